@@ -0,0 +1,289 @@
+//! Host benchmark of the wrapper's hot paths, against the mock Link of the
+//! `host` feature.
+//!
+//! Measures wall-clock time and heap allocations per call for the public
+//! `Link`, `AudioLink`, `SessionState` and `Timeline` operations, like the
+//! on-device `benchmark` example, so that changes to the Rust layer can be
+//! compared without flashing a board. The mock's own cost is small but not
+//! Link's: absolute numbers say little about the device, relative changes
+//! between two runs say a lot.
+//!
+//! ```sh
+//! cargo bench --features host
+//! # Only operations containing "Timeline"
+//! cargo bench --features host -- Timeline
+//! ```
+//!
+//! Each operation is warmed up, then timed in samples of a batch of calls,
+//! with the batch sized so that a sample takes about a millisecond. Every
+//! result is printed as one CSV line, prefixed with `BENCH,`, in the same
+//! layout as the on-device benchmark with nanoseconds instead of cycles:
+//!
+//! ```text
+//! BENCH,chip,peers,operation,iterations,mean_ns,min_ns,p99_ns,max_ns,allocs_per_call,alloc_bytes_per_call
+//! ```
+//!
+//! `chip` is `host`, and `peers` is `off` for the run with Link disabled.
+//! The suite runs again with 0, 1 and 8 other enabled instances in the
+//! process, which shows the cost of commits reaching more peers.
+//! `iterations` is the total number of timed calls, and min, p99 and max are
+//! of the per-call time of each sample.
+//!
+//! Allocations are counted with a counting global allocator, across all
+//! threads, so callback dispatch in the mock can add a small fraction per
+//! call to operations that commit.
+
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    hint::black_box,
+    sync::atomic::{AtomicUsize, Ordering},
+    time::{Duration, Instant},
+};
+
+use esp_idf_ableton_link::{Beats, Link, SessionState, SessionStatePool, TransportState};
+
+const QUANTUM: f64 = 4.0;
+const WARM_UP: Duration = Duration::from_millis(50);
+const SAMPLE_TIME: Duration = Duration::from_millis(1);
+const SAMPLES: usize = 100;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+static ALLOCATED_BYTES: AtomicUsize = AtomicUsize::new(0);
+
+struct CountingAllocator;
+
+// Safety: forwards to the system allocator, only counting calls.
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        ALLOCATED_BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        // Safety: forwarded from the caller.
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        // Safety: forwarded from the caller.
+        unsafe { System.dealloc(ptr, layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        ALLOCATED_BYTES.fetch_add(new_size, Ordering::Relaxed);
+        // Safety: forwarded from the caller.
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+struct Bench {
+    peers: String,
+    filter: Option<String>,
+}
+
+impl Bench {
+    #[allow(
+        clippy::cast_possible_truncation,
+        clippy::cast_precision_loss,
+        clippy::cast_sign_loss
+    )]
+    fn run(&self, operation: &str, mut f: impl FnMut()) {
+        if self
+            .filter
+            .as_ref()
+            .is_some_and(|filter| !operation.contains(filter.as_str()))
+        {
+            return;
+        }
+
+        // Warm up caches and any lazy initialization, and find how many
+        // calls fill a sample.
+        let start = Instant::now();
+        let mut calls = 0u32;
+        while start.elapsed() < WARM_UP {
+            f();
+            calls += 1;
+        }
+        let batch =
+            (f64::from(calls) * SAMPLE_TIME.as_secs_f64() / WARM_UP.as_secs_f64()).max(1.0) as u32;
+
+        // Allocate before counting allocations.
+        let mut samples = Vec::with_capacity(SAMPLES);
+
+        let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+        let bytes = ALLOCATED_BYTES.load(Ordering::Relaxed);
+        let mut total = Duration::ZERO;
+        for _ in 0..SAMPLES {
+            let start = Instant::now();
+            for _ in 0..batch {
+                f();
+            }
+            let elapsed = start.elapsed();
+            total += elapsed;
+            samples.push(elapsed.as_secs_f64() * 1e9 / f64::from(batch));
+        }
+        let allocations = ALLOCATIONS.load(Ordering::Relaxed) - allocations;
+        let bytes = ALLOCATED_BYTES.load(Ordering::Relaxed) - bytes;
+
+        samples.sort_unstable_by(f64::total_cmp);
+        let iterations = SAMPLES as f64 * f64::from(batch);
+        println!(
+            "BENCH,host,{},{operation},{iterations},{:.1},{:.1},{:.1},{:.1},{:.3},{:.1}",
+            self.peers,
+            total.as_secs_f64() * 1e9 / iterations,
+            samples[0],
+            samples[samples.len() * 99 / 100],
+            samples[samples.len() - 1],
+            allocations as f64 / iterations,
+            bytes as f64 / iterations,
+        );
+    }
+}
+
+fn run_suite(link: &mut Link, bench: &Bench) {
+    let mut state = SessionState::new().unwrap();
+    link.capture_app_session_state_into(&mut state);
+    let now = link.clock_now();
+
+    // Link
+    bench.run("Link::clock_now", || {
+        black_box(link.clock_now());
+    });
+    bench.run("Link::num_peers", || {
+        black_box(link.num_peers());
+    });
+    bench.run("Link::is_enabled", || {
+        black_box(link.is_enabled());
+    });
+    bench.run("Link::capture_app_session_state", || {
+        black_box(link.capture_app_session_state().unwrap());
+    });
+    bench.run("Link::capture_app_session_state_into", || {
+        link.capture_app_session_state_into(&mut state);
+    });
+    bench.run("Link::commit_app_session_state", || {
+        link.commit_app_session_state(&state);
+    });
+
+    // Session state pool
+    let pool = SessionStatePool::<2>::new().unwrap();
+    bench.run("SessionStatePool::acquire", || {
+        black_box(pool.acquire().unwrap());
+    });
+
+    // SessionState
+    bench.run("SessionState::new", || {
+        black_box(SessionState::new().unwrap());
+    });
+    bench.run("SessionState::tempo", || {
+        black_box(state.tempo());
+    });
+    bench.run("SessionState::beat_at_time", || {
+        black_box(state.beat_at_time(black_box(now), QUANTUM));
+    });
+    bench.run("SessionState::phase_at_time", || {
+        black_box(state.phase_at_time(black_box(now), QUANTUM));
+    });
+    bench.run("SessionState::time_at_beat", || {
+        black_box(state.time_at_beat(black_box(16.0), QUANTUM));
+    });
+    bench.run("SessionState::transport_state", || {
+        black_box(state.transport_state());
+    });
+    bench.run("SessionState::timeline", || {
+        black_box(state.timeline());
+    });
+    let mut beats = [0.0; 256];
+    bench.run("SessionState::beats_for_buffer/256", || {
+        state.beats_for_buffer(now, 48_000, QUANTUM, &mut beats);
+    });
+    let tempo = state.tempo();
+    bench.run("SessionState::set_tempo", || {
+        state.set_tempo(black_box(tempo), now);
+    });
+    bench.run("SessionState::request_beat_at_time", || {
+        state.request_beat_at_time(0.0, now, QUANTUM);
+    });
+    bench.run("SessionState::set_transport_state_at", || {
+        state.set_transport_state_at(TransportState::Stop, now);
+    });
+
+    // Timeline
+    let timeline = state.timeline();
+    bench.run("Timeline::beat_at_time", || {
+        black_box(timeline.beat_at_time(black_box(now), QUANTUM));
+    });
+    bench.run("Timeline::phase_at_time", || {
+        black_box(timeline.phase_at_time(black_box(now), QUANTUM));
+    });
+    bench.run("Timeline::time_at_beat", || {
+        black_box(timeline.time_at_beat(black_box(16.0), QUANTUM));
+    });
+    let quantum = Beats::from_beats(4);
+    bench.run("Timeline::beat_at_time_fixed", || {
+        black_box(timeline.beat_at_time_fixed(black_box(now), quantum));
+    });
+    bench.run("Timeline::time_at_beat_fixed", || {
+        black_box(timeline.time_at_beat_fixed(black_box(Beats::from_beats(16)), quantum));
+    });
+    bench.run("Timeline::beats_for_buffer/256", || {
+        timeline.beats_for_buffer(now, 48_000, QUANTUM, &mut beats);
+    });
+
+    // Shared timeline, refreshed on every commit
+    let shared = link.shared_timeline().unwrap();
+    bench.run("SharedTimeline::timeline", || {
+        black_box(shared.timeline());
+    });
+
+    // AudioLink
+    let audio_link = link.bind_audio_thread();
+    bench.run("AudioLink::clock_now", || {
+        black_box(audio_link.clock_now());
+    });
+    bench.run("AudioLink::capture_session_state", || {
+        black_box(audio_link.capture_session_state().unwrap());
+    });
+    bench.run("AudioLink::capture_session_state_into", || {
+        audio_link.capture_session_state_into(&mut state);
+    });
+    bench.run("AudioLink::commit_session_state", || {
+        audio_link.commit_session_state(&state);
+    });
+}
+
+fn main() {
+    // Like criterion, take the first argument that isn't a flag (cargo bench
+    // passes --bench) as a filter on operation names.
+    let filter = std::env::args().skip(1).find(|arg| !arg.starts_with('-'));
+    println!(
+        "BENCH,chip,peers,operation,iterations,mean_ns,min_ns,p99_ns,max_ns,allocs_per_call,alloc_bytes_per_call"
+    );
+
+    let mut link = Link::new(120.0).unwrap();
+    link.enable_transport_sync();
+
+    // Without a session, as a baseline.
+    let bench = Bench {
+        peers: "off".into(),
+        filter: filter.clone(),
+    };
+    run_suite(&mut link, &bench);
+
+    link.enable();
+    let mut others = Vec::new();
+    for peers in [0, 1, 8] {
+        while others.len() < peers {
+            let other = Link::new(120.0).unwrap();
+            other.enable_transport_sync();
+            other.enable();
+            others.push(other);
+        }
+        let bench = Bench {
+            peers: link.num_peers().to_string(),
+            filter: filter.clone(),
+        };
+        run_suite(&mut link, &bench);
+    }
+}
@@ -1,4 +1,12 @@
 fn main() {
+    // The host feature replaces ESP-IDF on workstations, so there is nothing
+    // to configure. For ESP-IDF targets, the crate refuses to build with it.
+    if std::env::var_os("CARGO_FEATURE_HOST").is_some()
+        && std::env::var("CARGO_CFG_TARGET_OS").as_deref() != Ok("espidf")
+    {
+        return;
+    }
+
     // Propagate cfgs from esp-idf-sys (e.g., esp_idf_compiler_cxx_exceptions)
     embuild::espidf::sysenv::output();
 
@@ -0,0 +1,333 @@
+//! On-device benchmark of the wrapper's hot paths.
+//!
+//! Measures CPU cycles and heap allocations per call for the public `Link`,
+//! `AudioLink`, `SessionState` and `Timeline` operations, and for callbacks
+//! on the Link thread. The suite runs once with Link disabled, then again
+//! every time the number of peers changes, so starting and stopping other
+//! Link peers on the network gives results for 0, 1 and N peers.
+//!
+//! Build and flash (replace `esp32` in the target and `MCU` for the S2/S3):
+//!
+//! ```sh
+//! MCU=esp32 ESP_IDF_VERSION=v5.3.3 \
+//! ESP_IDF_SYS_ROOT_CRATE=esp-idf-ableton-link \
+//! ESP_IDF_SDKCONFIG_DEFAULTS="sdkconfig.defaults.documentation;examples/sdkconfig.defaults.benchmark" \
+//! WIFI_SSID=... WIFI_PASSWORD=... \
+//! cargo run --release --example benchmark --features stats \
+//!     --target xtensa-esp32-espidf -Zbuild-std=std,panic_abort
+//! ```
+//!
+//! Every result is printed as one CSV line, prefixed with `BENCH,`:
+//!
+//! ```text
+//! BENCH,chip,peers,operation,iterations,mean_cycles,min_cycles,p99_cycles,max_cycles,allocs_per_call,alloc_bytes_per_call
+//! ```
+//!
+//! `peers` is `off` for the run with Link disabled. Callback lines are
+//! measured with the `stats` feature's histograms, which give the number of
+//! calls, min, a p99 upper bound and max, but no mean or allocations; those
+//! fields are left empty. They commit thousands of tempo changes to trigger
+//! the callback, so they run on a second Link instance that is never
+//! enabled, which keeps those changes out of the session; their operation
+//! names end in `/disabled`.
+//!
+//! Each core has a cycle counter of its own. The benchmark runs on the main
+//! task, which ESP-IDF pins to a core (`CONFIG_ESP_MAIN_TASK_AFFINITY`, core
+//! 0 by default), so every call is timed on one counter.
+//!
+//! Allocations are counted with ESP-IDF heap hooks
+//! (`CONFIG_HEAP_USE_HOOKS`), so they include allocations made by the Link
+//! library itself. They are counted across all tasks, so background
+//! activity (Wi-Fi, the Link thread) can add a small fraction per call.
+
+#![feature(asm_experimental_arch)]
+
+use std::{
+    ffi::{CStr, c_void},
+    hint::black_box,
+    sync::atomic::{AtomicU32, AtomicUsize, Ordering},
+};
+
+use esp_idf_ableton_link::{Link, SessionState, SessionStatePool, TransportState};
+use esp_idf_svc::{
+    eventloop::EspSystemEventLoop,
+    hal::{delay::FreeRtos, peripherals::Peripherals},
+    nvs::EspDefaultNvsPartition,
+    sys,
+    wifi::{BlockingWifi, ClientConfiguration, Configuration, EspWifi},
+};
+
+const ITERATIONS: u32 = 1000;
+const QUANTUM: f64 = 4.0;
+
+static ALLOCATIONS: AtomicU32 = AtomicU32::new(0);
+static ALLOCATED_BYTES: AtomicUsize = AtomicUsize::new(0);
+
+// Called by ESP-IDF for every successful heap allocation when
+// CONFIG_HEAP_USE_HOOKS is enabled.
+#[unsafe(no_mangle)]
+extern "C" fn esp_heap_trace_alloc_hook(_ptr: *mut c_void, size: usize, _caps: u32) {
+    ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+    ALLOCATED_BYTES.fetch_add(size, Ordering::Relaxed);
+}
+
+#[unsafe(no_mangle)]
+extern "C" fn esp_heap_trace_free_hook(_ptr: *mut c_void) {}
+
+fn cycle_count() -> u32 {
+    let cycles: u32;
+    // Safety: reading CCOUNT has no side effects.
+    unsafe {
+        core::arch::asm!("rsr.ccount {0}", out(reg) cycles, options(nomem, nostack));
+    }
+    cycles
+}
+
+struct Bench {
+    chip: &'static str,
+    peers: String,
+}
+
+impl Bench {
+    fn run(&self, operation: &str, mut f: impl FnMut()) {
+        // Warm up caches and any lazy initialization.
+        f();
+
+        // Allocate before counting allocations.
+        let mut samples = Vec::with_capacity(ITERATIONS as usize);
+
+        let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+        let bytes = ALLOCATED_BYTES.load(Ordering::Relaxed);
+        for _ in 0..ITERATIONS {
+            let start = cycle_count();
+            f();
+            samples.push(cycle_count().wrapping_sub(start));
+        }
+        let allocations = ALLOCATIONS.load(Ordering::Relaxed) - allocations;
+        let bytes = ALLOCATED_BYTES.load(Ordering::Relaxed) - bytes;
+
+        samples.sort_unstable();
+        let total: u64 = samples.iter().map(|&cycles| u64::from(cycles)).sum();
+        let p99 = samples[samples.len() * 99 / 100];
+        let iterations = f64::from(ITERATIONS);
+        println!(
+            "BENCH,{},{},{operation},{ITERATIONS},{:.1},{},{p99},{},{:.3},{:.1}",
+            self.chip,
+            self.peers,
+            total as f64 / iterations,
+            samples[0],
+            samples[samples.len() - 1],
+            f64::from(allocations) / iterations,
+            bytes as f64 / iterations,
+        );
+    }
+}
+
+fn run_suite(link: &mut Link, bench: &Bench) {
+    let mut state = SessionState::new().unwrap();
+    link.capture_app_session_state_into(&mut state);
+    let now = link.clock_now();
+
+    // Link
+    bench.run("Link::clock_now", || {
+        black_box(link.clock_now());
+    });
+    bench.run("Link::num_peers", || {
+        black_box(link.num_peers());
+    });
+    bench.run("Link::is_enabled", || {
+        black_box(link.is_enabled());
+    });
+    bench.run("Link::capture_app_session_state", || {
+        black_box(link.capture_app_session_state().unwrap());
+    });
+    bench.run("Link::capture_app_session_state_into", || {
+        link.capture_app_session_state_into(&mut state);
+    });
+    bench.run("Link::commit_app_session_state", || {
+        link.commit_app_session_state(&state);
+    });
+
+    // Session state pool
+    let pool = SessionStatePool::<2>::new().unwrap();
+    bench.run("SessionStatePool::acquire", || {
+        black_box(pool.acquire().unwrap());
+    });
+
+    // SessionState
+    bench.run("SessionState::new", || {
+        black_box(SessionState::new().unwrap());
+    });
+    bench.run("SessionState::tempo", || {
+        black_box(state.tempo());
+    });
+    bench.run("SessionState::beat_at_time", || {
+        black_box(state.beat_at_time(black_box(now), QUANTUM));
+    });
+    bench.run("SessionState::phase_at_time", || {
+        black_box(state.phase_at_time(black_box(now), QUANTUM));
+    });
+    bench.run("SessionState::time_at_beat", || {
+        black_box(state.time_at_beat(black_box(16.0), QUANTUM));
+    });
+    bench.run("SessionState::transport_state", || {
+        black_box(state.transport_state());
+    });
+    bench.run("SessionState::timeline", || {
+        black_box(state.timeline());
+    });
+    let mut beats = [0.0; 256];
+    bench.run("SessionState::beats_for_buffer/256", || {
+        state.beats_for_buffer(now, 48_000, QUANTUM, &mut beats);
+    });
+    let tempo = state.tempo();
+    bench.run("SessionState::set_tempo", || {
+        state.set_tempo(black_box(tempo), now);
+    });
+    bench.run("SessionState::request_beat_at_time", || {
+        state.request_beat_at_time(0.0, now, QUANTUM);
+    });
+    bench.run("SessionState::set_transport_state_at", || {
+        state.set_transport_state_at(TransportState::Stop, now);
+    });
+
+    // Timeline
+    let timeline = state.timeline();
+    bench.run("Timeline::beat_at_time", || {
+        black_box(timeline.beat_at_time(black_box(now), QUANTUM));
+    });
+    bench.run("Timeline::phase_at_time", || {
+        black_box(timeline.phase_at_time(black_box(now), QUANTUM));
+    });
+    bench.run("Timeline::time_at_beat", || {
+        black_box(timeline.time_at_beat(black_box(16.0), QUANTUM));
+    });
+    bench.run("Timeline::beats_for_buffer/256", || {
+        timeline.beats_for_buffer(now, 48_000, QUANTUM, &mut beats);
+    });
+
+    // Callbacks: the tempo callback runs on the Link thread after every
+    // committed tempo change, so time it with the stats feature.
+    bench_callbacks(bench);
+
+    // AudioLink
+    let audio_link = link.bind_audio_thread();
+    bench.run("AudioLink::clock_now", || {
+        black_box(audio_link.clock_now());
+    });
+    bench.run("AudioLink::capture_session_state", || {
+        black_box(audio_link.capture_session_state().unwrap());
+    });
+    bench.run("AudioLink::capture_session_state_into", || {
+        audio_link.capture_session_state_into(&mut state);
+    });
+    bench.run("AudioLink::commit_session_state", || {
+        audio_link.commit_session_state(&state);
+    });
+}
+
+fn bench_callbacks(bench: &Bench) {
+    static CALLS: AtomicU32 = AtomicU32::new(0);
+
+    // Never enabled, so the tempo changes stay out of the session.
+    let mut link = Link::new(120.0).unwrap();
+    let mut state = link.capture_app_session_state().unwrap();
+    let tempo = state.tempo();
+    let mut measure = |link: &mut Link, operation: &str| {
+        link.reset_stats();
+        for i in 0..ITERATIONS {
+            // Alternate the tempo so that every commit changes it.
+            let bpm = if i % 2 == 0 { tempo + 1.0 } else { tempo };
+            state.set_tempo(bpm, link.clock_now());
+            link.commit_app_session_state(&state);
+            // Leave the Link thread time to run the callback.
+            FreeRtos::delay_ms(2);
+        }
+        let callbacks = link.stats().callbacks;
+        println!(
+            "BENCH,{},{},{operation}/disabled,{},,{},{},{},,",
+            bench.chip,
+            bench.peers,
+            callbacks.calls,
+            callbacks.min_cycles,
+            callbacks.p99_cycles,
+            callbacks.max_cycles,
+        );
+    };
+
+    link.set_tempo_callback(|tempo| {
+        black_box(tempo);
+        CALLS.fetch_add(1, Ordering::Relaxed);
+    });
+    measure(&mut link, "Link::tempo_callback/boxed");
+
+    link.set_static_tempo_callback(|tempo| {
+        black_box(tempo);
+        CALLS.fetch_add(1, Ordering::Relaxed);
+    });
+    measure(&mut link, "Link::tempo_callback/static");
+}
+
+fn connect_wifi() -> BlockingWifi<EspWifi<'static>> {
+    let peripherals = Peripherals::take().unwrap();
+    let sysloop = EspSystemEventLoop::take().unwrap();
+    let nvs = EspDefaultNvsPartition::take().unwrap();
+
+    let mut wifi = BlockingWifi::wrap(
+        EspWifi::new(peripherals.modem, sysloop.clone(), Some(nvs)).unwrap(),
+        sysloop,
+    )
+    .unwrap();
+    wifi.set_configuration(&Configuration::Client(ClientConfiguration {
+        ssid: env!("WIFI_SSID").try_into().unwrap(),
+        password: env!("WIFI_PASSWORD").try_into().unwrap(),
+        ..Default::default()
+    }))
+    .unwrap();
+    wifi.start().unwrap();
+    wifi.connect().unwrap();
+    wifi.wait_netif_up().unwrap();
+    wifi
+}
+
+fn main() {
+    sys::link_patches();
+    esp_idf_svc::log::EspLogger::initialize_default();
+
+    let chip = CStr::from_bytes_until_nul(sys::CONFIG_IDF_TARGET)
+        .unwrap()
+        .to_str()
+        .unwrap();
+    println!(
+        "BENCH,chip,peers,operation,iterations,mean_cycles,min_cycles,p99_cycles,max_cycles,allocs_per_call,alloc_bytes_per_call"
+    );
+
+    let mut link = Link::new(120.0).unwrap();
+
+    // Without networking, as a baseline.
+    let bench = Bench {
+        chip,
+        peers: "off".into(),
+    };
+    run_suite(&mut link, &bench);
+
+    let _wifi = connect_wifi();
+    link.enable();
+
+    // Rerun whenever the number of peers changes.
+    let mut measured = None;
+    loop {
+        let peers = link.num_peers();
+        if measured != Some(peers) {
+            // Let the session settle after a peer joins or leaves.
+            FreeRtos::delay_ms(2000);
+            let bench = Bench {
+                chip,
+                peers: peers.to_string(),
+            };
+            run_suite(&mut link, &bench);
+            measured = Some(peers);
+        }
+        FreeRtos::delay_ms(1000);
+    }
+}
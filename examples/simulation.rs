@@ -0,0 +1,302 @@
+//! Many-peer session simulation, against the mock Link of the `host`
+//! feature.
+//!
+//! Starts dozens of virtual peers in one process, each a `Link` instance
+//! driven by a thread of its own, the way an application drives Link from a
+//! task: reading notifications from an event queue, and starting and
+//! stopping the transport with a `Transport`. It then takes the session
+//! through peers joining, a tempo change, a transport start by one peer and
+//! half of the peers leaving, and checks that every peer agrees.
+//!
+//! ```sh
+//! cargo run --release --example simulation --features host
+//! # With 64 peers
+//! cargo run --release --example simulation --features host -- 64
+//! ```
+//!
+//! The mock delivers commits to the other peers immediately and shares one
+//! clock between them, so this measures the wrapper's notification and
+//! publishing paths under load, from a peer's commit to every other peer's
+//! task seeing the change, not Link's clock measurement or network latency.
+//! Peers check for commands from the main thread between waits for events
+//! of up to a millisecond, which adds up to that much to each latency.
+
+use std::{
+    sync::mpsc::{self, Receiver, Sender},
+    thread::{self, JoinHandle},
+};
+
+use esp_idf_ableton_link::{
+    Duration, Instant, Link, LinkEvent, LinkEventKind, Transport, TransportState,
+};
+
+const DEFAULT_PEERS: usize = 32;
+const QUANTUM: f64 = 4.0;
+const TIMEOUT: std::time::Duration = std::time::Duration::from_secs(10);
+
+/// What the main thread asks of a peer.
+enum Command {
+    SetTempo(f64),
+    Start,
+    /// Report the beat at a time, according to the peer's session state.
+    BeatAt(Instant),
+    Leave,
+}
+
+/// What a peer reports to the main thread.
+enum Report {
+    Event(usize, LinkEvent),
+    /// The launch time of a transport start, and when the peer acted on it.
+    Started {
+        launch: Instant,
+        at: Instant,
+    },
+    Beat(f64),
+    /// The number of events the peer's queue dropped, as it leaves.
+    Left(u32),
+}
+
+struct Peer {
+    commands: Sender<Command>,
+    thread: JoinHandle<()>,
+}
+
+fn spawn_peer(index: usize, reports: Sender<Report>) -> Peer {
+    let (commands, command_receiver) = mpsc::channel();
+    let thread = thread::spawn(move || run_peer(index, &command_receiver, &reports));
+    Peer { commands, thread }
+}
+
+fn run_peer(index: usize, commands: &Receiver<Command>, reports: &Sender<Report>) {
+    let mut link = Link::new(120.0).unwrap();
+    link.enable_transport_sync();
+    // Room for every other peer joining at once.
+    let mut events = link.event_queue::<256>().unwrap();
+    let mut transport = Transport::new(QUANTUM).unwrap();
+    link.enable();
+
+    loop {
+        while let Some(event) = events.recv_timeout(Duration::from_millis(1)) {
+            reports.send(Report::Event(index, event)).unwrap();
+            if event.kind == LinkEventKind::TransportState(TransportState::Play)
+                && let Some(launch) = transport.sync(&mut link)
+            {
+                reports
+                    .send(Report::Started {
+                        launch: launch.time,
+                        at: link.clock_now(),
+                    })
+                    .unwrap();
+            }
+        }
+        match commands.try_recv() {
+            Ok(Command::SetTempo(bpm)) => {
+                let mut state = link.capture_app_session_state().unwrap();
+                state.set_tempo(bpm, link.clock_now());
+                link.commit_app_session_state(&state);
+            }
+            Ok(Command::Start) => {
+                let launch = transport.start(&mut link);
+                reports
+                    .send(Report::Started {
+                        launch: launch.time,
+                        at: link.clock_now(),
+                    })
+                    .unwrap();
+            }
+            Ok(Command::BeatAt(time)) => {
+                let state = link.capture_app_session_state().unwrap();
+                let beat = state.beat_at_time(time, QUANTUM);
+                reports.send(Report::Beat(beat)).unwrap();
+            }
+            Ok(Command::Leave) | Err(mpsc::TryRecvError::Disconnected) => break,
+            Err(mpsc::TryRecvError::Empty) => {}
+        }
+    }
+    link.disable();
+    reports.send(Report::Left(events.dropped_events())).unwrap();
+}
+
+/// Latencies from the start of a step to each peer reporting it, in
+/// microseconds.
+struct Latencies(Vec<i64>);
+
+impl Latencies {
+    fn print(&mut self, step: &str) {
+        self.0.sort_unstable();
+        let count = self.0.len();
+        let mean = self.0.iter().sum::<i64>() / i64::try_from(count.max(1)).unwrap();
+        println!(
+            "{step}: {count} peers, latency min {} us, mean {mean} us, max {} us",
+            self.0.first().unwrap_or(&0),
+            self.0.last().unwrap_or(&0),
+        );
+    }
+}
+
+/// The peers, and the channel they report on.
+struct Session {
+    peers: Vec<Peer>,
+    reports: Receiver<Report>,
+    // For reading the shared clock only.
+    clock: Link,
+    dropped: u32,
+}
+
+impl Session {
+    fn now(&self) -> Instant {
+        self.clock.clock_now()
+    }
+
+    /// Wait until `done` has accepted reports from `count` peers.
+    fn collect(&mut self, count: usize, mut done: impl FnMut(&Report) -> bool) {
+        let mut accepted = 0;
+        while accepted < count {
+            let Ok(report) = self.reports.recv_timeout(TIMEOUT) else {
+                println!("Timed out with {accepted} of {count} peers");
+                return;
+            };
+            if let Report::Left(dropped) = report {
+                self.dropped += dropped;
+            }
+            if done(&report) {
+                accepted += 1;
+            }
+        }
+    }
+
+    /// Wait until the first `count` peers see `num_peers` peers.
+    fn wait_for_peers(&mut self, step: &str, start: Instant, count: usize, num_peers: u64) {
+        let mut seen = vec![false; count];
+        let mut latencies = Latencies(Vec::new());
+        self.collect(count, |report| match *report {
+            Report::Event(index, event)
+                if index < count
+                    && event.kind == LinkEventKind::NumPeers(num_peers)
+                    && !seen[index] =>
+            {
+                seen[index] = true;
+                latencies.0.push((event.time - start).as_micros());
+                true
+            }
+            _ => false,
+        });
+        latencies.print(step);
+    }
+
+    /// A tempo change by one peer reaches all the others.
+    fn tempo_change(&mut self, bpm: f64) {
+        let start = self.now();
+        self.peers[0].commands.send(Command::SetTempo(bpm)).unwrap();
+        let mut latencies = Latencies(Vec::new());
+        self.collect(self.peers.len() - 1, |report| match *report {
+            Report::Event(index, event)
+                if index != 0 && event.kind == LinkEventKind::Tempo(bpm) =>
+            {
+                latencies.0.push((event.time - start).as_micros());
+                true
+            }
+            _ => false,
+        });
+        latencies.print("Tempo change");
+    }
+
+    /// A transport start by one peer: everyone launches at the same time.
+    fn transport_start(&mut self) {
+        let start = self.now();
+        self.peers[1].commands.send(Command::Start).unwrap();
+        let mut launches = Vec::new();
+        let mut latencies = Latencies(Vec::new());
+        self.collect(self.peers.len(), |report| match *report {
+            Report::Started { launch, at } => {
+                launches.push(launch);
+                latencies.0.push((at - start).as_micros());
+                true
+            }
+            _ => false,
+        });
+        latencies.print("Transport start");
+        let first = launches.iter().min().copied().unwrap_or(start);
+        let last = launches.iter().max().copied().unwrap_or(start);
+        println!(
+            "Transport start: launch times spread over {} us",
+            (last - first).as_micros()
+        );
+    }
+
+    /// Everyone agrees on the beat.
+    fn beat_agreement(&mut self) {
+        let at = self.now().add_millis(100);
+        for peer in &self.peers {
+            peer.commands.send(Command::BeatAt(at)).unwrap();
+        }
+        let mut beats = Vec::new();
+        self.collect(self.peers.len(), |report| match *report {
+            Report::Beat(beat) => {
+                beats.push(beat);
+                true
+            }
+            _ => false,
+        });
+        let low = beats.iter().copied().fold(f64::INFINITY, f64::min);
+        let high = beats.iter().copied().fold(f64::NEG_INFINITY, f64::max);
+        println!(
+            "Beat agreement: {} peers within {:.6} beats",
+            beats.len(),
+            high - low
+        );
+    }
+
+    /// Peers from `remaining` on leave; the others see the new peer count.
+    fn leave(&mut self, remaining: usize) {
+        let start = self.now();
+        let leaving: Vec<_> = self.peers.drain(remaining..).collect();
+        for peer in &leaving {
+            peer.commands.send(Command::Leave).unwrap();
+        }
+        self.wait_for_peers("Leave", start, remaining, remaining as u64 - 1);
+        for peer in leaving {
+            peer.thread.join().unwrap();
+        }
+    }
+
+    /// All peers leave.
+    fn finish(mut self) {
+        for peer in &self.peers {
+            peer.commands.send(Command::Leave).unwrap();
+        }
+        // Collect the drop counts of the peers that are still there.
+        let count = self.peers.len();
+        self.collect(count, |report| matches!(report, Report::Left(_)));
+        for peer in self.peers.drain(..) {
+            peer.thread.join().unwrap();
+        }
+        println!("Dropped events: {}", self.dropped);
+    }
+}
+
+fn main() {
+    let count = std::env::args()
+        .nth(1)
+        .map_or(DEFAULT_PEERS, |arg| arg.parse().expect("peer count"));
+    assert!(count >= 2, "a session needs at least 2 peers");
+    let clock = Link::new(120.0).unwrap();
+    let (report_sender, reports) = mpsc::channel();
+
+    let start = clock.clock_now();
+    let peers = (0..count)
+        .map(|index| spawn_peer(index, report_sender.clone()))
+        .collect();
+    let mut session = Session {
+        peers,
+        reports,
+        clock,
+        dropped: 0,
+    };
+    session.wait_for_peers("Join", start, count, count as u64 - 1);
+    session.tempo_change(132.5);
+    session.transport_start();
+    session.beat_agreement();
+    session.leave(count - count / 2);
+    session.finish();
+}
@@ -0,0 +1,445 @@
+//! Futures for Link notifications, enabled by the `async` feature.
+
+use std::{
+    cell::UnsafeCell,
+    ffi::c_void,
+    future::Future,
+    pin::Pin,
+    ptr,
+    sync::{
+        Arc,
+        atomic::{AtomicU8, Ordering},
+    },
+    task::{Context, Poll, Waker},
+};
+
+use crate::{
+    Link, LinkError, SessionStatePool, TransportState,
+    callback::Subscription,
+    double_buffer::DoubleBuffer,
+    idf::{
+        EspError, esp_timer_create, esp_timer_create_args_t, esp_timer_delete,
+        esp_timer_dispatch_t_ESP_TIMER_TASK, esp_timer_handle_t, esp_timer_start_once,
+        esp_timer_stop,
+    },
+    timeline::Timeline,
+};
+
+const WAITING: u8 = 0;
+const REGISTERING: u8 = 1;
+const WAKING: u8 = 2;
+
+/// A slot for one [`Waker`], which can be woken from any thread without
+/// taking a lock.
+///
+/// Registering and waking are coordinated through a small state machine: a
+/// wake that arrives while a waker is being registered is handed to the
+/// registering side, which wakes the new waker itself, so no wake-up is ever
+/// lost.
+struct WakerSlot {
+    state: AtomicU8,
+    waker: UnsafeCell<Option<Waker>>,
+}
+
+// Safety: `waker` is only accessed by whichever side moved `state` away from
+// WAITING, so never by two threads at once.
+unsafe impl Sync for WakerSlot {}
+
+impl WakerSlot {
+    const fn new() -> Self {
+        Self {
+            state: AtomicU8::new(WAITING),
+            waker: UnsafeCell::new(None),
+        }
+    }
+
+    /// Store `waker`, to be woken by the next [`wake`](Self::wake).
+    fn register(&self, waker: &Waker) {
+        match self
+            .state
+            .compare_exchange(WAITING, REGISTERING, Ordering::Acquire, Ordering::Acquire)
+            .unwrap_or_else(|state| state)
+        {
+            WAITING => {
+                // Safety: we moved the state to REGISTERING, which excludes
+                // all other access to the waker.
+                let slot = unsafe { &mut *self.waker.get() };
+                if !slot.as_ref().is_some_and(|old| old.will_wake(waker)) {
+                    *slot = Some(waker.clone());
+                }
+                if self
+                    .state
+                    .compare_exchange(REGISTERING, WAITING, Ordering::AcqRel, Ordering::Acquire)
+                    .is_err()
+                {
+                    // A wake arrived while registering, and left the waker to
+                    // us. The state is REGISTERING | WAKING.
+                    let waker = slot.take();
+                    self.state.swap(WAITING, Ordering::AcqRel);
+                    if let Some(waker) = waker {
+                        waker.wake();
+                    }
+                }
+            }
+            // A wake is in progress, and may have missed this waker.
+            WAKING => waker.wake_by_ref(),
+            // Concurrent registration; see the AsyncEvents documentation.
+            _ => {}
+        }
+    }
+
+    /// Wake the registered waker, if any.
+    fn wake(&self) {
+        if self.state.fetch_or(WAKING, Ordering::AcqRel) == WAITING {
+            // Safety: we moved the state from WAITING to WAKING, which
+            // excludes all other access to the waker.
+            let waker = unsafe { (*self.waker.get()).take() };
+            self.state.fetch_and(!WAKING, Ordering::Release);
+            if let Some(waker) = waker {
+                waker.wake();
+            }
+        }
+    }
+}
+
+/// The latest value of one kind of notification, and the waker of the task
+/// waiting for the next one.
+struct Watch {
+    value: DoubleBuffer<2>,
+    waker: WakerSlot,
+}
+
+impl Watch {
+    const fn new() -> Self {
+        Self {
+            value: DoubleBuffer::new(),
+            waker: WakerSlot::new(),
+        }
+    }
+
+    /// Publish a new value. Must only be called by the single writer, the
+    /// Link thread.
+    #[allow(clippy::cast_possible_truncation)]
+    fn set(&self, bits: u64) {
+        self.value.store([bits as u32, (bits >> 32) as u32]);
+        self.waker.wake();
+    }
+
+    /// The number of values published so far.
+    fn generation(&self) -> u32 {
+        self.value.generation()
+    }
+
+    fn get(&self) -> u64 {
+        let [low, high] = self.value.load().1;
+        u64::from(high) << 32 | u64::from(low)
+    }
+}
+
+/// State shared between an [`AsyncEvents`] handle, the Link callbacks and
+/// the sleep timer.
+struct Shared {
+    num_peers: Watch,
+    tempo: Watch,
+    transport_state: Watch,
+    // Woken by the sleep timer, and by any change that can move a beat.
+    sleep: WakerSlot,
+}
+
+impl Shared {
+    fn wake_sleep(&self) {
+        self.sleep.wake();
+    }
+}
+
+fn num_peers_callback(shared: &Arc<Shared>) -> impl FnMut(u64) + Send + 'static {
+    let shared = Arc::clone(shared);
+    move |num_peers| {
+        shared.num_peers.set(num_peers);
+        // Joining a session can move beats.
+        shared.wake_sleep();
+    }
+}
+
+fn tempo_callback(shared: &Arc<Shared>) -> impl FnMut(f64) + Send + 'static {
+    let shared = Arc::clone(shared);
+    move |tempo| {
+        shared.tempo.set(tempo.to_bits());
+        shared.wake_sleep();
+    }
+}
+
+fn transport_state_callback(shared: &Arc<Shared>) -> impl FnMut(TransportState) + Send + 'static {
+    let shared = Arc::clone(shared);
+    move |state| {
+        shared.transport_state.set(bool::from(state).into());
+        shared.wake_sleep();
+    }
+}
+
+// esp_timer callback; the argument is the Shared state.
+extern "C" fn wake_sleep(shared: *mut c_void) {
+    // Safety: the timer holds a strong reference to the Shared state, which
+    // is only released after the timer is deleted.
+    unsafe { &*shared.cast::<Shared>() }.wake_sleep();
+}
+
+/// Futures for Link's peer count, tempo and transport state notifications,
+/// and for sleeping until a beat.
+///
+/// Created by [`Link::async_events`]. Requires the `async` feature.
+///
+/// Each future wakes its task through a lock-free waker slot, from the Link
+/// thread (for notifications) or the `esp_timer` task (for sleeps). No
+/// `FreeRTOS` task is blocked while waiting, so a single executor task can
+/// serve Link alongside the rest of the application.
+///
+/// Each kind of future supports one waiting task at a time: awaiting, for
+/// example, [`tempo_changed`](Self::tempo_changed) from two tasks at once
+/// leaves one of them waiting for the next change after that. Selecting
+/// over different kinds from one task is fine.
+///
+/// Like [`EventReceiver`](crate::EventReceiver), the futures only report the
+/// latest value. Several changes between two polls resolve a future once.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::Link;
+///
+/// let link = Link::new(120.0).unwrap();
+/// let events = link.async_events().unwrap();
+/// link.enable();
+///
+/// # async fn run(link: &Link, events: esp_idf_ableton_link::AsyncEvents<'_>) {
+/// loop {
+///     // Run the executor's other tasks until the next downbeat
+///     let state = link.capture_app_session_state().unwrap();
+///     let next_bar = (state.beat_at_time(link.clock_now(), 4.0) / 4.0).floor() * 4.0 + 4.0;
+///     events.sleep_until_beat(next_bar, 4.0).await;
+///     log::info!("Downbeat");
+/// }
+/// # }
+/// ```
+pub struct AsyncEvents<'a> {
+    link: &'a Link,
+    shared: Arc<Shared>,
+    timer: esp_timer_handle_t,
+    // For extracting timelines without allocating.
+    pool: SessionStatePool<1>,
+    // Feeds the shared state from every Link notification.
+    _subscription: Subscription,
+}
+
+// Safety: the esp_timer API is thread-safe, and the rest is Sync.
+unsafe impl Send for AsyncEvents<'_> {}
+unsafe impl Sync for AsyncEvents<'_> {}
+
+impl<'a> AsyncEvents<'a> {
+    pub(crate) fn new(link: &'a Link) -> Result<Self, LinkError> {
+        let pool = SessionStatePool::new()?;
+        let shared = Arc::new(Shared {
+            num_peers: Watch::new(),
+            tempo: Watch::new(),
+            transport_state: Watch::new(),
+            sleep: WakerSlot::new(),
+        });
+        let subscription = link.callbacks.subscribe(
+            num_peers_callback(&shared),
+            tempo_callback(&shared),
+            transport_state_callback(&shared),
+        )?;
+
+        let arg = Arc::into_raw(Arc::clone(&shared));
+        let args = esp_timer_create_args_t {
+            callback: Some(wake_sleep),
+            arg: arg.cast_mut().cast(),
+            dispatch_method: esp_timer_dispatch_t_ESP_TIMER_TASK,
+            name: c"abl_link_async".as_ptr(),
+            skip_unhandled_events: true,
+        };
+        let mut timer = ptr::null_mut();
+        // Safety: args is valid for the duration of the call, and the name is
+        // a static string.
+        let result = unsafe { esp_timer_create(&raw const args, &raw mut timer) };
+        if let Err(err) = EspError::convert(result) {
+            // Safety: arg came from Arc::into_raw above, and the timer that
+            // would have owned it doesn't exist.
+            drop(unsafe { Arc::from_raw(arg) });
+            return Err(LinkError::Driver(err));
+        }
+
+        Ok(Self {
+            link,
+            shared,
+            timer,
+            pool,
+            _subscription: subscription,
+        })
+    }
+
+    /// Wait for the number of peers to change, and get the new number.
+    pub fn peers_changed(&self) -> Changed<'_, u64> {
+        Changed::new(&self.shared.num_peers, |bits| bits)
+    }
+
+    /// Wait for the session tempo to change, and get the new tempo in BPM.
+    pub fn tempo_changed(&self) -> Changed<'_, f64> {
+        Changed::new(&self.shared.tempo, f64::from_bits)
+    }
+
+    /// Wait for the transport state to change, and get the new state.
+    ///
+    /// Like [`Link::set_transport_state_callback`], this only fires while
+    /// transport sync is enabled.
+    pub fn transport_changed(&self) -> Changed<'_, TransportState> {
+        Changed::new(&self.shared.transport_state, |bits| (bits != 0).into())
+    }
+
+    /// Sleep until the given beat, at the given quantum, in the app session
+    /// state.
+    ///
+    /// The time of the beat is recalculated whenever the tempo, transport
+    /// state or peer count changes, so the sleep follows the session. If the
+    /// beat has already passed, the future is ready at once.
+    ///
+    /// Only one sleep can be pending per handle at a time.
+    pub fn sleep_until_beat(&self, beat: f64, quantum: f64) -> SleepUntilBeat<'_, 'a> {
+        SleepUntilBeat {
+            events: self,
+            beat,
+            quantum,
+            timeline: None,
+        }
+    }
+
+    /// The app session state's timeline, extracted without allocating unless
+    /// another sleep is extracting one at the same moment.
+    fn timeline(&self) -> Result<Timeline, LinkError> {
+        if let Ok(mut state) = self.pool.acquire() {
+            self.link.capture_app_session_state_into(&mut state);
+            Ok(state.timeline())
+        } else {
+            Ok(self.link.capture_app_session_state()?.timeline())
+        }
+    }
+
+    fn generations(&self) -> [u32; 3] {
+        [
+            self.shared.num_peers.generation(),
+            self.shared.tempo.generation(),
+            self.shared.transport_state.generation(),
+        ]
+    }
+}
+
+impl Drop for AsyncEvents<'_> {
+    fn drop(&mut self) {
+        // Safety: the timer is valid, and must be stopped before it can be
+        // deleted. Once deleted, it no longer uses its reference to the
+        // Shared state, so it can be released.
+        unsafe {
+            esp_timer_stop(self.timer);
+            esp_timer_delete(self.timer);
+            drop(Arc::from_raw(Arc::as_ptr(&self.shared)));
+        }
+    }
+}
+
+/// A future that resolves with the next value of a Link notification.
+///
+/// Created by [`AsyncEvents::peers_changed`],
+/// [`AsyncEvents::tempo_changed`] and [`AsyncEvents::transport_changed`].
+/// Only changes after the future was created resolve it.
+#[must_use = "futures do nothing unless awaited"]
+pub struct Changed<'a, T> {
+    watch: &'a Watch,
+    seen: u32,
+    decode: fn(u64) -> T,
+}
+
+impl<'a, T> Changed<'a, T> {
+    fn new(watch: &'a Watch, decode: fn(u64) -> T) -> Self {
+        Self {
+            watch,
+            seen: watch.generation(),
+            decode,
+        }
+    }
+}
+
+impl<T> Future for Changed<'_, T> {
+    type Output = T;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<T> {
+        // Register before checking, so a change in between still wakes us.
+        self.watch.waker.register(cx.waker());
+        if self.watch.generation() == self.seen {
+            Poll::Pending
+        } else {
+            Poll::Ready((self.decode)(self.watch.get()))
+        }
+    }
+}
+
+/// A future that resolves at a beat of the session.
+///
+/// Created by [`AsyncEvents::sleep_until_beat`].
+#[must_use = "futures do nothing unless awaited"]
+pub struct SleepUntilBeat<'e, 'a> {
+    events: &'e AsyncEvents<'a>,
+    beat: f64,
+    quantum: f64,
+    // The timeline the beat's time was last calculated with, and the
+    // notification generations at that point.
+    timeline: Option<(Timeline, [u32; 3])>,
+}
+
+impl Future for SleepUntilBeat<'_, '_> {
+    type Output = ();
+
+    #[allow(clippy::cast_sign_loss)]
+    fn poll(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        let events = self.events;
+        events.shared.sleep.register(cx.waker());
+
+        let generations = events.generations();
+        let timeline = match self.timeline {
+            Some((timeline, seen)) if seen == generations => timeline,
+            _ => {
+                let Ok(timeline) = events.timeline() else {
+                    // Out of memory; try again shortly.
+                    // Safety: the timer is valid until the handle is dropped.
+                    unsafe {
+                        esp_timer_stop(events.timer);
+                        esp_timer_start_once(events.timer, 10_000);
+                    }
+                    return Poll::Pending;
+                };
+                self.timeline = Some((timeline, generations));
+                timeline
+            }
+        };
+
+        let remaining = timeline.time_at_beat(self.beat, self.quantum) - events.link.clock_now();
+        if remaining.as_micros() <= 0 {
+            return Poll::Ready(());
+        }
+        // Safety: the timer is valid until the handle is dropped. Stopping a
+        // timer that isn't running only returns an error, which is
+        // irrelevant here.
+        unsafe {
+            esp_timer_stop(events.timer);
+            esp_timer_start_once(events.timer, remaining.as_micros() as u64);
+        }
+        Poll::Pending
+    }
+}
+
+impl Drop for SleepUntilBeat<'_, '_> {
+    fn drop(&mut self) {
+        // Safety: the timer is valid until the handle is dropped. Stopping a
+        // timer that isn't running only returns an error.
+        unsafe { esp_timer_stop(self.events.timer) };
+    }
+}
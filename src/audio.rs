@@ -0,0 +1,233 @@
+//! Latency-compensated timing of audio buffers.
+
+use crate::{
+    AudioLink, ClockBridge, LinkError, SessionState,
+    time::{Duration, Instant},
+    timeline::Timeline,
+};
+
+/// Static timing parameters of an audio output, for an [`AudioRenderer`].
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct AudioConfig {
+    /// The sample rate in Hz.
+    pub sample_rate: u32,
+    /// The number of frames rendered per buffer.
+    pub buffer_size: usize,
+    /// The time from the start of a render call until the first sample of
+    /// the buffer it renders is heard: the DMA buffers queued ahead of it
+    /// plus the I2S/DAC latency.
+    pub output_latency: Duration,
+    /// The quantum (beats per cycle/bar) used for beat values and phase.
+    pub quantum: f64,
+}
+
+/// The timing of one audio buffer, as returned by
+/// [`AudioRenderer::begin_buffer`].
+///
+/// All times are the times at which samples reach the output, so beat values
+/// and phase computed from them already compensate for the output latency.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct BufferTiming {
+    /// The session timeline, captured for this buffer.
+    pub timeline: Timeline,
+    /// The quantum used for [`beat`](Self::beat) and the sample methods.
+    pub quantum: f64,
+    /// The time at which the first sample of the buffer is heard.
+    pub start: Instant,
+    /// The duration of one sample, in microseconds of Link time.
+    pub sample_period: f64,
+    /// The beat value at [`start`](Self::start).
+    pub beat: f64,
+    /// The number of beats that pass per sample at the current tempo.
+    pub beats_per_sample: f64,
+}
+
+impl BufferTiming {
+    /// Get the time at which sample `index` of the buffer is heard.
+    #[inline]
+    #[must_use]
+    #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+    pub fn sample_time(&self, index: usize) -> Instant {
+        self.start + Duration::from_micros((self.sample_period * index as f64).round() as i64)
+    }
+
+    /// Get the beat value at sample `index` of the buffer.
+    ///
+    /// This evaluates the timeline exactly, without an FFI call. For a
+    /// cheaper linear approximation within a buffer, use
+    /// `beat + index * beats_per_sample`.
+    #[inline]
+    #[must_use]
+    pub fn beat_at_sample(&self, index: usize) -> f64 {
+        self.timeline
+            .beat_at_time(self.sample_time(index), self.quantum)
+    }
+
+    /// Get the phase at sample `index` of the buffer.
+    #[inline]
+    #[must_use]
+    pub fn phase_at_sample(&self, index: usize) -> f64 {
+        self.timeline
+            .phase_at_time(self.sample_time(index), self.quantum)
+    }
+}
+
+/// Times audio buffers on the Link timeline, compensating for the output
+/// latency.
+///
+/// Link's beat values and phase are only meaningful at the time a sample is
+/// actually heard, which is the time of the render call plus the output
+/// latency. An `AudioRenderer` is configured once with that latency and the
+/// buffer size, and then does a fixed amount of realtime-safe FFI work per
+/// buffer: one session state capture, one clock read, and the six calls that
+/// extract the captured state's [`Timeline`](crate::Timeline).
+/// [`begin_buffer`](Self::begin_buffer) returns a [`BufferTiming`] with the
+/// buffer's start time at the output, the duration of a sample, and the beat
+/// at the start of the buffer, from which the beat or phase at every sample
+/// follows without further clock reads or FFI calls.
+///
+/// The clock reading is filtered against a running sample count with a
+/// [`ClockBridge`], so buffer start times advance by exactly one buffer
+/// length (at the measured sample clock rate) instead of jittering with the
+/// scheduling of the render task.
+///
+/// The renderer captures into a session state allocated once by
+/// [`new`](Self::new), so rendering doesn't allocate.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{AudioConfig, AudioRenderer, Duration, Link};
+///
+/// let mut link = Link::new(120.0).unwrap();
+/// let config = AudioConfig {
+///     sample_rate: 48_000,
+///     buffer_size: 256,
+///     output_latency: Duration::from_micros(10_667),
+///     quantum: 4.0,
+/// };
+/// let mut renderer = AudioRenderer::new(link.bind_audio_thread(), config).unwrap();
+///
+/// // In the render loop:
+/// let mut buffer = [0i16; 256];
+/// let timing = renderer.begin_buffer();
+/// for (index, sample) in buffer.iter_mut().enumerate() {
+///     // Click on every downbeat
+///     let phase = timing.phase_at_sample(index);
+///     *sample = if phase < 0.01 { i16::MAX } else { 0 };
+/// }
+/// ```
+pub struct AudioRenderer<'a> {
+    audio_link: AudioLink<'a>,
+    config: AudioConfig,
+    state: SessionState,
+    bridge: ClockBridge,
+    // Frames rendered so far.
+    sample_count: i64,
+}
+
+impl<'a> AudioRenderer<'a> {
+    /// Create a renderer for the given audio thread handle and output
+    /// configuration.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state used by
+    /// the renderer could not be allocated.
+    ///
+    /// # Panics
+    ///
+    /// Panics if the sample rate is zero.
+    pub fn new(audio_link: AudioLink<'a>, config: AudioConfig) -> Result<Self, LinkError> {
+        Ok(Self {
+            audio_link,
+            config,
+            state: SessionState::new()?,
+            bridge: new_bridge(&config),
+            sample_count: 0,
+        })
+    }
+
+    /// Get the output configuration.
+    #[must_use]
+    pub const fn config(&self) -> &AudioConfig {
+        &self.config
+    }
+
+    /// Get the audio thread handle, for example to read the clock.
+    #[must_use]
+    pub const fn audio_link(&self) -> &AudioLink<'a> {
+        &self.audio_link
+    }
+
+    /// Capture the session state and time the next buffer (realtime-safe).
+    ///
+    /// Call this once at the start of every render call. It advances the
+    /// renderer's sample count by [`AudioConfig::buffer_size`].
+    pub fn begin_buffer(&mut self) -> BufferTiming {
+        self.audio_link.capture_session_state_into(&mut self.state);
+        self.bridge
+            .update(self.sample_count, self.audio_link.clock_now());
+
+        let start = self.bridge.link_time(self.sample_count) + self.config.output_latency;
+        #[allow(clippy::cast_possible_wrap)]
+        let buffer_size = self.config.buffer_size as i64;
+        self.sample_count += buffer_size;
+
+        let timeline = self.state.timeline();
+        let sample_period = self.bridge.micros_per_count();
+        BufferTiming {
+            timeline,
+            quantum: self.config.quantum,
+            start,
+            sample_period,
+            beat: timeline.beat_at_time(start, self.config.quantum),
+            beats_per_sample: timeline.tempo() / 60e6 * sample_period,
+        }
+    }
+
+    /// Get the session state captured by the last
+    /// [`begin_buffer`](Self::begin_buffer), for modification.
+    ///
+    /// Use [`commit`](Self::commit) to apply the changes.
+    pub const fn session_state_mut(&mut self) -> &mut SessionState {
+        &mut self.state
+    }
+
+    /// Commit the session state captured by the last
+    /// [`begin_buffer`](Self::begin_buffer), with any modifications
+    /// (realtime-safe).
+    ///
+    /// See [`AudioLink::commit_session_state`].
+    pub fn commit(&self) {
+        self.audio_link.commit_session_state(&self.state);
+    }
+
+    /// Commit the session state like [`commit`](Self::commit), but only if
+    /// it was modified since [`begin_buffer`](Self::begin_buffer).
+    ///
+    /// Returns whether the session state was committed. See
+    /// [`AudioLink::commit_session_state_if_modified`].
+    pub fn commit_if_modified(&mut self) -> bool {
+        self.audio_link
+            .commit_session_state_if_modified(&mut self.state)
+    }
+
+    /// Restart the sample count, for example after an underrun or when the
+    /// output was paused.
+    ///
+    /// This discards the clock fit, so the next buffer is timed from a fresh
+    /// clock reading.
+    pub fn reset(&mut self) {
+        self.bridge = new_bridge(&self.config);
+        self.sample_count = 0;
+    }
+}
+
+/// A clock bridge for the sample clock of `config`, averaging over about a
+/// second of buffers.
+fn new_bridge(config: &AudioConfig) -> ClockBridge {
+    let buffers_per_second = config.sample_rate as usize / config.buffer_size.max(1);
+    let window = u32::try_from(buffers_per_second).unwrap_or(u32::MAX);
+    ClockBridge::new(config.sample_rate, window.max(1))
+}
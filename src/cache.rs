@@ -0,0 +1,164 @@
+//! Persistence of the last session's tempo and transport state in NVS.
+
+use std::ffi::CStr;
+
+use esp_idf_sys::{
+    ESP_OK, EspError, esp_err_t, nvs_close, nvs_commit, nvs_get_u8, nvs_get_u64, nvs_handle_t,
+    nvs_open, nvs_open_mode_t_NVS_READWRITE, nvs_set_u8, nvs_set_u64,
+};
+
+use crate::{LinkError, SessionState, TransportState};
+
+const TEMPO_KEY: &CStr = c"tempo";
+const PLAYING_KEY: &CStr = c"playing";
+
+/// The part of a session that is worth restoring after a restart.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct CachedSession {
+    /// The session tempo, in BPM.
+    pub tempo: f64,
+    /// Whether the transport was playing.
+    pub transport_state: TransportState,
+}
+
+impl CachedSession {
+    /// Take the tempo and transport state of a session state.
+    #[must_use]
+    pub fn from_session_state(state: &SessionState) -> Self {
+        Self {
+            tempo: state.tempo(),
+            transport_state: state.transport_state(),
+        }
+    }
+}
+
+/// Keeps the tempo and transport state of the last session in NVS, so that a
+/// device can come back at the session's tempo after a reboot.
+///
+/// On start-up, create the Link instance with the cached tempo instead of a
+/// fixed one. Before it has found its peers again, the device then already
+/// plays at the right tempo, and when it joins, its tempo doesn't briefly
+/// pull the session (or the session jerk the device) to a stale default.
+///
+/// Only tempo and transport state are kept. Beat positions are relative to
+/// the Link clock, which restarts at boot, so a cached timeline can't be
+/// reused; the phase comes back from the session as soon as a peer is found.
+/// Link discovers peers by multicast as soon as it is enabled, so there is
+/// no peer list to seed. Rather than sleeping a fixed time after
+/// [`Link::enable`](crate::Link::enable), wait for the first
+/// [`NumPeers`](crate::LinkEventKind::NumPeers) event, with a timeout for
+/// when there are no peers.
+///
+/// [`save`](Self::save) only writes to flash when the cached values change,
+/// so it can be called on every tempo or transport event (for example from
+/// the task that drains an [`EventReceiver`](crate::EventReceiver)) without
+/// wearing out flash.
+///
+/// The default NVS partition must be initialized first, for example with
+/// `nvs_flash_init`, or by taking `EspDefaultNvsPartition` in `esp-idf-svc`.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{CachedSession, Link, SessionCache};
+///
+/// let mut cache = SessionCache::open(c"abl_link").unwrap();
+/// let tempo = cache.load().map_or(120.0, |cached| cached.tempo);
+/// let link = Link::new(tempo).unwrap();
+/// link.enable();
+///
+/// // Later, for example after every tempo change:
+/// let state = link.capture_app_session_state().unwrap();
+/// cache.save(CachedSession::from_session_state(&state)).unwrap();
+/// ```
+pub struct SessionCache {
+    handle: nvs_handle_t,
+    saved: Option<CachedSession>,
+}
+
+// Safety: NVS handles can be used from any task.
+unsafe impl Send for SessionCache {}
+
+impl SessionCache {
+    /// Open the cache in the given namespace of the default NVS partition.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::Driver`] if the namespace could not be opened,
+    /// for example because NVS is not initialized.
+    pub fn open(namespace: &CStr) -> Result<Self, LinkError> {
+        let mut handle = 0;
+        // Safety: namespace is a valid C string, and handle is valid for
+        // writes.
+        check(unsafe {
+            nvs_open(
+                namespace.as_ptr(),
+                nvs_open_mode_t_NVS_READWRITE,
+                &raw mut handle,
+            )
+        })?;
+        let mut cache = Self {
+            handle,
+            saved: None,
+        };
+        cache.saved = cache.load();
+        Ok(cache)
+    }
+
+    /// Read the cached session, or `None` if there is none (or it can't be
+    /// read).
+    #[must_use]
+    pub fn load(&self) -> Option<CachedSession> {
+        let mut tempo = 0;
+        let mut playing = 0;
+        // Safety: handle is open, and the keys are valid C strings.
+        let found = unsafe {
+            nvs_get_u64(self.handle, TEMPO_KEY.as_ptr(), &raw mut tempo) == ESP_OK
+                && nvs_get_u8(self.handle, PLAYING_KEY.as_ptr(), &raw mut playing) == ESP_OK
+        };
+        found.then(|| CachedSession {
+            tempo: f64::from_bits(tempo),
+            transport_state: (playing != 0).into(),
+        })
+    }
+
+    /// Store a session, if it differs from the one in the cache.
+    ///
+    /// Returns whether anything was written.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::Driver`] if writing to NVS failed.
+    pub fn save(&mut self, session: CachedSession) -> Result<bool, LinkError> {
+        if self.saved == Some(session) {
+            return Ok(false);
+        }
+        // Safety: handle is open, and the keys are valid C strings.
+        unsafe {
+            check(nvs_set_u64(
+                self.handle,
+                TEMPO_KEY.as_ptr(),
+                session.tempo.to_bits(),
+            ))?;
+            check(nvs_set_u8(
+                self.handle,
+                PLAYING_KEY.as_ptr(),
+                bool::from(session.transport_state).into(),
+            ))?;
+            check(nvs_commit(self.handle))?;
+        }
+        self.saved = Some(session);
+        Ok(true)
+    }
+}
+
+impl Drop for SessionCache {
+    fn drop(&mut self) {
+        // Safety: handle is open, and is not used after this.
+        unsafe { nvs_close(self.handle) };
+    }
+}
+
+fn check(err: esp_err_t) -> Result<(), LinkError> {
+    EspError::convert(err).map_err(LinkError::Driver)
+}
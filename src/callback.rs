@@ -0,0 +1,393 @@
+//! Lock-free callback storage shared with the Link thread.
+
+use std::{
+    ffi::c_void,
+    mem, ptr,
+    sync::{
+        Arc,
+        atomic::{AtomicPtr, AtomicU32, Ordering},
+    },
+};
+
+use crate::{LinkError, TransportState};
+
+/// How many helpers (such as event queues and schedulers) can follow a Link
+/// instance's notifications at once, besides the application's callbacks.
+pub(crate) const SUBSCRIBERS: usize = 8;
+
+type BoxedCallback<T> = Box<dyn FnMut(T) + Send>;
+
+/// A callback slot that the Link thread can invoke without taking a lock.
+///
+/// The slot holds a pointer to a boxed callback, or null when empty. To run
+/// the callback, the trampoline swaps the pointer out and leaves a "busy"
+/// marker in its place, so it owns the callback for the duration of the call.
+/// Afterwards it swaps the callback back in, unless the slot was changed in
+/// the meantime, in which case it drops the old callback itself.
+///
+/// This keeps both sides wait-free:
+///
+/// - Invoking costs two atomic operations, with no retry loop.
+/// - Setting or clearing the callback is a single swap, and never waits for a
+///   running callback to finish. A callback that is running when it is
+///   replaced is dropped by the trampoline once it returns, so a callback is
+///   never dropped while it executes.
+///
+/// Link invokes each callback from a single thread. If the trampoline were
+/// ever re-entered concurrently, the second invocation would see the busy
+/// marker and skip the callback, so a `FnMut` is never run twice at once.
+pub(crate) struct CallbackSlot<T> {
+    callback: AtomicPtr<BoxedCallback<T>>,
+}
+
+impl<T> CallbackSlot<T> {
+    pub(crate) const fn new() -> Self {
+        Self {
+            callback: AtomicPtr::new(ptr::null_mut()),
+        }
+    }
+
+    /// Marker stored in the slot while the trampoline runs the callback.
+    ///
+    /// A dangling pointer is well-aligned and never returned by the
+    /// allocator, so it cannot collide with a real callback.
+    const fn busy() -> *mut BoxedCallback<T> {
+        ptr::dangling_mut()
+    }
+
+    /// Replace the stored callback, or clear it with `None`.
+    ///
+    /// This never blocks, even while the callback is running.
+    pub(crate) fn set(&self, callback: Option<BoxedCallback<T>>) {
+        let new = callback.map_or(ptr::null_mut(), |callback| {
+            Box::into_raw(Box::new(callback))
+        });
+        let old = self.callback.swap(new, Ordering::AcqRel);
+
+        // If the trampoline holds the old callback (the slot was busy), it
+        // will notice the swap and drop the old callback itself.
+        if !old.is_null() && old != Self::busy() {
+            // Safety: old came from Box::into_raw in a previous set(), and
+            // swapping it out of the slot transferred ownership to us.
+            drop(unsafe { Box::from_raw(old) });
+        }
+    }
+
+    fn invoke(&self, value: T) {
+        // Most slots of a fan-out are empty.
+        if self.callback.load(Ordering::Relaxed).is_null() {
+            return;
+        }
+
+        let callback = self.callback.swap(Self::busy(), Ordering::AcqRel);
+
+        if callback == Self::busy() {
+            // Already running on another thread; see the type documentation.
+            return;
+        }
+
+        if !callback.is_null() {
+            // Catch panics to prevent unwinding across FFI boundary
+            let _ = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
+                // Safety: we swapped the callback out of the slot, so nothing
+                // else can access or drop it until we put it back.
+                unsafe { (*callback)(value) };
+            }));
+        }
+
+        // Put the callback back, unless it was replaced or cleared while we
+        // held it. In that case we own it and must drop it here.
+        if self
+            .callback
+            .compare_exchange(Self::busy(), callback, Ordering::AcqRel, Ordering::Acquire)
+            .is_err()
+            && !callback.is_null()
+        {
+            // Safety: the slot no longer refers to callback, and we took it
+            // out of the slot above, so we are its only owner.
+            drop(unsafe { Box::from_raw(callback) });
+        }
+    }
+}
+
+impl<T> Drop for CallbackSlot<T> {
+    fn drop(&mut self) {
+        self.set(None);
+    }
+}
+
+/// One kind of Link notification, fanned out to the application's callback
+/// and to every subscribed helper.
+///
+/// The application's callback is either boxed, in `callback`, or static, in
+/// which case `static_callback` points to a [`static_shim`] for its type.
+/// At most one of the two is set.
+pub(crate) struct Fanout<T> {
+    static_callback: AtomicPtr<()>,
+    callback: CallbackSlot<T>,
+    subscribers: [CallbackSlot<T>; SUBSCRIBERS],
+}
+
+impl<T: Copy> Fanout<T> {
+    const fn new() -> Self {
+        Self {
+            static_callback: AtomicPtr::new(ptr::null_mut()),
+            callback: CallbackSlot::new(),
+            subscribers: [const { CallbackSlot::new() }; SUBSCRIBERS],
+        }
+    }
+
+    /// Replace the application's callback, or clear it with `None`.
+    pub(crate) fn set(&self, callback: Option<BoxedCallback<T>>) {
+        self.static_callback
+            .store(ptr::null_mut(), Ordering::Release);
+        self.callback.set(callback);
+    }
+
+    /// Replace the application's callback with a zero-sized one.
+    pub(crate) fn set_static<F: Fn(T) + Copy>(&self, _callback: F) {
+        const { assert_zero_sized::<F>() };
+
+        self.callback.set(None);
+        let shim: fn(T) = static_shim::<T, F>;
+        self.static_callback
+            .store(shim as *mut (), Ordering::Release);
+    }
+
+    /// Get the context pointer to register alongside [`trampoline`].
+    pub(crate) fn context(&self) -> *mut c_void {
+        ptr::from_ref(self).cast_mut().cast()
+    }
+
+    fn invoke(&self, value: T) {
+        #[cfg(feature = "stats")]
+        let _timing = crate::stats::STATS.callback.start();
+
+        let shim = self.static_callback.load(Ordering::Acquire);
+        if shim.is_null() {
+            self.callback.invoke(value);
+        } else {
+            // Safety: static_callback is only ever set from a fn(T) in
+            // set_static, and function pointers are pointer-sized.
+            let shim = unsafe { mem::transmute::<*mut (), fn(T)>(shim) };
+            shim(value);
+        }
+
+        for subscriber in &self.subscribers {
+            subscriber.invoke(value);
+        }
+    }
+}
+
+/// The notifications of a Link instance.
+///
+/// Shared by the Link instance, which registers its fan-outs with Link once,
+/// and by the [`Subscription`]s of its helpers, which may outlive it.
+pub(crate) struct Callbacks {
+    pub(crate) num_peers: Fanout<u64>,
+    pub(crate) tempo: Fanout<f64>,
+    pub(crate) start_stop: Fanout<TransportState>,
+    // One bit per subscriber slot in use.
+    claimed: AtomicU32,
+}
+
+impl Callbacks {
+    pub(crate) const fn new() -> Self {
+        Self {
+            num_peers: Fanout::new(),
+            tempo: Fanout::new(),
+            start_stop: Fanout::new(),
+            claimed: AtomicU32::new(0),
+        }
+    }
+
+    /// Claim a subscriber slot of each fan-out, and fill it with the given
+    /// callbacks until the returned subscription is dropped.
+    ///
+    /// Fails with [`LinkError::TooManySubscribers`] when all
+    /// [`SUBSCRIBERS`] slots are claimed.
+    pub(crate) fn subscribe(
+        self: &Arc<Self>,
+        num_peers: impl FnMut(u64) + Send + 'static,
+        tempo: impl FnMut(f64) + Send + 'static,
+        start_stop: impl FnMut(TransportState) + Send + 'static,
+    ) -> Result<Subscription, LinkError> {
+        const ALL: u32 = (1 << SUBSCRIBERS) - 1;
+
+        let claimed = self
+            .claimed
+            .fetch_update(Ordering::Acquire, Ordering::Relaxed, |claimed| {
+                (claimed != ALL).then(|| claimed | (claimed + 1))
+            })
+            .map_err(|_| LinkError::TooManySubscribers)?;
+        // The lowest clear bit, which was just set.
+        let index = claimed.trailing_ones() as usize;
+
+        self.num_peers.subscribers[index].set(Some(Box::new(num_peers)));
+        self.tempo.subscribers[index].set(Some(Box::new(tempo)));
+        self.start_stop.subscribers[index].set(Some(Box::new(start_stop)));
+        Ok(Subscription {
+            callbacks: Arc::clone(self),
+            index,
+        })
+    }
+}
+
+/// A helper's claim on one subscriber slot of each fan-out of a Link
+/// instance, released when dropped.
+pub(crate) struct Subscription {
+    callbacks: Arc<Callbacks>,
+    index: usize,
+}
+
+impl Drop for Subscription {
+    fn drop(&mut self) {
+        self.callbacks.num_peers.subscribers[self.index].set(None);
+        self.callbacks.tempo.subscribers[self.index].set(None);
+        self.callbacks.start_stop.subscribers[self.index].set(None);
+        self.callbacks
+            .claimed
+            .fetch_and(!(1 << self.index), Ordering::Release);
+    }
+}
+
+// Trampoline function for C callbacks, registered once per fan-out. `C` is
+// the type passed by the C API, `T` the type passed to the Rust callbacks.
+pub(crate) extern "C" fn trampoline<C, T: From<C> + Copy>(value: C, context: *mut c_void) {
+    // Safety: context is a pointer to a Fanout<T> in the Callbacks of the
+    // Link instance, which outlive all callbacks.
+    let fanout = unsafe { &*context.cast::<Fanout<T>>() };
+    fanout.invoke(T::from(value));
+}
+
+// Shim for zero-sized callbacks, monomorphized per callback type so the
+// callback is called directly behind a plain function pointer.
+fn static_shim<T, F: Fn(T) + Copy>(value: T) {
+    // Safety: F is zero-sized (checked in Fanout::set_static), so it carries
+    // no data, and it is Copy, so conjuring another instance is equivalent
+    // to copying the one that was registered.
+    let callback: F = unsafe { mem::zeroed() };
+
+    // Catch panics to prevent unwinding across FFI boundary
+    let _ = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| callback(value)));
+}
+
+/// Fail compilation unless `F` is zero-sized.
+pub(crate) const fn assert_zero_sized<F>() {
+    assert!(
+        size_of::<F>() == 0,
+        "static callbacks must be zero-sized: use a function item or a closure that captures nothing"
+    );
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::{
+        Arc, Mutex,
+        atomic::{AtomicU64, Ordering},
+    };
+
+    use super::{Callbacks, SUBSCRIBERS, trampoline};
+    use crate::{Link, LinkError, LinkEventKind, host::session_test};
+
+    fn recorder(
+        log: &Arc<Mutex<Vec<(usize, u64)>>>,
+        id: usize,
+    ) -> impl FnMut(u64) + Send + 'static {
+        let log = Arc::clone(log);
+        move |value| log.lock().unwrap().push((id, value))
+    }
+
+    #[test]
+    fn invokes_the_callback_and_every_subscriber() {
+        let callbacks = Arc::new(Callbacks::new());
+        let log = Arc::new(Mutex::new(Vec::new()));
+        callbacks.num_peers.set(Some(Box::new(recorder(&log, 0))));
+        let first = callbacks
+            .subscribe(recorder(&log, 1), |_| {}, |_| {})
+            .unwrap();
+        let second = callbacks
+            .subscribe(recorder(&log, 2), |_| {}, |_| {})
+            .unwrap();
+
+        trampoline::<u64, u64>(3, callbacks.num_peers.context());
+        assert_eq!(*log.lock().unwrap(), [(0, 3), (1, 3), (2, 3)]);
+
+        // Replacing the application's callback leaves the subscribers be,
+        // and unsubscribing leaves the others be.
+        callbacks.num_peers.set(None);
+        drop(first);
+        trampoline::<u64, u64>(4, callbacks.num_peers.context());
+        assert_eq!(log.lock().unwrap()[3..], [(2, 4)]);
+        drop(second);
+    }
+
+    #[test]
+    fn calls_a_static_callback_instead_of_the_boxed_one() {
+        static LAST: AtomicU64 = AtomicU64::new(0);
+
+        let callbacks = Arc::new(Callbacks::new());
+        let log = Arc::new(Mutex::new(Vec::new()));
+        callbacks.num_peers.set(Some(Box::new(recorder(&log, 0))));
+        callbacks
+            .num_peers
+            .set_static(|value| LAST.store(value, Ordering::Relaxed));
+        let _subscription = callbacks
+            .subscribe(recorder(&log, 1), |_| {}, |_| {})
+            .unwrap();
+
+        trampoline::<u64, u64>(5, callbacks.num_peers.context());
+        assert_eq!(LAST.load(Ordering::Relaxed), 5);
+        assert_eq!(*log.lock().unwrap(), [(1, 5)]);
+    }
+
+    #[test]
+    fn reuses_released_subscriber_slots() {
+        let callbacks = Arc::new(Callbacks::new());
+        let subscribe = || callbacks.subscribe(|_| {}, |_| {}, |_| {});
+        let mut subscriptions: Vec<_> = (0..SUBSCRIBERS).map(|_| subscribe().unwrap()).collect();
+        assert!(matches!(subscribe(), Err(LinkError::TooManySubscribers)));
+
+        let released = subscriptions.swap_remove(3).index;
+        let subscription = subscribe().unwrap();
+        assert_eq!(subscription.index, released);
+    }
+
+    #[test]
+    fn helpers_and_callbacks_follow_the_same_change() {
+        let _session = session_test();
+        let link = Link::new(120.0).unwrap();
+        let mut peer = Link::new(120.0).unwrap();
+        link.enable();
+        peer.enable();
+
+        let tempo = Arc::new(AtomicU64::new(0));
+        let callback_tempo = Arc::clone(&tempo);
+        link.set_tempo_callback(move |bpm: f64| {
+            callback_tempo.store(bpm.to_bits(), Ordering::Relaxed);
+        });
+        // Subscribed last, so it sees a change after the other helpers do.
+        let mut scheduler = link.beat_scheduler(4, 4.0).unwrap();
+        let shared = link.shared_timeline().unwrap();
+        let mut events = link.event_queue::<16>().unwrap();
+
+        let mut state = peer.capture_app_session_state().unwrap();
+        state.set_tempo(90.0, peer.clock_now());
+        peer.commit_app_session_state(&state);
+
+        let deadline = std::time::Instant::now() + std::time::Duration::from_secs(5);
+        while events
+            .drain()
+            .all(|event| event.kind != LinkEventKind::Tempo(90.0))
+        {
+            assert!(std::time::Instant::now() < deadline, "timed out");
+            std::thread::sleep(std::time::Duration::from_millis(1));
+        }
+        assert_eq!(tempo.load(Ordering::Relaxed), 90f64.to_bits());
+        assert_eq!(shared.timeline().tempo().to_bits(), 90f64.to_bits());
+        // The scheduler captured the session again: a tick is 1/6 s now.
+        let first = scheduler.next().unwrap();
+        let second = scheduler.next().unwrap();
+        assert_eq!((second.time - first.time).as_micros(), 166_667);
+    }
+}
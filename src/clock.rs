@@ -0,0 +1,291 @@
+//! Conversion between the Link clock and other clocks.
+
+use crate::{
+    Link,
+    time::{Duration, Instant},
+};
+
+/// Converts between Link [`Instant`]s and the counter of another clock, such
+/// as an I2S sample counter or `esp_timer_get_time()`.
+///
+/// The bridge keeps a running linear fit of Link time against the host
+/// clock, `link = offset + rate * host`, from pairs of readings of both
+/// clocks taken with [`update`](Self::update) (typically once per audio
+/// buffer). The fit is a least-squares fit with exponential forgetting, so
+/// it follows slow drift between the clocks while smoothing out the jitter
+/// of reading two clocks at slightly different moments. Each update is
+/// `O(1)`.
+///
+/// Converting with [`link_time`](Self::link_time) and
+/// [`host_time`](Self::host_time) only evaluates the fit, without reading
+/// either clock or calling into Link. So a single pair of clock readings per
+/// buffer gives the Link time of every sample of the buffer, and with it, the
+/// buffer's output latency.
+///
+/// Host clock values are plain `i64` counts in the host clock's own unit;
+/// the nominal rate of the host clock is given to [`new`](Self::new).
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{ClockBridge, Link};
+///
+/// let link = Link::new(120.0).unwrap();
+/// let mut bridge = ClockBridge::new(48_000, 64);
+///
+/// // In the audio loop, with the number of samples played so far and the
+/// // sample position of the buffer being filled:
+/// # let (played, buffer_start) = (0, 0);
+/// bridge.update(played, link.clock_now());
+/// let buffer_time = bridge.link_time(buffer_start);
+/// let output_latency = buffer_time - link.clock_now();
+/// ```
+#[derive(Debug, Clone)]
+pub struct ClockBridge {
+    nominal_rate: f64,
+    decay: f64,
+    // The latest reading, which all sums and the fit are relative to.
+    host_ref: i64,
+    link_ref: i64,
+    // Exponentially weighted sums over readings (x = host, y = link),
+    // relative to the latest reading.
+    weight: f64,
+    sum_x: f64,
+    sum_y: f64,
+    sum_xx: f64,
+    sum_xy: f64,
+    // The fit, relative to the latest reading: link_ref + offset + rate * x.
+    offset: f64,
+    rate: f64,
+}
+
+impl ClockBridge {
+    /// Create a bridge for a host clock that nominally counts `host_hz`
+    /// times per second (for example, the sample rate for a sample counter,
+    /// or `1_000_000` for `esp_timer_get_time()`).
+    ///
+    /// `window` is the approximate number of recent updates the fit averages
+    /// over. Larger windows reject more jitter but follow changes in drift
+    /// more slowly.
+    ///
+    /// Until the first [`update`](Self::update), conversions assume both
+    /// clocks start at zero at the nominal rate.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `host_hz` or `window` is zero.
+    #[must_use]
+    pub fn new(host_hz: u32, window: u32) -> Self {
+        assert!(host_hz > 0, "host_hz must be non-zero");
+        assert!(window > 0, "window must be non-zero");
+        let nominal_rate = 1e6 / f64::from(host_hz);
+        Self {
+            nominal_rate,
+            decay: 1.0 - 1.0 / f64::from(window),
+            host_ref: 0,
+            link_ref: 0,
+            weight: 0.0,
+            sum_x: 0.0,
+            sum_y: 0.0,
+            sum_xx: 0.0,
+            sum_xy: 0.0,
+            offset: 0.0,
+            rate: nominal_rate,
+        }
+    }
+
+    /// Add a pair of readings: the host clock was at `host` when the Link
+    /// clock was at `link`.
+    ///
+    /// Read the clocks as close together as possible. Any jitter between
+    /// the two readings is smoothed by the fit.
+    #[allow(clippy::cast_precision_loss)]
+    pub fn update(&mut self, host: i64, link: Instant) {
+        // Move the reference to the new reading. The shifts are exact
+        // algebraically, and keep the sums small, because old readings decay.
+        let dx = (host - self.host_ref) as f64;
+        let dy = (link.as_micros() - self.link_ref) as f64;
+        self.host_ref = host;
+        self.link_ref = link.as_micros();
+        self.sum_xy += self.weight * dx * dy - dy * self.sum_x - dx * self.sum_y;
+        self.sum_xx += self.weight * dx * dx - 2.0 * dx * self.sum_x;
+        self.sum_x -= self.weight * dx;
+        self.sum_y -= self.weight * dy;
+
+        // Decay old readings, and add the new one at (0, 0).
+        self.weight = self.weight * self.decay + 1.0;
+        self.sum_x *= self.decay;
+        self.sum_y *= self.decay;
+        self.sum_xx *= self.decay;
+        self.sum_xy *= self.decay;
+
+        let spread = self.weight * self.sum_xx - self.sum_x * self.sum_x;
+        // With a single reading (or all at the same host time), keep the
+        // previous rate.
+        if spread > 0.0 {
+            self.rate = (self.weight * self.sum_xy - self.sum_x * self.sum_y) / spread;
+        }
+        self.offset = (self.sum_y - self.rate * self.sum_x) / self.weight;
+    }
+
+    /// Read the Link clock and add it with the host clock reading `host`.
+    ///
+    /// Returns the Link clock reading, so that a single read per buffer can
+    /// also serve as the buffer's "now".
+    pub fn sync(&mut self, link: &Link, host: i64) -> Instant {
+        let now = link.clock_now();
+        self.update(host, now);
+        now
+    }
+
+    /// Convert a host clock value to Link time.
+    #[must_use]
+    #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+    pub fn link_time(&self, host: i64) -> Instant {
+        let x = (host - self.host_ref) as f64;
+        Instant::from_micros(self.link_ref + (self.offset + self.rate * x).round() as i64)
+    }
+
+    /// Convert a Link time to a host clock value.
+    #[must_use]
+    #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+    pub fn host_time(&self, link: Instant) -> i64 {
+        let y = (link.as_micros() - self.link_ref) as f64;
+        self.host_ref + ((y - self.offset) / self.rate).round() as i64
+    }
+
+    /// Convert a number of host clock counts to a Link [`Duration`].
+    #[must_use]
+    #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+    pub fn link_duration(&self, host_counts: i64) -> Duration {
+        Duration::from_micros((self.rate * host_counts as f64).round() as i64)
+    }
+
+    /// Get the measured duration of one host clock count, in microseconds of
+    /// Link time.
+    #[must_use]
+    pub const fn micros_per_count(&self) -> f64 {
+        self.rate
+    }
+
+    /// Get the measured drift of the host clock relative to the Link clock,
+    /// in parts per million.
+    ///
+    /// Positive values mean the host clock runs slow: each host count takes
+    /// more Link time than nominal.
+    #[must_use]
+    pub fn drift_ppm(&self) -> f64 {
+        (self.rate / self.nominal_rate - 1.0) * 1e6
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::ClockBridge;
+    use crate::{
+        Link,
+        time::{Duration, Instant},
+    };
+
+    /// Feed `buffers` buffers of 256 samples of a 48 kHz counter running
+    /// `ppm` slow, continuing from the bridge's latest reading.
+    #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+    fn feed(bridge: &mut ClockBridge, host: &mut i64, link: &mut f64, ppm: f64, buffers: u32) {
+        let micros_per_sample = 1e6 / 48_000.0 * (1.0 + ppm * 1e-6);
+        for _ in 0..buffers {
+            *host += 256;
+            *link += micros_per_sample * 256.0;
+            bridge.update(*host, Instant::from_micros(link.round() as i64));
+        }
+    }
+
+    #[test]
+    fn converts_at_the_nominal_rate_before_updates() {
+        let bridge = ClockBridge::new(48_000, 16);
+        assert_eq!(bridge.link_time(48_000), Instant::from_micros(1_000_000));
+        assert_eq!(bridge.host_time(Instant::from_micros(500_000)), 24_000);
+        assert!(bridge.drift_ppm().abs() < 1e-9);
+    }
+
+    #[test]
+    fn follows_a_drifting_clock() {
+        // A 48 kHz sample counter running 100 ppm slow, with its origin at
+        // one second of Link time.
+        let micros_per_sample = 1e6 / 48_000.0 * (1.0 + 100e-6);
+        let mut bridge = ClockBridge::new(48_000, 16);
+        for buffer in 0..1000 {
+            let host = buffer * 256;
+            #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+            let link = Instant::from_micros((1e6 + micros_per_sample * host as f64).round() as i64);
+            bridge.update(host, link);
+        }
+        assert!(
+            (bridge.drift_ppm() - 100.0).abs() < 1.0,
+            "{}",
+            bridge.drift_ppm()
+        );
+        assert!((bridge.micros_per_count() - micros_per_sample).abs() < 1e-4);
+
+        let host = 300_000;
+        let link = bridge.link_time(host);
+        #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+        let expected = (1e6 + micros_per_sample * host as f64).round() as i64;
+        assert!((link.as_micros() - expected).abs() <= 1);
+        assert!((bridge.host_time(link) - host).abs() <= 1);
+        assert_eq!(
+            bridge.link_duration(48_000),
+            Duration::from_micros(1_000_100)
+        );
+    }
+
+    #[test]
+    fn smooths_jitter() {
+        let mut bridge = ClockBridge::new(1_000_000, 64);
+        for reading in 0..1000 {
+            let host = reading * 1000;
+            // Alternate readings are taken 20 µs late.
+            let jitter = if reading % 2 == 0 { 0 } else { 20 };
+            bridge.update(host, Instant::from_micros(host + jitter));
+        }
+        assert!(bridge.drift_ppm().abs() < 100.0, "{}", bridge.drift_ppm());
+        let error = bridge.link_time(1_000_000).as_micros() - 1_000_000;
+        assert!((0..=20).contains(&error), "{error}");
+    }
+
+    #[test]
+    fn follows_a_change_in_drift() {
+        let mut bridges = [ClockBridge::new(48_000, 16), ClockBridge::new(48_000, 256)];
+        for bridge in &mut bridges {
+            let (mut host, mut link) = (0, 0.0);
+            feed(bridge, &mut host, &mut link, 0.0, 2000);
+            assert!(bridge.drift_ppm().abs() < 1.0, "{}", bridge.drift_ppm());
+            // The crystal warms up.
+            feed(bridge, &mut host, &mut link, 200.0, 160);
+        }
+
+        // The short window has caught up, the long one is still averaging
+        // in the old rate.
+        let [short, long] = bridges.map(|bridge| bridge.drift_ppm());
+        assert!((short - 200.0).abs() < 5.0, "{short}");
+        assert!(long < 150.0, "{long}");
+    }
+
+    #[test]
+    fn keeps_the_nominal_rate_after_one_reading() {
+        let mut bridge = ClockBridge::new(48_000, 16);
+        bridge.update(96_000, Instant::from_micros(5_000_000));
+        assert_eq!(bridge.link_time(96_000), Instant::from_micros(5_000_000));
+        assert_eq!(bridge.link_time(144_000), Instant::from_micros(6_000_000));
+        assert_eq!(bridge.host_time(Instant::from_micros(4_500_000)), 72_000);
+    }
+
+    #[test]
+    fn sync_reads_the_link_clock() {
+        let link = Link::new(120.0).unwrap();
+        let mut bridge = ClockBridge::new(1_000_000, 16);
+        let before = link.clock_now();
+        let now = bridge.sync(&link, 42);
+        assert!(before <= now && now <= link.clock_now());
+        assert_eq!(bridge.link_time(42), now);
+    }
+}
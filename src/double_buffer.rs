@@ -0,0 +1,131 @@
+//! Lock-free publication of small values from one writer to many readers.
+
+use std::sync::atomic::{AtomicU32, Ordering, fence};
+
+/// A value of `N` words, published by a single writer and read by any number
+/// of readers, without locks and without 64-bit atomics.
+///
+/// The writer fills the slot readers aren't directed to, then publishes it
+/// by flipping `published`, which also counts the writes. A reader copies the
+/// published slot and checks that `published` didn't change meanwhile, so a
+/// torn copy is detected and retried. Unlike a seqlock, readers never wait
+/// for a write in progress: they only retry when a write has completed, so a
+/// high-priority reader can't spin on a preempted low-priority writer.
+pub(crate) struct DoubleBuffer<const N: usize> {
+    // Number of writes so far, shifted left by one, with the index of the
+    // published slot in the lowest bit.
+    published: AtomicU32,
+    slots: [[AtomicU32; N]; 2],
+}
+
+impl<const N: usize> DoubleBuffer<N> {
+    pub(crate) const fn new() -> Self {
+        Self {
+            published: AtomicU32::new(0),
+            slots: [const { [const { AtomicU32::new(0) }; N] }; 2],
+        }
+    }
+
+    /// Publish a new value. Must only be called by the single writer.
+    pub(crate) fn store(&self, value: [u32; N]) {
+        let published = self.published.load(Ordering::Relaxed);
+        let index = (published & 1) ^ 1;
+        let slot = &self.slots[index as usize];
+        // If a reader sees any of the stores below, it also sees the previous
+        // publication, so it knows its copy of this slot is stale.
+        fence(Ordering::Release);
+        for (word, value) in slot.iter().zip(value) {
+            word.store(value, Ordering::Relaxed);
+        }
+        self.published
+            .store((published & !1).wrapping_add(2) | index, Ordering::Release);
+    }
+
+    /// The number of values published so far, wrapping at 2^31.
+    pub(crate) fn generation(&self) -> u32 {
+        self.published.load(Ordering::Acquire) >> 1
+    }
+
+    /// Read the latest value, and the [`generation`](Self::generation) it was
+    /// published in.
+    pub(crate) fn load(&self) -> (u32, [u32; N]) {
+        let mut published = self.published.load(Ordering::Acquire);
+        loop {
+            let slot = &self.slots[(published & 1) as usize];
+            let value = std::array::from_fn(|i| slot[i].load(Ordering::Relaxed));
+            fence(Ordering::Acquire);
+            let now = self.published.load(Ordering::Acquire);
+            if now == published {
+                return (published >> 1, value);
+            }
+            published = now;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::{
+        sync::{
+            Arc,
+            atomic::{AtomicBool, Ordering},
+        },
+        thread,
+    };
+
+    use super::DoubleBuffer;
+
+    #[test]
+    fn load_returns_the_latest_store() {
+        let buffer = DoubleBuffer::<3>::new();
+        assert_eq!(buffer.load(), (0, [0, 0, 0]));
+        buffer.store([1, 2, 3]);
+        assert_eq!(buffer.load(), (1, [1, 2, 3]));
+        buffer.store([4, 5, 6]);
+        buffer.store([7, 8, 9]);
+        assert_eq!(buffer.generation(), 3);
+        assert_eq!(buffer.load(), (3, [7, 8, 9]));
+    }
+
+    #[test]
+    fn readers_never_see_a_torn_value() {
+        let buffer = Arc::new(DoubleBuffer::<8>::new());
+        let done = Arc::new(AtomicBool::new(false));
+        let readers: Vec<_> = (0..4)
+            .map(|_| {
+                let buffer = Arc::clone(&buffer);
+                let done = Arc::clone(&done);
+                thread::spawn(move || {
+                    let mut last = 0;
+                    while !done.load(Ordering::Relaxed) {
+                        let (generation, value) = buffer.load();
+                        // Every store fills all words with its generation.
+                        assert!(value.iter().all(|&word| word == generation));
+                        assert!(generation >= last);
+                        last = generation;
+                    }
+                })
+            })
+            .collect();
+        for generation in 1..=100_000 {
+            buffer.store([generation; 8]);
+        }
+        done.store(true, Ordering::Relaxed);
+        for reader in readers {
+            reader.join().unwrap();
+        }
+    }
+
+    #[test]
+    fn generation_wraps_without_losing_values() {
+        let buffer = DoubleBuffer::<2>::new();
+        // The last generation before the wrap, in slot 1.
+        buffer.published.store(u32::MAX, Ordering::Relaxed);
+        assert_eq!(buffer.generation(), (1 << 31) - 1);
+
+        buffer.store([1, 2]);
+        assert_eq!(buffer.load(), (0, [1, 2]));
+        buffer.store([3, 4]);
+        assert_eq!(buffer.load(), (1, [3, 4]));
+    }
+}
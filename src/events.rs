@@ -0,0 +1,365 @@
+//! Bounded event queue for Link notifications.
+
+use std::{
+    cell::UnsafeCell,
+    ffi::c_void,
+    mem::MaybeUninit,
+    ptr,
+    sync::{
+        Arc,
+        atomic::{AtomicBool, AtomicPtr, AtomicU32, AtomicUsize, Ordering},
+    },
+};
+
+use crate::{
+    TransportState,
+    callback::Subscription,
+    idf::{
+        TickType_t, configTICK_RATE_HZ, eNotifyAction_eIncrement, ulTaskGenericNotifyTake,
+        xTaskGenericNotify, xTaskGetCurrentTaskHandle, xTaskGetTickCount,
+    },
+    sys,
+    time::{Duration, Instant},
+};
+
+/// A Link notification, timestamped with the Link clock.
+///
+/// See [`Link::event_queue`](crate::Link::event_queue).
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct LinkEvent {
+    /// The Link clock time at which the notification was received.
+    pub time: Instant,
+    /// What changed.
+    pub kind: LinkEventKind,
+}
+
+/// The kind of a [`LinkEvent`], with the new value.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum LinkEventKind {
+    /// The number of peers changed.
+    NumPeers(u64),
+    /// The session tempo changed, in BPM.
+    Tempo(f64),
+    /// The transport state changed.
+    TransportState(TransportState),
+}
+
+/// A copy of the Link handle, for reading the clock from callbacks.
+#[derive(Clone, Copy)]
+pub(crate) struct CallbackClock(sys::abl_link);
+
+// Safety: abl_link_clock_micros is thread-safe, and the callbacks holding a
+// CallbackClock are stored in the Link instance, so they never outlive it.
+unsafe impl Send for CallbackClock {}
+unsafe impl Sync for CallbackClock {}
+
+impl CallbackClock {
+    pub(crate) const fn new(handle: sys::abl_link) -> Self {
+        Self(handle)
+    }
+
+    pub(crate) fn now(self) -> Instant {
+        // Safety: handle is valid while the owning Link instance is alive.
+        Instant::from_micros(unsafe { sys::abl_link_clock_micros(self.0) })
+    }
+}
+
+/// Lock-free ring buffer shared between the Link thread and an
+/// [`EventReceiver`].
+pub(crate) struct EventRing<const N: usize> {
+    events: [UnsafeCell<MaybeUninit<LinkEvent>>; N],
+    // Total number of events written and read. Only the producer advances
+    // `written`, only the consumer advances `read`.
+    written: AtomicUsize,
+    read: AtomicUsize,
+    // Set while an event is being pushed, so that two producers can never
+    // write at the same time.
+    pushing: AtomicBool,
+    dropped: AtomicU32,
+    // FreeRTOS task to notify on push, or null.
+    task: AtomicPtr<c_void>,
+}
+
+// Safety: Each event slot is written only by the (single) producer before it
+// is published through `written`, and read only by the (single) consumer
+// before it is released through `read`.
+unsafe impl<const N: usize> Sync for EventRing<N> {}
+
+impl<const N: usize> EventRing<N> {
+    pub(crate) fn new() -> Self {
+        const { assert!(N > 0, "event queue capacity must be non-zero") };
+        Self {
+            events: std::array::from_fn(|_| UnsafeCell::new(MaybeUninit::uninit())),
+            written: AtomicUsize::new(0),
+            read: AtomicUsize::new(0),
+            pushing: AtomicBool::new(false),
+            dropped: AtomicU32::new(0),
+            task: AtomicPtr::new(ptr::null_mut()),
+        }
+    }
+
+    /// Push an event, or count it as dropped if the ring is full.
+    ///
+    /// This never blocks or allocates.
+    pub(crate) fn push(&self, event: LinkEvent) {
+        // Link invokes callbacks from a single thread, so this never fails in
+        // practice. If it ever does, dropping the event keeps the ring sound.
+        if self.pushing.swap(true, Ordering::Acquire) {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+
+        let written = self.written.load(Ordering::Relaxed);
+        let read = self.read.load(Ordering::Acquire);
+        if written.wrapping_sub(read) == N {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+        } else {
+            // Safety: this slot is not readable by the consumer until we
+            // publish it below, and `pushing` excludes other producers.
+            unsafe { (*self.events[written % N].get()).write(event) };
+            self.written
+                .store(written.wrapping_add(1), Ordering::Release);
+        }
+
+        self.pushing.store(false, Ordering::Release);
+
+        let task = self.task.load(Ordering::Acquire);
+        if !task.is_null() {
+            // Safety: task was stored by EventReceiver::wait, from the
+            // task that waits on it. Incrementing a notification value is
+            // always valid.
+            unsafe {
+                xTaskGenericNotify(task.cast(), 0, 0, eNotifyAction_eIncrement, ptr::null_mut());
+            }
+        }
+    }
+
+    /// Pop the oldest event. Must only be called by the single consumer.
+    fn pop(&self) -> Option<LinkEvent> {
+        let read = self.read.load(Ordering::Relaxed);
+        let written = self.written.load(Ordering::Acquire);
+        if read == written {
+            return None;
+        }
+
+        // Safety: the producer published this slot through `written`, and it
+        // will not overwrite it until we release it through `read`.
+        let event = unsafe { (*self.events[read % N].get()).assume_init() };
+        self.read.store(read.wrapping_add(1), Ordering::Release);
+        Some(event)
+    }
+}
+
+/// The receiving end of a Link event queue.
+///
+/// Created by [`Link::event_queue`](crate::Link::event_queue). Link pushes a
+/// [`LinkEvent`] for every peer count, tempo and transport state change into
+/// a fixed-capacity ring buffer of `N` events. The receiving task drains it on
+/// its own schedule with [`try_recv`](Self::try_recv), or blocks on a `FreeRTOS`
+/// task notification with [`recv`](Self::recv) or
+/// [`recv_timeout`](Self::recv_timeout).
+///
+/// The Link thread never runs application code, never blocks and never
+/// allocates when pushing events. When the queue is full, new events are
+/// dropped and counted (see [`dropped_events`](Self::dropped_events)).
+///
+/// `EventReceiver` is `Send`, so it can be moved to the task that processes
+/// events, but not `Clone` or `Sync`: there is exactly one receiver per queue.
+pub struct EventReceiver<const N: usize> {
+    ring: Arc<EventRing<N>>,
+    // Pushes every Link notification into the ring.
+    _subscription: Subscription,
+}
+
+impl<const N: usize> EventReceiver<N> {
+    pub(crate) const fn new(ring: Arc<EventRing<N>>, subscription: Subscription) -> Self {
+        Self {
+            ring,
+            _subscription: subscription,
+        }
+    }
+
+    /// Take the oldest pending event, if any, without blocking.
+    pub fn try_recv(&mut self) -> Option<LinkEvent> {
+        self.ring.pop()
+    }
+
+    /// Iterate over all pending events, oldest first, without blocking.
+    pub fn drain(&mut self) -> impl Iterator<Item = LinkEvent> + '_ {
+        std::iter::from_fn(|| self.try_recv())
+    }
+
+    /// Wait for the next event, blocking the current task until one arrives.
+    ///
+    /// See [`recv_timeout`](Self::recv_timeout).
+    pub fn recv(&mut self) -> LinkEvent {
+        loop {
+            if let Some(event) = self.wait(TickType_t::MAX) {
+                return event;
+            }
+        }
+    }
+
+    /// Wait for the next event, blocking the current task for at most
+    /// `timeout`.
+    ///
+    /// Returns `None` if no event arrived in time. The timeout is rounded
+    /// down to `FreeRTOS` ticks.
+    ///
+    /// While waiting, the task sleeps on its `FreeRTOS` task notification
+    /// (index 0), which Link signals when it pushes an event. Don't use that
+    /// notification index for anything else in the receiving task.
+    pub fn recv_timeout(&mut self, timeout: Duration) -> Option<LinkEvent> {
+        let ticks = timeout
+            .as_micros()
+            .max(0)
+            .cast_unsigned()
+            .saturating_mul(u64::from(configTICK_RATE_HZ))
+            / 1_000_000;
+        self.wait(TickType_t::try_from(ticks).unwrap_or(TickType_t::MAX))
+    }
+
+    fn wait(&mut self, ticks: TickType_t) -> Option<LinkEvent> {
+        // Register before checking the ring, so that an event pushed after
+        // the check always wakes us.
+        // Safety: xTaskGetCurrentTaskHandle is always safe to call from a task.
+        let task = unsafe { xTaskGetCurrentTaskHandle() };
+        self.ring.task.store(task.cast(), Ordering::Release);
+
+        // Safety: xTaskGetTickCount is always safe to call from a task.
+        let start = unsafe { xTaskGetTickCount() };
+        let event = loop {
+            if let Some(event) = self.try_recv() {
+                break Some(event);
+            }
+
+            // A notification may be left over from events that were already
+            // drained, so keep waiting until the timeout has fully elapsed.
+            let elapsed = unsafe { xTaskGetTickCount() }.wrapping_sub(start);
+            let remaining = match ticks {
+                TickType_t::MAX => TickType_t::MAX,
+                _ if elapsed >= ticks => break None,
+                _ => ticks - elapsed,
+            };
+
+            // Safety: waits on the current task's own notification value.
+            if unsafe { ulTaskGenericNotifyTake(0, 1, remaining) } == 0 {
+                break self.try_recv();
+            }
+        };
+        // The receiver may move to another task, and this one may be deleted,
+        // so stop notifying it as soon as it stops waiting.
+        self.ring.task.store(ptr::null_mut(), Ordering::Release);
+        event
+    }
+
+    /// Get the number of events dropped because the queue was full.
+    ///
+    /// This counts all drops since the queue was created.
+    #[must_use]
+    pub fn dropped_events(&self) -> u32 {
+        self.ring.dropped.load(Ordering::Relaxed)
+    }
+}
+
+impl<const N: usize> Drop for EventReceiver<N> {
+    fn drop(&mut self) {
+        // Stop notifying a task that may no longer exist.
+        self.ring.task.store(ptr::null_mut(), Ordering::Release);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::{sync::Arc, thread};
+
+    use super::{EventReceiver, EventRing, LinkEvent, LinkEventKind, Ordering};
+    use crate::{
+        callback::Callbacks,
+        time::{Duration, Instant},
+    };
+
+    fn event(peers: u64) -> LinkEvent {
+        LinkEvent {
+            time: Instant::from_micros(0),
+            kind: LinkEventKind::NumPeers(peers),
+        }
+    }
+
+    // A receiver for a ring that the test pushes into directly.
+    fn receiver(ring: &Arc<EventRing<4>>) -> EventReceiver<4> {
+        let subscription = Arc::new(Callbacks::new())
+            .subscribe(|_| {}, |_| {}, |_| {})
+            .unwrap();
+        EventReceiver::new(Arc::clone(ring), subscription)
+    }
+
+    #[test]
+    fn pops_events_in_push_order() {
+        let ring = EventRing::<4>::new();
+        assert_eq!(ring.pop(), None);
+        for peers in 0..3 {
+            ring.push(event(peers));
+        }
+        for peers in 0..3 {
+            assert_eq!(ring.pop(), Some(event(peers)));
+        }
+        assert_eq!(ring.pop(), None);
+    }
+
+    #[test]
+    fn drops_events_when_full() {
+        let ring = EventRing::<2>::new();
+        for peers in 0..5 {
+            ring.push(event(peers));
+        }
+        assert_eq!(ring.dropped.load(Ordering::Relaxed), 3);
+        assert_eq!(ring.pop(), Some(event(0)));
+        assert_eq!(ring.pop(), Some(event(1)));
+        assert_eq!(ring.pop(), None);
+    }
+
+    #[test]
+    fn wraps_around() {
+        let ring = EventRing::<3>::new();
+        for peers in 0..10 {
+            ring.push(event(peers));
+            assert_eq!(ring.pop(), Some(event(peers)));
+        }
+        assert_eq!(ring.dropped.load(Ordering::Relaxed), 0);
+    }
+
+    #[test]
+    fn recv_wakes_on_push_from_another_thread() {
+        let ring = Arc::new(EventRing::<4>::new());
+        let mut receiver = receiver(&ring);
+        let waiter = thread::spawn(move || receiver.recv());
+        // Wait until the receiver sleeps, so the push has to wake it.
+        while ring.task.load(Ordering::Acquire).is_null() {
+            thread::yield_now();
+        }
+        ring.push(event(3));
+        assert_eq!(waiter.join().unwrap(), event(3));
+    }
+
+    #[test]
+    fn stops_notifying_once_done_waiting() {
+        let ring = Arc::new(EventRing::<4>::new());
+        let mut receiver = receiver(&ring);
+        assert_eq!(receiver.recv_timeout(Duration::from_millis(10)), None);
+        assert!(ring.task.load(Ordering::Acquire).is_null());
+
+        ring.push(event(1));
+        assert_eq!(
+            receiver.recv_timeout(Duration::from_millis(10)),
+            Some(event(1))
+        );
+        assert!(ring.task.load(Ordering::Acquire).is_null());
+
+        // The receiver can move to another task, and the first one can end.
+        ring.push(event(2));
+        let handle = thread::spawn(move || receiver.recv());
+        assert_eq!(handle.join().unwrap(), event(2));
+        assert!(ring.task.load(Ordering::Acquire).is_null());
+    }
+}
@@ -0,0 +1,875 @@
+//! Stand-ins for ESP-IDF and the Ableton Link C API, enabled by the `host`
+//! feature, so that the crate builds and runs on a workstation.
+//!
+//! [`abl_link`] is an in-process mock of Link. Every instance created in the
+//! process is a virtual peer: enabled instances form one session, sharing
+//! tempo, beat timeline and (with start/stop sync) transport state, and
+//! their peer counts and callbacks follow instances being enabled and
+//! disabled. Changes reach the other peers as soon as they are committed,
+//! and all peers share one clock, so there is no network latency, clock
+//! offset or measurement to converge: the mock exercises the Rust layer, not
+//! Link's synchronization. Timelines are evaluated with the same math as
+//! [`Timeline`], which mirrors Link's.
+//!
+//! The `FreeRTOS` task notifications and `esp_timer`s that the crate uses are
+//! emulated with std threads; timers run their callbacks on a thread of
+//! their own, like `ESP_TIMER_TASK` dispatch. Everything else from ESP-IDF
+//! (`GPTimer`, NVS) has no stand-in, so the modules using it are not built
+//! with this feature.
+//!
+//! The names and signatures follow the `esp-idf-sys` bindings, so the rest
+//! of the crate uses them unchanged.
+
+#![allow(non_camel_case_types, non_upper_case_globals, non_snake_case)]
+
+use std::{
+    ffi::{c_char, c_void},
+    ptr,
+    sync::{
+        Arc, Condvar, Mutex, MutexGuard, OnceLock, PoisonError,
+        atomic::{AtomicBool, AtomicU64, Ordering},
+        mpsc::{self, Sender},
+    },
+    thread::{self, JoinHandle},
+    time::Duration,
+};
+
+pub type esp_err_t = i32;
+pub const ESP_OK: esp_err_t = 0;
+const ESP_FAIL: esp_err_t = -1;
+
+/// Stand-in for `esp_idf_sys::EspError`: a non-`ESP_OK` error code.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct EspError(esp_err_t);
+
+impl EspError {
+    /// Convert an error code, with `ESP_OK` becoming `Ok`.
+    pub const fn convert(code: esp_err_t) -> Result<(), Self> {
+        if code == ESP_OK {
+            Ok(())
+        } else {
+            Err(Self(code))
+        }
+    }
+
+    /// Get the error code.
+    #[must_use]
+    pub const fn code(self) -> esp_err_t {
+        self.0
+    }
+}
+
+impl std::fmt::Display for EspError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(f, "ESP error {}", self.0)
+    }
+}
+
+impl std::error::Error for EspError {}
+
+/// Lock a mutex, ignoring poisoning: a panic in a callback thread must not
+/// take the whole mock down with it.
+fn lock<T>(mutex: &Mutex<T>) -> MutexGuard<'_, T> {
+    mutex.lock().unwrap_or_else(PoisonError::into_inner)
+}
+
+/// Serialize the tests that enable instances: every enabled instance in the
+/// process joins the one session, so tests running in parallel would join
+/// each other's.
+#[cfg(test)]
+pub(crate) fn session_test() -> MutexGuard<'static, ()> {
+    static SESSION_TESTS: Mutex<()> = Mutex::new(());
+    lock(&SESSION_TESTS)
+}
+
+/// Microseconds since the first call, the clock of both `esp_timer` and
+/// Link, like on the device.
+fn micros() -> i64 {
+    static EPOCH: OnceLock<std::time::Instant> = OnceLock::new();
+    let elapsed = EPOCH.get_or_init(std::time::Instant::now).elapsed();
+    i64::try_from(elapsed.as_micros()).unwrap_or(i64::MAX)
+}
+
+// FreeRTOS task notifications.
+
+pub type TickType_t = u32;
+pub type BaseType_t = i32;
+pub type UBaseType_t = u32;
+pub struct tskTaskControlBlock {
+    _private: [u8; 0],
+}
+pub type TaskHandle_t = *mut tskTaskControlBlock;
+pub type eNotifyAction = u32;
+pub const eNotifyAction_eIncrement: eNotifyAction = 2;
+pub const configTICK_RATE_HZ: u32 = 1000;
+
+/// The notification value of one thread, standing in for a task's.
+struct Notification {
+    value: Mutex<u32>,
+    changed: Condvar,
+}
+
+thread_local! {
+    // Leaked, so that handles stay valid however long they are kept.
+    static TASK: &'static Notification = Box::leak(Box::new(Notification {
+        value: Mutex::new(0),
+        changed: Condvar::new(),
+    }));
+}
+
+pub unsafe fn xTaskGetCurrentTaskHandle() -> TaskHandle_t {
+    TASK.with(|task| ptr::from_ref(*task).cast_mut().cast())
+}
+
+#[allow(clippy::cast_possible_truncation, clippy::cast_sign_loss)]
+pub unsafe fn xTaskGetTickCount() -> TickType_t {
+    (micros() / 1_000) as TickType_t
+}
+
+pub unsafe fn xTaskGenericNotify(
+    task: TaskHandle_t,
+    _index: UBaseType_t,
+    _value: u32,
+    action: eNotifyAction,
+    _previous: *mut u32,
+) -> BaseType_t {
+    assert_eq!(
+        action, eNotifyAction_eIncrement,
+        "only eIncrement is emulated"
+    );
+    // Safety: task handles are only created by xTaskGetCurrentTaskHandle,
+    // and point to leaked notifications.
+    let task = unsafe { &*task.cast::<Notification>() };
+    *lock(&task.value) += 1;
+    task.changed.notify_all();
+    1
+}
+
+pub unsafe fn ulTaskGenericNotifyTake(
+    _index: UBaseType_t,
+    clear_on_exit: BaseType_t,
+    ticks: TickType_t,
+) -> u32 {
+    TASK.with(|task| {
+        let mut value = lock(&task.value);
+        if ticks == TickType_t::MAX {
+            while *value == 0 {
+                value = task
+                    .changed
+                    .wait(value)
+                    .unwrap_or_else(PoisonError::into_inner);
+            }
+        } else {
+            let timeout = Duration::from_millis(u64::from(ticks));
+            value = task
+                .changed
+                .wait_timeout_while(value, timeout, |value| *value == 0)
+                .unwrap_or_else(PoisonError::into_inner)
+                .0;
+        }
+        let taken = *value;
+        if taken > 0 {
+            *value = if clear_on_exit == 0 { taken - 1 } else { 0 };
+        }
+        taken
+    })
+}
+
+// esp_timer.
+
+pub type esp_timer_cb_t = Option<unsafe extern "C" fn(arg: *mut c_void)>;
+pub type esp_timer_dispatch_t = u32;
+pub const esp_timer_dispatch_t_ESP_TIMER_TASK: esp_timer_dispatch_t = 0;
+pub type esp_timer_handle_t = *mut esp_timer;
+
+// Only the callback and its argument are used; timers always dispatch from
+// a thread of their own.
+#[allow(dead_code)]
+#[derive(Debug, Clone, Copy)]
+pub struct esp_timer_create_args_t {
+    pub callback: esp_timer_cb_t,
+    pub arg: *mut c_void,
+    pub dispatch_method: esp_timer_dispatch_t,
+    pub name: *const c_char,
+    pub skip_unhandled_events: bool,
+}
+
+#[derive(Default)]
+struct TimerState {
+    deadline: Option<std::time::Instant>,
+    deleted: bool,
+}
+
+struct TimerShared {
+    state: Mutex<TimerState>,
+    changed: Condvar,
+}
+
+/// A one-shot timer, with a thread that sleeps until it expires.
+pub struct esp_timer {
+    shared: Arc<TimerShared>,
+    thread: Option<JoinHandle<()>>,
+}
+
+/// The callback and its argument, moved to the timer thread.
+struct TimerCallback(unsafe extern "C" fn(*mut c_void), *mut c_void);
+
+// Safety: esp_timer callbacks must be callable from the timer task, so the
+// argument is meant to be used from another thread.
+unsafe impl Send for TimerCallback {}
+
+impl TimerCallback {
+    fn call(&self) {
+        // Safety: the creator of the timer guarantees that the callback can
+        // be called with its argument until the timer is deleted.
+        unsafe { (self.0)(self.1) }
+    }
+}
+
+pub unsafe fn esp_timer_create(
+    args: *const esp_timer_create_args_t,
+    handle: *mut esp_timer_handle_t,
+) -> esp_err_t {
+    // Safety: the caller passes valid arguments, as with ESP-IDF.
+    let args = unsafe { &*args };
+    let Some(callback) = args.callback else {
+        return ESP_FAIL;
+    };
+    let callback = TimerCallback(callback, args.arg);
+    let shared = Arc::new(TimerShared {
+        state: Mutex::new(TimerState::default()),
+        changed: Condvar::new(),
+    });
+    let timer_shared = Arc::clone(&shared);
+    let thread = thread::spawn(move || {
+        let mut state = lock(&timer_shared.state);
+        while !state.deleted {
+            let Some(deadline) = state.deadline else {
+                state = timer_shared
+                    .changed
+                    .wait(state)
+                    .unwrap_or_else(PoisonError::into_inner);
+                continue;
+            };
+            let now = std::time::Instant::now();
+            if now < deadline {
+                state = timer_shared
+                    .changed
+                    .wait_timeout(state, deadline - now)
+                    .unwrap_or_else(PoisonError::into_inner)
+                    .0;
+                continue;
+            }
+            state.deadline = None;
+            drop(state);
+            callback.call();
+            state = lock(&timer_shared.state);
+        }
+    });
+    let timer = Box::new(esp_timer {
+        shared,
+        thread: Some(thread),
+    });
+    // Safety: the caller passes a valid pointer to store the handle in.
+    unsafe { *handle = Box::into_raw(timer) };
+    ESP_OK
+}
+
+pub unsafe fn esp_timer_start_once(timer: esp_timer_handle_t, timeout_us: u64) -> esp_err_t {
+    // Safety: the handle is valid until esp_timer_delete.
+    let shared = unsafe { &(*timer).shared };
+    lock(&shared.state).deadline =
+        Some(std::time::Instant::now() + Duration::from_micros(timeout_us));
+    shared.changed.notify_all();
+    ESP_OK
+}
+
+pub unsafe fn esp_timer_stop(timer: esp_timer_handle_t) -> esp_err_t {
+    // Safety: the handle is valid until esp_timer_delete.
+    let shared = unsafe { &(*timer).shared };
+    lock(&shared.state).deadline = None;
+    shared.changed.notify_all();
+    ESP_OK
+}
+
+pub unsafe fn esp_timer_delete(timer: esp_timer_handle_t) -> esp_err_t {
+    // Safety: the handle is valid, and not used after this.
+    let mut timer = unsafe { Box::from_raw(timer) };
+    lock(&timer.shared.state).deleted = true;
+    timer.shared.changed.notify_all();
+    if let Some(thread) = timer.thread.take() {
+        // A panicking callback has already been reported.
+        let _ = thread.join();
+    }
+    ESP_OK
+}
+
+// Only used by the `stats` feature, to stand in for the cycle counter.
+#[cfg_attr(not(feature = "stats"), allow(dead_code))]
+pub unsafe fn esp_timer_get_time() -> i64 {
+    micros()
+}
+
+/// In-process mock of the `abl_link` C API.
+pub mod abl_link {
+    use super::{
+        Arc, AtomicBool, AtomicU64, JoinHandle, Mutex, Ordering, Sender, c_void, lock, micros,
+        mpsc, thread,
+    };
+    use crate::{
+        time::Instant,
+        timeline::{Timeline, closest_phase_match, floating, half, micro_beats, next_phase_match},
+    };
+
+    #[derive(Debug, Clone, Copy)]
+    pub struct abl_link {
+        pub impl_: *mut c_void,
+    }
+
+    #[derive(Debug, Clone, Copy)]
+    pub struct abl_link_session_state {
+        pub impl_: *mut c_void,
+    }
+
+    pub type abl_link_num_peers_callback =
+        Option<unsafe extern "C" fn(num_peers: u64, context: *mut c_void)>;
+    pub type abl_link_tempo_callback =
+        Option<unsafe extern "C" fn(tempo: f64, context: *mut c_void)>;
+    pub type abl_link_start_stop_callback =
+        Option<unsafe extern "C" fn(is_playing: bool, context: *mut c_void)>;
+
+    /// A timeline in Link's representation: micro-beats and microseconds.
+    #[derive(Debug, Clone, Copy, PartialEq)]
+    struct Timing {
+        tempo: f64,
+        beat_origin: i64,
+        time_origin: i64,
+    }
+
+    impl Timing {
+        fn timeline(self) -> Timeline {
+            Timeline::from_parts(self.tempo, self.beat_origin, self.time_origin)
+        }
+
+        /// Link's `Timeline::toBeats`: with a quantum of zero, there is no
+        /// phase encoding.
+        fn beats_at(self, time: i64) -> i64 {
+            self.encoded_at(time, 0)
+        }
+
+        /// Link's `Timeline::fromBeats`.
+        fn time_at(self, beats: i64) -> i64 {
+            self.time_at_encoded(beats, 0)
+        }
+
+        fn encoded_at(self, time: i64, quantum: i64) -> i64 {
+            micro_beats(
+                self.timeline()
+                    .beat_at_time(Instant::from_micros(time), floating(quantum)),
+            )
+        }
+
+        fn time_at_encoded(self, beat: i64, quantum: i64) -> i64 {
+            self.timeline()
+                .time_at_beat(floating(beat), floating(quantum))
+                .as_micros()
+        }
+    }
+
+    /// The state behind a session state handle, and of each instance.
+    #[derive(Debug, Clone, Copy)]
+    struct State {
+        timing: Timing,
+        playing: bool,
+        playing_time: i64,
+        // Whether beat requests align to the quantum; true if there were
+        // peers when the state was captured, like in Link.
+        respect_quantum: bool,
+    }
+
+    impl State {
+        fn new(tempo: f64, time_origin: i64) -> Self {
+            Self {
+                timing: Timing {
+                    tempo: clamp_tempo(tempo),
+                    beat_origin: 0,
+                    time_origin,
+                },
+                playing: false,
+                playing_time: 0,
+                respect_quantum: false,
+            }
+        }
+
+        /// Link's `ApiState::setTempo`.
+        fn set_tempo(&mut self, bpm: f64, time: i64) {
+            let desired = Timing {
+                tempo: clamp_tempo(bpm),
+                beat_origin: self.timing.beats_at(time),
+                time_origin: time,
+            };
+            self.timing.tempo = desired.tempo;
+            self.timing.time_origin = desired.time_at(self.timing.beat_origin);
+        }
+
+        /// Link's `ApiState::requestBeatAtTime`.
+        fn request_beat_at_time(&mut self, beat: i64, time: i64, quantum: i64) {
+            let time = if self.respect_quantum {
+                let current = self.timing.encoded_at(time, quantum);
+                self.timing
+                    .time_at_encoded(next_phase_match(current, beat, quantum), quantum)
+            } else {
+                time
+            };
+            self.force_beat_at_time(beat, time, quantum);
+        }
+
+        /// Link's `ApiState::forceBeatAtTime`: a phase shift, then a beat
+        /// magnitude adjustment.
+        fn force_beat_at_time(&mut self, beat: i64, time: i64, quantum: i64) {
+            let current = self.timing.encoded_at(time, quantum);
+            let closest = closest_phase_match(current, beat, quantum, half(quantum));
+            let shift = self.timing.time_at(closest - current) - self.timing.time_at(0);
+            self.timing.time_origin -= shift;
+            self.timing.beat_origin += beat - closest;
+        }
+    }
+
+    /// Link's tempo range.
+    fn clamp_tempo(bpm: f64) -> f64 {
+        bpm.clamp(20.0, 999.0)
+    }
+
+    enum Notification {
+        NumPeers(u64),
+        Tempo(f64),
+        StartStop(bool),
+    }
+
+    /// A callback and its context, kept as an address so that peers are
+    /// `Sync`.
+    type Registered<F> = Option<(F, usize)>;
+
+    #[derive(Default, Clone, Copy)]
+    struct Callbacks {
+        num_peers: Registered<unsafe extern "C" fn(u64, *mut c_void)>,
+        tempo: Registered<unsafe extern "C" fn(f64, *mut c_void)>,
+        start_stop: Registered<unsafe extern "C" fn(bool, *mut c_void)>,
+    }
+
+    /// One instance, as the session sees it.
+    struct Peer {
+        state: Mutex<State>,
+        enabled: AtomicBool,
+        start_stop_sync: AtomicBool,
+        num_peers: AtomicU64,
+        callbacks: Mutex<Callbacks>,
+        notifications: Mutex<Option<Sender<Notification>>>,
+    }
+
+    impl Peer {
+        fn notify(&self, notification: Notification) {
+            if let Some(sender) = &*lock(&self.notifications) {
+                // The dispatcher only stops once the sender is gone.
+                let _ = sender.send(notification);
+            }
+        }
+
+        /// Apply a timeline and, if both sides sync it, a transport state
+        /// from elsewhere in the session.
+        fn receive(&self, from: &State, transport: bool) {
+            let mut state = lock(&self.state);
+            if state.timing.tempo.to_bits() != from.timing.tempo.to_bits() {
+                self.notify(Notification::Tempo(from.timing.tempo));
+            }
+            state.timing = from.timing;
+            if transport && self.start_stop_sync.load(Ordering::Relaxed) {
+                if state.playing != from.playing {
+                    self.notify(Notification::StartStop(from.playing));
+                }
+                state.playing = from.playing;
+                state.playing_time = from.playing_time;
+            }
+        }
+    }
+
+    /// The enabled instances, which form the session.
+    static SESSION: Mutex<Vec<Arc<Peer>>> = Mutex::new(Vec::new());
+
+    /// Set the peer count of every member of the session.
+    fn count_peers(session: &[Arc<Peer>]) {
+        let num_peers = session.len().saturating_sub(1) as u64;
+        for peer in session {
+            if peer.num_peers.swap(num_peers, Ordering::Relaxed) != num_peers {
+                peer.notify(Notification::NumPeers(num_peers));
+            }
+        }
+    }
+
+    struct Instance {
+        peer: Arc<Peer>,
+        dispatcher: JoinHandle<()>,
+    }
+
+    /// Get the instance behind a handle.
+    ///
+    /// # Safety
+    ///
+    /// The handle must come from `abl_link_create` and not be destroyed.
+    unsafe fn instance<'a>(link: abl_link) -> &'a Instance {
+        // Safety: guaranteed by the caller.
+        unsafe { &*link.impl_.cast::<Instance>() }
+    }
+
+    /// Get the state behind a session state handle.
+    ///
+    /// # Safety
+    ///
+    /// The handle must come from `abl_link_create_session_state` and not be
+    /// destroyed, and must not be accessed elsewhere at the same time.
+    unsafe fn state<'a>(session_state: abl_link_session_state) -> &'a mut State {
+        // Safety: guaranteed by the caller.
+        unsafe { &mut *session_state.impl_.cast::<State>() }
+    }
+
+    /// Run callbacks on a thread of the instance's own, like Link does.
+    fn dispatch(peer: &Peer, notification: &Notification) {
+        let callbacks = *lock(&peer.callbacks);
+        // Safety: registered callbacks are valid with their contexts until
+        // replaced, like with Link.
+        unsafe {
+            match *notification {
+                Notification::NumPeers(num_peers) => {
+                    if let Some((callback, context)) = callbacks.num_peers {
+                        callback(num_peers, context as *mut c_void);
+                    }
+                }
+                Notification::Tempo(tempo) => {
+                    if let Some((callback, context)) = callbacks.tempo {
+                        callback(tempo, context as *mut c_void);
+                    }
+                }
+                Notification::StartStop(is_playing) => {
+                    if let Some((callback, context)) = callbacks.start_stop {
+                        callback(is_playing, context as *mut c_void);
+                    }
+                }
+            }
+        }
+    }
+
+    pub unsafe fn abl_link_create(bpm: f64) -> abl_link {
+        let (sender, receiver) = mpsc::channel();
+        let peer = Arc::new(Peer {
+            state: Mutex::new(State::new(bpm, micros())),
+            enabled: AtomicBool::new(false),
+            start_stop_sync: AtomicBool::new(false),
+            num_peers: AtomicU64::new(0),
+            callbacks: Mutex::new(Callbacks::default()),
+            notifications: Mutex::new(Some(sender)),
+        });
+        let dispatch_peer = Arc::clone(&peer);
+        let dispatcher = thread::spawn(move || {
+            // Ends once the instance is destroyed.
+            for notification in receiver {
+                dispatch(&dispatch_peer, &notification);
+            }
+        });
+        let instance = Box::new(Instance { peer, dispatcher });
+        abl_link {
+            impl_: Box::into_raw(instance).cast(),
+        }
+    }
+
+    pub unsafe fn abl_link_destroy(link: abl_link) {
+        // Safety: the handle is valid, and not used after this.
+        unsafe { abl_link_enable(link, false) };
+        // Safety: as above.
+        let instance = unsafe { Box::from_raw(link.impl_.cast::<Instance>()) };
+        // Closing the channel stops the dispatcher once the callbacks still
+        // pending have run, so that none runs after this returns.
+        lock(&instance.peer.notifications).take();
+        // A panicking callback has already been reported.
+        let _ = instance.dispatcher.join();
+    }
+
+    pub unsafe fn abl_link_is_enabled(link: abl_link) -> bool {
+        // Safety: the handle is valid.
+        unsafe { instance(link) }
+            .peer
+            .enabled
+            .load(Ordering::Relaxed)
+    }
+
+    pub unsafe fn abl_link_enable(link: abl_link, enable: bool) {
+        // Safety: the handle is valid.
+        let peer = &unsafe { instance(link) }.peer;
+        let mut session = lock(&SESSION);
+        if peer.enabled.swap(enable, Ordering::Relaxed) == enable {
+            return;
+        }
+        if enable {
+            // Joining adopts the session's timeline, like Link does.
+            if let Some(member) = session.first() {
+                let from = *lock(&member.state);
+                let transport = member.start_stop_sync.load(Ordering::Relaxed);
+                peer.receive(&from, transport);
+            }
+            session.push(Arc::clone(peer));
+        } else {
+            session.retain(|member| !Arc::ptr_eq(member, peer));
+            if peer.num_peers.swap(0, Ordering::Relaxed) != 0 {
+                peer.notify(Notification::NumPeers(0));
+            }
+        }
+        count_peers(&session);
+    }
+
+    pub unsafe fn abl_link_is_start_stop_sync_enabled(link: abl_link) -> bool {
+        // Safety: the handle is valid.
+        unsafe { instance(link) }
+            .peer
+            .start_stop_sync
+            .load(Ordering::Relaxed)
+    }
+
+    pub unsafe fn abl_link_enable_start_stop_sync(link: abl_link, enabled: bool) {
+        // Safety: the handle is valid.
+        unsafe { instance(link) }
+            .peer
+            .start_stop_sync
+            .store(enabled, Ordering::Relaxed);
+    }
+
+    pub unsafe fn abl_link_num_peers(link: abl_link) -> u64 {
+        // Safety: the handle is valid.
+        unsafe { instance(link) }
+            .peer
+            .num_peers
+            .load(Ordering::Relaxed)
+    }
+
+    pub unsafe fn abl_link_set_num_peers_callback(
+        link: abl_link,
+        callback: abl_link_num_peers_callback,
+        context: *mut c_void,
+    ) {
+        // Safety: the handle is valid.
+        let peer = &unsafe { instance(link) }.peer;
+        lock(&peer.callbacks).num_peers = callback.map(|callback| (callback, context as usize));
+    }
+
+    pub unsafe fn abl_link_set_tempo_callback(
+        link: abl_link,
+        callback: abl_link_tempo_callback,
+        context: *mut c_void,
+    ) {
+        // Safety: the handle is valid.
+        let peer = &unsafe { instance(link) }.peer;
+        lock(&peer.callbacks).tempo = callback.map(|callback| (callback, context as usize));
+    }
+
+    pub unsafe fn abl_link_set_start_stop_callback(
+        link: abl_link,
+        callback: abl_link_start_stop_callback,
+        context: *mut c_void,
+    ) {
+        // Safety: the handle is valid.
+        let peer = &unsafe { instance(link) }.peer;
+        lock(&peer.callbacks).start_stop = callback.map(|callback| (callback, context as usize));
+    }
+
+    pub unsafe fn abl_link_clock_micros(_link: abl_link) -> i64 {
+        micros()
+    }
+
+    pub unsafe fn abl_link_create_session_state() -> abl_link_session_state {
+        abl_link_session_state {
+            impl_: Box::into_raw(Box::new(State::new(120.0, 0))).cast(),
+        }
+    }
+
+    pub unsafe fn abl_link_destroy_session_state(session_state: abl_link_session_state) {
+        // Safety: the handle is valid, and not used after this.
+        drop(unsafe { Box::from_raw(session_state.impl_.cast::<State>()) });
+    }
+
+    pub unsafe fn abl_link_capture_app_session_state(
+        link: abl_link,
+        session_state: abl_link_session_state,
+    ) {
+        // Safety: both handles are valid.
+        let (peer, state) = unsafe { (&instance(link).peer, state(session_state)) };
+        *state = State {
+            respect_quantum: peer.num_peers.load(Ordering::Relaxed) > 0,
+            ..*lock(&peer.state)
+        };
+    }
+
+    pub unsafe fn abl_link_commit_app_session_state(
+        link: abl_link,
+        session_state: abl_link_session_state,
+    ) {
+        // Safety: both handles are valid.
+        let (peer, new) = unsafe { (&instance(link).peer, *state(session_state)) };
+        let session = lock(&SESSION);
+        let old = std::mem::replace(&mut *lock(&peer.state), new);
+
+        let timing_changed = old.timing != new.timing;
+        let transport_changed = (old.playing, old.playing_time) != (new.playing, new.playing_time);
+        if old.timing.tempo.to_bits() != new.timing.tempo.to_bits() {
+            peer.notify(Notification::Tempo(new.timing.tempo));
+        }
+        if old.playing != new.playing {
+            peer.notify(Notification::StartStop(new.playing));
+        }
+
+        if !peer.enabled.load(Ordering::Relaxed) || !(timing_changed || transport_changed) {
+            return;
+        }
+        let transport = transport_changed && peer.start_stop_sync.load(Ordering::Relaxed);
+        for member in session.iter().filter(|member| !Arc::ptr_eq(member, peer)) {
+            member.receive(&new, transport);
+        }
+    }
+
+    pub unsafe fn abl_link_capture_audio_session_state(
+        link: abl_link,
+        session_state: abl_link_session_state,
+    ) {
+        // Safety: forwarded from the caller. The mock has one session state
+        // per instance for both threads.
+        unsafe { abl_link_capture_app_session_state(link, session_state) }
+    }
+
+    pub unsafe fn abl_link_commit_audio_session_state(
+        link: abl_link,
+        session_state: abl_link_session_state,
+    ) {
+        // Safety: as above.
+        unsafe { abl_link_commit_app_session_state(link, session_state) }
+    }
+
+    pub unsafe fn abl_link_tempo(session_state: abl_link_session_state) -> f64 {
+        // Safety: the handle is valid.
+        unsafe { state(session_state) }.timing.tempo
+    }
+
+    pub unsafe fn abl_link_set_tempo(
+        session_state: abl_link_session_state,
+        bpm: f64,
+        at_time: i64,
+    ) {
+        // Safety: the handle is valid.
+        unsafe { state(session_state) }.set_tempo(bpm, at_time);
+    }
+
+    pub unsafe fn abl_link_beat_at_time(
+        session_state: abl_link_session_state,
+        time: i64,
+        quantum: f64,
+    ) -> f64 {
+        // Safety: the handle is valid.
+        let timing = unsafe { state(session_state) }.timing;
+        timing
+            .timeline()
+            .beat_at_time(Instant::from_micros(time), quantum)
+    }
+
+    pub unsafe fn abl_link_phase_at_time(
+        session_state: abl_link_session_state,
+        time: i64,
+        quantum: f64,
+    ) -> f64 {
+        // Safety: the handle is valid.
+        let timing = unsafe { state(session_state) }.timing;
+        timing
+            .timeline()
+            .phase_at_time(Instant::from_micros(time), quantum)
+    }
+
+    pub unsafe fn abl_link_time_at_beat(
+        session_state: abl_link_session_state,
+        beat: f64,
+        quantum: f64,
+    ) -> i64 {
+        // Safety: the handle is valid.
+        let timing = unsafe { state(session_state) }.timing;
+        timing.timeline().time_at_beat(beat, quantum).as_micros()
+    }
+
+    pub unsafe fn abl_link_request_beat_at_time(
+        session_state: abl_link_session_state,
+        beat: f64,
+        time: i64,
+        quantum: f64,
+    ) {
+        // Safety: the handle is valid.
+        unsafe { state(session_state) }.request_beat_at_time(
+            micro_beats(beat),
+            time,
+            micro_beats(quantum),
+        );
+    }
+
+    pub unsafe fn abl_link_force_beat_at_time(
+        session_state: abl_link_session_state,
+        beat: f64,
+        time: u64,
+        quantum: f64,
+    ) {
+        // Safety: the handle is valid.
+        unsafe { state(session_state) }.force_beat_at_time(
+            micro_beats(beat),
+            time.cast_signed(),
+            micro_beats(quantum),
+        );
+    }
+
+    pub unsafe fn abl_link_set_is_playing(
+        session_state: abl_link_session_state,
+        is_playing: bool,
+        time: u64,
+    ) {
+        // Safety: the handle is valid.
+        let state = unsafe { state(session_state) };
+        state.playing = is_playing;
+        state.playing_time = time.cast_signed();
+    }
+
+    pub unsafe fn abl_link_is_playing(session_state: abl_link_session_state) -> bool {
+        // Safety: the handle is valid.
+        unsafe { state(session_state) }.playing
+    }
+
+    pub unsafe fn abl_link_time_for_is_playing(session_state: abl_link_session_state) -> u64 {
+        // Safety: the handle is valid.
+        unsafe { state(session_state) }.playing_time.cast_unsigned()
+    }
+
+    pub unsafe fn abl_link_request_beat_at_start_playing_time(
+        session_state: abl_link_session_state,
+        beat: f64,
+        quantum: f64,
+    ) {
+        // Safety: the handle is valid.
+        let state = unsafe { state(session_state) };
+        if state.playing {
+            state.request_beat_at_time(micro_beats(beat), state.playing_time, micro_beats(quantum));
+        }
+    }
+
+    pub unsafe fn abl_link_set_is_playing_and_request_beat_at_time(
+        session_state: abl_link_session_state,
+        is_playing: bool,
+        time: u64,
+        beat: f64,
+        quantum: f64,
+    ) {
+        // Safety: the handle is valid.
+        let state = unsafe { state(session_state) };
+        state.playing = is_playing;
+        state.playing_time = time.cast_signed();
+        state.request_beat_at_time(micro_beats(beat), time.cast_signed(), micro_beats(quantum));
+    }
+}
@@ -129,12 +129,26 @@
 //!   callbacks. These are lock-free and will never block, making them safe
 //!   for low-latency audio processing.
 //!
+//! Both capture functions allocate a new [`SessionState`] on every call. On
+//! hot paths, allocate one up front with [`SessionState::new`] and refill it
+//! with [`Link::capture_app_session_state_into`] or
+//! [`AudioLink::capture_session_state_into`] instead, so that no heap
+//! allocation happens per capture. When several tasks capture concurrently,
+//! a [`SessionStatePool`] hands out preallocated session states from a
+//! fixed-capacity pool.
+//!
 //! If your application has a dedicated audio thread with realtime constraints,
 //! use [`Link::bind_audio_thread`] to obtain an [`AudioLink`] handle and use
 //! its methods exclusively from that thread. For simpler applications without
 //! strict realtime requirements, the application thread functions are
 //! sufficient.
 //!
+//! Beat values and phase for audio must be computed for the time a sample is
+//! heard, not the time it is rendered. An [`AudioRenderer`] wraps the
+//! [`AudioLink`] handle with the output latency and buffer size, and times
+//! each buffer with a single capture and clock read, plus the calls that
+//! extract the captured [`Timeline`], none of them per sample.
+//!
 //! The Link library recommends avoiding concurrent session state modifications
 //! from both application and audio threads. This crate enforces that
 //! recommendation: the [`AudioLink`] handle mutably borrows the [`Link`]
@@ -220,6 +234,9 @@
 //!   progress or count beats locally.
 //! - Use [`SessionState::request_beat_at_time`] to adjust your local beat value
 //!   while preserving phase alignment with the session.
+//! - Use [`SessionState::timeline`] to get a [`Timeline`]: a `Copy` snapshot
+//!   of the timeline that answers the same queries in pure Rust, without FFI
+//!   calls, and can be shared with other tasks and interrupt handlers.
 //!
 //! ## Examples
 //!
@@ -243,6 +260,12 @@
 //! // esp_timer_start_once(timer_handle, delay_us as u64);
 //! ```
 //!
+//! For a steady stream of beat subdivisions, such as MIDI clock, use
+//! [`Link::beat_scheduler`] instead. It follows tempo changes and wakes the
+//! task exactly when each tick is due. To output those ticks as clock pulses
+//! on a GPIO, timed by a hardware timer instead of a task, use a
+//! [`PulseOutput`].
+//!
 //! ### Counting Beats Locally
 //!
 //! To count how many beats have elapsed since your app started:
@@ -346,17 +369,168 @@
 //! [`Play`](TransportState::Play)/[`Stop`](TransportState::Stop) variants for
 //! clarity, since the state can be either currently active or scheduled for the
 //! future (see [The Transport State Model](#the-transport-state-model)).
+//!
+//! # Link Tasks
+//!
+//! Link runs its networking and callback dispatch on `FreeRTOS` tasks that
+//! the component's ESP32 platform layer creates itself, directly with the
+//! `FreeRTOS` task API, as the Link instance is constructed. Their stack
+//! size and priority are fixed in the component, and the core of the
+//! networking task comes from the component's Kconfig, so keeping Link off
+//! an audio task's core on dual-core chips is done in `sdkconfig`:
+//!
+//! ```text
+//! # Core of Link's networking task
+//! CONFIG_LINK_ESP_TASK_CORE_ID=0
+//! ```
+//!
+//! The `esp_pthread` configuration doesn't reach these tasks, and the C API
+//! takes no task settings, so changing their stack size or priority needs
+//! a change to the component.
+//!
+//! # Memory Placement
+//!
+//! Link allocates its peer tables, network buffers and session states with
+//! C++ `new`, which on ESP-IDF is `malloc`. With PSRAM enabled, ESP-IDF can
+//! send large allocations to it and keep small ones in internal SRAM, based
+//! on their size. Allocations on Link's realtime path, such as
+//! [`SessionState`]s (including those in a [`SessionStatePool`]), are small,
+//! so a threshold above their size keeps them internal while larger
+//! non-realtime buffers move to PSRAM:
+//!
+//! ```text
+//! CONFIG_SPIRAM=y
+//! CONFIG_SPIRAM_USE_MALLOC=y
+//! # Allocations smaller than this stay in internal SRAM
+//! CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL=512
+//! # Internal SRAM kept free of large allocations, for DMA
+//! CONFIG_SPIRAM_MALLOC_RESERVE_INTERNAL=32768
+//! ```
+//!
+//! This doesn't cover the stacks of Link's own tasks, which the component
+//! allocates as it creates them, out of reach of this crate.
+//!
+//! # Network Interfaces
+//!
+//! Link picks its interfaces itself: every `esp_netif` interface that is up
+//! takes part in discovery and measurement, and the list is rescanned
+//! periodically. The `esp_abl_link` component doesn't let that be changed,
+//! so on devices with several interfaces (Wi-Fi station and Ethernet, or an
+//! access point), the way to keep Link off an interface is to keep that
+//! interface down while Link is enabled.
+//!
+//! Link's sockets are ordinary lwIP UDP sockets, so their receive queue
+//! depth is lwIP's. Packets arriving while the queue is full are dropped,
+//! which with many peers shows up as slower discovery and noisier
+//! measurements. The depth is set per socket in `sdkconfig`:
+//!
+//! ```text
+//! # Packets queued per UDP socket before lwIP drops them (default 6)
+//! CONFIG_LWIP_UDP_RECVMBOX_SIZE=16
+//! ```
+//!
+//! # Cargo Features
+//!
+//! - `stats`: Record the durations of session state captures and commits,
+//!   and of callbacks on the Link thread, in allocation-free histograms. The
+//!   durations are read from the CPU cycle counter, which is per core, so
+//!   calls that move to another core midway are counted but not timed. Read
+//!   them with `Link::stats`.
+//! - `async`: Futures for peer count, tempo and transport state changes, and
+//!   for sleeping until a beat, for use with async executors. Create them
+//!   with `Link::async_events`.
+//! - `host`: Build for a workstation instead of ESP-IDF, against an
+//!   in-process mock of Link in which every instance is a peer of one
+//!   session. Changes reach the other instances as soon as they are
+//!   committed, and all instances share one clock, so this tests the
+//!   application and this crate, not Link's synchronization.
+//!   `SessionCache` and `PulseOutput` need ESP-IDF drivers and are left
+//!   out. The `host` benchmark, the `simulation` example, with dozens of
+//!   peers, and the unit tests (`cargo test --features host --lib`) run
+//!   with this feature. It isn't additive, so it fails to build
+//!   for ESP-IDF targets: enable it only in workstation builds, for example
+//!   through a `[target.'cfg(not(target_os = "espidf"))'.dev-dependencies]`
+//!   entry.
+
+#![cfg_attr(
+    all(feature = "stats", target_arch = "xtensa"),
+    feature(asm_experimental_arch)
+)]
 
-use std::{ffi::c_void, marker::PhantomData, sync::Mutex};
+use std::{
+    marker::PhantomData,
+    sync::{Arc, OnceLock},
+};
 
 use delegate::delegate;
 
+#[cfg(feature = "async")]
+mod async_events;
+mod audio;
+#[cfg(not(feature = "host"))]
+mod cache;
+mod callback;
+mod clock;
+mod double_buffer;
+mod events;
+#[cfg(feature = "host")]
+mod host;
+mod monitor;
+mod pool;
+mod power;
+#[cfg(not(feature = "host"))]
+mod pulse;
+mod quantized;
+mod ramp;
+mod scheduler;
+mod sequencer;
 mod session;
+mod shared_timeline;
+#[cfg(feature = "stats")]
+mod stats;
 mod time;
+mod timeline;
+mod transport;
+#[cfg(feature = "async")]
+pub use async_events::{AsyncEvents, Changed, SleepUntilBeat};
+pub use audio::{AudioConfig, AudioRenderer, BufferTiming};
+#[cfg(not(feature = "host"))]
+pub use cache::{CachedSession, SessionCache};
+pub use clock::ClockBridge;
+pub use events::{EventReceiver, LinkEvent, LinkEventKind};
+pub use monitor::{SyncMetrics, SyncMetricsReader, SyncMonitor};
+pub use pool::{PooledSessionState, SessionStatePool};
+pub use power::{PowerSaver, PowerSaverConfig};
+#[cfg(not(feature = "host"))]
+pub use pulse::{PulseGate, PulseOutput};
+pub use quantized::Quantized;
+pub use ramp::TempoRamp;
+pub use scheduler::{BeatScheduler, Tick};
+pub use sequencer::{SequencedEvent, Sequencer};
 pub use session::SessionState;
-pub use time::{Duration, Instant};
+pub use shared_timeline::SharedTimeline;
+#[cfg(feature = "stats")]
+pub use stats::{HistogramSnapshot, LinkStats};
+pub use time::{Beats, Duration, Instant};
+pub use timeline::Timeline;
+pub use transport::{Launch, LaunchReader, Transport};
 
-type Callback<T> = Mutex<Option<Box<dyn FnMut(T) + Send>>>;
+use callback::{Callbacks, Subscription, trampoline};
+use events::{CallbackClock, EventRing};
+use shared_timeline::TimelineCell;
+
+// The mock would silently replace Link in firmware, for example when another
+// crate in the dependency graph enables the feature for its host tests.
+#[cfg(all(feature = "host", target_os = "espidf"))]
+compile_error!(
+    "the `host` feature replaces Link with an in-process mock and can't be \
+     enabled for ESP-IDF targets; enable it only in workstation builds"
+);
+
+#[cfg(not(feature = "host"))]
+use esp_idf_sys as idf;
+#[cfg(feature = "host")]
+use host as idf;
 
 /// The transport state: [`Play`](Self::Play) or [`Stop`](Self::Stop).
 ///
@@ -388,7 +562,7 @@ mod sys {
     // Allow wildcard imports for the sys module since there is nothing else in
     // this module.
     #[allow(clippy::wildcard_imports)]
-    pub use esp_idf_sys::abl_link::*;
+    pub use crate::idf::abl_link::*;
 }
 
 /// Error type for Link operations.
@@ -396,33 +570,29 @@ mod sys {
 pub enum LinkError {
     /// Failed to allocate memory.
     AllocationFailed,
+    /// All session states in a [`SessionStatePool`] are in use.
+    PoolExhausted,
+    /// An ESP-IDF driver call failed.
+    Driver(idf::EspError),
+    /// Too many helpers, such as event queues, beat schedulers and async
+    /// events, follow the Link instance's notifications at once: at most
+    /// eight can. Dropping one makes room for another.
+    TooManySubscribers,
 }
 
 impl std::fmt::Display for LinkError {
     fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
         match self {
             Self::AllocationFailed => write!(f, "Failed to allocate memory"),
+            Self::PoolExhausted => write!(f, "Session state pool is exhausted"),
+            Self::Driver(err) => write!(f, "ESP-IDF driver error: {err}"),
+            Self::TooManySubscribers => write!(f, "Too many subscribers to Link notifications"),
         }
     }
 }
 
 impl std::error::Error for LinkError {}
 
-// Generic trampoline function for C callbacks.
-extern "C" fn trampoline<T>(value: T, context: *mut c_void) {
-    // Catch panics to prevent unwinding across FFI boundary
-    let _ = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
-        // Safety: context is a pointer to Mutex<Option<Box<dyn FnMut(T) + Send>>>
-        // stored in the Link struct, which outlives all callbacks.
-        let mutex = unsafe { &*context.cast::<Mutex<Option<Box<dyn FnMut(T) + Send>>>>() };
-        if let Ok(mut guard) = mutex.lock()
-            && let Some(callback) = guard.as_mut()
-        {
-            callback(value);
-        }
-    }));
-}
-
 /// A safe wrapper around an Ableton Link instance.
 ///
 /// Link enables musical applications to synchronize tempo and beat phase over a
@@ -454,18 +624,60 @@ extern "C" fn trampoline<T>(value: T, context: *mut c_void) {
 /// state.set_tempo(140.0, now);
 /// link.commit_app_session_state(&state);
 /// ```
+///
+/// # Static Callbacks
+///
+/// The `set_*_callback` methods accept any closure, which they box. For
+/// firmware where heap is scarce, each has a `set_static_*_callback` variant
+/// (such as [`set_static_tempo_callback`](Self::set_static_tempo_callback))
+/// that accepts only zero-sized callbacks: function items and closures that
+/// capture nothing. These are never boxed. A shim is generated for each
+/// callback type, so the callback is called directly (and can be inlined into
+/// the shim), which Link reaches through a plain function pointer instead of
+/// a vtable. Passing a capturing closure or a function pointer fails to
+/// compile.
+///
+/// An `extern "C" fn` handler (for example one implemented in C) can be
+/// registered by wrapping it in a non-capturing closure, which is still
+/// zero-sized:
+///
+/// ```no_run
+/// use esp_idf_ableton_link::Link;
+///
+/// unsafe extern "C" {
+///     fn on_tempo(tempo: f64);
+/// }
+///
+/// let link = Link::new(120.0).unwrap();
+/// link.set_static_tempo_callback(|tempo| unsafe { on_tempo(tempo) });
+/// ```
+///
+/// Static callbacks have no state of their own. To share data with the rest
+/// of the application, use `static`s, such as atomics.
+///
+/// # Multiple Instances
+///
+/// Each Link instance has its own tasks, sockets and discovery, as the
+/// `esp_abl_link` component creates them inside `abl_link_create` and
+/// offers no way to share them between instances. Every extra instance
+/// therefore costs the same memory as the first. A disabled instance sends
+/// and receives nothing, so keep a secondary session, for example for
+/// rehearsals, disabled while it is not in use: it then adds no network
+/// traffic and no work on its tasks.
 pub struct Link {
     handle: sys::abl_link,
-    // Callbacks protected by mutex. The trampoline locks before calling,
-    // ensuring callbacks cannot be dropped while executing.
-    num_peers_callback: Callback<u64>,
-    tempo_callback: Callback<f64>,
-    start_stop_callback: Callback<bool>,
+    // Lock-free callback slots, for the application and for helpers. The
+    // trampoline takes a callback out of its slot while running it, ensuring
+    // callbacks cannot be dropped while executing. On the heap, so that the
+    // contexts registered with Link stay put when the Link instance moves.
+    callbacks: Arc<Callbacks>,
+    // Republished on every commit, once created.
+    shared_timeline: OnceLock<(Arc<TimelineCell>, Subscription)>,
 }
 
 // Safety: Link holds a pointer to a heap-allocated C++ object. All methods
 // we call are documented as "Thread-safe: yes" in abl_link.h, and callback
-// context management is protected by a Mutex.
+// context management uses atomic operations only.
 unsafe impl Send for Link {}
 unsafe impl Sync for Link {}
 
@@ -494,6 +706,9 @@ impl Link {
     ///
     /// let link = Link::new(120.0).expect("Failed to create Link");
     /// ```
+    ///
+    /// The tasks Link starts are configured by the component, see
+    /// [Link Tasks](crate#link-tasks).
     pub fn new(initial_bpm: f64) -> Result<Self, LinkError> {
         // Safety: abl_link_create is safe to call with any f64 value. It
         // allocates a new Link instance and returns a struct with impl pointer.
@@ -506,11 +721,31 @@ impl Link {
                 "Created Link instance at {:p} with {initial_bpm} BPM",
                 handle.impl_
             );
+            let callbacks = Arc::new(Callbacks::new());
+            // Safety: handle is valid, the trampolines have the correct
+            // signatures, and the contexts point into the callbacks, which
+            // outlive the Link instance.
+            unsafe {
+                sys::abl_link_set_num_peers_callback(
+                    handle,
+                    Some(trampoline::<u64, u64>),
+                    callbacks.num_peers.context(),
+                );
+                sys::abl_link_set_tempo_callback(
+                    handle,
+                    Some(trampoline::<f64, f64>),
+                    callbacks.tempo.context(),
+                );
+                sys::abl_link_set_start_stop_callback(
+                    handle,
+                    Some(trampoline::<bool, TransportState>),
+                    callbacks.start_stop.context(),
+                );
+            }
             Ok(Self {
                 handle,
-                num_peers_callback: Mutex::new(None),
-                tempo_callback: Mutex::new(None),
-                start_stop_callback: Mutex::new(None),
+                callbacks,
+                shared_timeline: OnceLock::new(),
             })
         }
     }
@@ -573,6 +808,17 @@ impl Link {
     ///
     /// The number of other Link-enabled applications connected to this session.
     /// Returns 0 if no peers are connected (solo mode).
+    ///
+    /// To see how well the session is synced, beyond the number of peers, use
+    /// a [`SyncMonitor`].
+    ///
+    /// Only the count is available. Link keeps its peer table (peer IDs,
+    /// endpoints, session IDs and measured clock offsets) inside its C++
+    /// core, and the `esp_abl_link` component exports no functions to read
+    /// it, so which peer joined or left can't be told from here. To react to
+    /// count changes without polling, use
+    /// [`event_queue`](Self::event_queue), which timestamps each change
+    /// without allocating on the Link thread.
     #[must_use]
     pub fn num_peers(&self) -> u64 {
         // Safety: handle is valid (checked in new()).
@@ -662,17 +908,39 @@ impl Link {
     /// let tempo = state.tempo();
     /// ```
     pub fn capture_app_session_state(&self) -> Result<SessionState, LinkError> {
-        // Safety: abl_link_create_session_state allocates a new session state.
-        let session_state = unsafe { sys::abl_link_create_session_state() };
-
-        if session_state.impl_.is_null() {
-            return Err(LinkError::AllocationFailed);
-        }
+        let mut state = SessionState::new()?;
+        self.capture_app_session_state_into(&mut state);
+        Ok(state)
+    }
 
+    /// Capture the current Link session state from an application thread
+    /// into an existing [`SessionState`].
+    ///
+    /// This is the same as
+    /// [`capture_app_session_state`](Self::capture_app_session_state), but
+    /// overwrites `state` instead of allocating a new session state. Use it
+    /// with a session state from [`SessionState::new`] to capture repeatedly
+    /// without heap allocations.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::{Link, SessionState};
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// let mut state = SessionState::new().unwrap();
+    /// loop {
+    ///     link.capture_app_session_state_into(&mut state);
+    ///     let tempo = state.tempo();
+    ///     // ...
+    /// }
+    /// ```
+    pub fn capture_app_session_state_into(&self, state: &mut SessionState) {
+        #[cfg(feature = "stats")]
+        let _timing = stats::STATS.capture_app.start();
         // Safety: Both handles are valid.
-        unsafe { sys::abl_link_capture_app_session_state(self.handle, session_state) };
-
-        Ok(SessionState::from_handle(session_state))
+        unsafe { sys::abl_link_capture_app_session_state(self.handle, state.handle) }
+        state.modified = false;
     }
 
     /// Commit the given session state to the Link session from an application
@@ -700,8 +968,52 @@ impl Link {
     /// link.commit_app_session_state(&state);
     /// ```
     pub fn commit_app_session_state(&mut self, state: &SessionState) {
-        // Safety: both handles are valid.
-        unsafe { sys::abl_link_commit_app_session_state(self.handle, state.handle) }
+        {
+            #[cfg(feature = "stats")]
+            let _timing = stats::STATS.commit_app.start();
+            // Safety: both handles are valid.
+            unsafe { sys::abl_link_commit_app_session_state(self.handle, state.handle) }
+        }
+        if let Some((cell, _)) = self.shared_timeline.get() {
+            cell.refresh();
+        }
+    }
+
+    /// Commit the given session state from an application thread, but only
+    /// if it was modified since it was captured.
+    ///
+    /// This skips the FFI call, Link's internal lock and any resulting
+    /// network traffic when nothing changed, so a control loop can capture
+    /// and commit on every iteration. See [`SessionState::is_modified`].
+    ///
+    /// After committing, the session state counts as unmodified again.
+    ///
+    /// Returns whether the session state was committed.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::{Link, SessionState};
+    ///
+    /// let mut link = Link::new(120.0).unwrap();
+    /// let mut state = SessionState::new().unwrap();
+    /// # let tempo_knob_moved = || false;
+    /// loop {
+    ///     link.capture_app_session_state_into(&mut state);
+    ///     if tempo_knob_moved() {
+    ///         state.set_tempo(140.0, link.clock_now());
+    ///     }
+    ///     // Only crosses FFI when the tempo was set
+    ///     link.commit_app_session_state_if_modified(&mut state);
+    /// }
+    /// ```
+    pub fn commit_app_session_state_if_modified(&mut self, state: &mut SessionState) -> bool {
+        let modified = state.modified;
+        if modified {
+            self.commit_app_session_state(state);
+            state.modified = false;
+        }
+        modified
     }
 
     /// Register a callback to be notified when the number of peers changes.
@@ -710,19 +1022,21 @@ impl Link {
     /// peers in the Link session changes.
     ///
     /// Setting a new callback replaces any previously registered callback.
+    /// Helpers such as [`event_queue`](Self::event_queue) have callbacks of
+    /// their own, which this doesn't affect.
     /// Use [`clear_num_peers_callback`](Self::clear_num_peers_callback) to
     /// unregister without setting a new one.
     ///
-    /// # Arguments
+    /// Replacing or clearing a callback never blocks, even if the previous
+    /// callback is currently running. The previous callback is dropped once
+    /// it returns.
     ///
-    /// * `callback` - A closure that receives the new peer count.
+    /// Panics in the callback are caught to prevent unwinding across the FFI
+    /// boundary.
     ///
-    /// # Panics
+    /// # Arguments
     ///
-    /// Panics if the internal mutex is poisoned. This can happen if a
-    /// previously registered callback panicked. Note that panics in callbacks
-    /// are caught to prevent unwinding across the FFI boundary, but the mutex
-    /// will still be poisoned.
+    /// * `callback` - A closure that receives the new peer count.
     ///
     /// # Example
     ///
@@ -739,34 +1053,54 @@ impl Link {
     where
         F: FnMut(u64) + Send + 'static,
     {
-        let boxed: Box<dyn FnMut(u64) + Send> = Box::new(callback);
-
-        // Lock mutex and replace callback. Any in-flight trampoline call
-        // is blocked until we release the lock.
-        *self.num_peers_callback.lock().unwrap() = Some(boxed);
-
-        // Safety: handle is valid (checked in new()), trampoline has correct
-        // signature. Context pointer is stable for Link's lifetime.
-        let context = std::ptr::from_ref(&self.num_peers_callback)
-            .cast_mut()
-            .cast::<c_void>();
-        unsafe {
-            sys::abl_link_set_num_peers_callback(self.handle, Some(trampoline::<u64>), context);
-        }
+        self.callbacks.num_peers.set(Some(Box::new(callback)));
     }
 
-    /// Clear the num peers callback without setting a new one.
+    /// Register a zero-sized callback to be notified when the number of peers
+    /// changes, without allocating.
     ///
-    /// After calling this, no callback will be invoked when the peer count changes.
+    /// This is like [`set_num_peers_callback`](Self::set_num_peers_callback),
+    /// but the callback is not boxed. Instead, a shim is generated for the
+    /// callback's type, which calls it directly, so Link reaches it through a
+    /// plain function pointer rather than a box and vtable. See
+    /// [Static Callbacks](#static-callbacks).
     ///
-    /// # Panics
+    /// Setting a new callback replaces any previously registered callback.
+    /// Helpers such as [`event_queue`](Self::event_queue) have callbacks of
+    /// their own, which this doesn't affect.
+    /// Use [`clear_num_peers_callback`](Self::clear_num_peers_callback) to
+    /// unregister without setting a new one.
+    ///
+    /// # Arguments
+    ///
+    /// * `callback` - A function item or non-capturing closure that receives
+    ///   the new peer count.
     ///
-    /// Panics if the internal mutex is poisoned. See
-    /// [`set_num_peers_callback`](Self::set_num_peers_callback) for details.
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::Link;
+    ///
+    /// fn on_num_peers(num_peers: u64) {
+    ///     log::info!("Peer count changed: {}", num_peers);
+    /// }
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// link.set_static_num_peers_callback(on_num_peers);
+    /// link.enable();
+    /// ```
+    pub fn set_static_num_peers_callback<F>(&self, callback: F)
+    where
+        F: Fn(u64) + Copy + Send + Sync + 'static,
+    {
+        self.callbacks.num_peers.set_static(callback);
+    }
+
+    /// Clear the num peers callback without setting a new one.
+    ///
+    /// After calling this, no callback will be invoked when the peer count changes.
     pub fn clear_num_peers_callback(&self) {
-        // Lock mutex and clear callback. Any in-flight trampoline call
-        // is blocked until we release the lock.
-        *self.num_peers_callback.lock().unwrap() = None;
+        self.callbacks.num_peers.set(None);
     }
 
     /// Register a callback to be notified when the session tempo changes.
@@ -775,19 +1109,21 @@ impl Link {
     /// of the Link session changes.
     ///
     /// Setting a new callback replaces any previously registered callback.
+    /// Helpers such as [`event_queue`](Self::event_queue) have callbacks of
+    /// their own, which this doesn't affect.
     /// Use [`clear_tempo_callback`](Self::clear_tempo_callback) to unregister
     /// without setting a new one.
     ///
-    /// # Arguments
+    /// Replacing or clearing a callback never blocks, even if the previous
+    /// callback is currently running. The previous callback is dropped once
+    /// it returns.
     ///
-    /// * `callback` - A closure that receives the new tempo in BPM.
+    /// Panics in the callback are caught to prevent unwinding across the FFI
+    /// boundary.
     ///
-    /// # Panics
+    /// # Arguments
     ///
-    /// Panics if the internal mutex is poisoned. This can happen if a
-    /// previously registered callback panicked. Note that panics in callbacks
-    /// are caught to prevent unwinding across the FFI boundary, but the mutex
-    /// will still be poisoned.
+    /// * `callback` - A closure that receives the new tempo in BPM.
     ///
     /// # Example
     ///
@@ -804,34 +1140,52 @@ impl Link {
     where
         F: FnMut(f64) + Send + 'static,
     {
-        let boxed: Box<dyn FnMut(f64) + Send> = Box::new(callback);
-
-        // Lock mutex and replace callback. Any in-flight trampoline call
-        // is blocked until we release the lock.
-        *self.tempo_callback.lock().unwrap() = Some(boxed);
-
-        // Safety: handle is valid (checked in new()), trampoline has correct
-        // signature. Context pointer is stable for Link's lifetime.
-        let context = std::ptr::from_ref(&self.tempo_callback)
-            .cast_mut()
-            .cast::<c_void>();
-        unsafe {
-            sys::abl_link_set_tempo_callback(self.handle, Some(trampoline::<f64>), context);
-        }
+        self.callbacks.tempo.set(Some(Box::new(callback)));
     }
 
-    /// Clear the tempo callback without setting a new one.
+    /// Register a zero-sized callback to be notified when the session tempo
+    /// changes, without allocating.
     ///
-    /// After calling this, no callback will be invoked when the tempo changes.
+    /// This is like [`set_tempo_callback`](Self::set_tempo_callback), but the
+    /// callback is not boxed. Instead, a shim is generated for the callback's
+    /// type, which calls it directly, so Link reaches it through a plain
+    /// function pointer rather than a box and vtable. See
+    /// [Static Callbacks](#static-callbacks).
     ///
-    /// # Panics
+    /// Setting a new callback replaces any previously registered callback.
+    /// Helpers such as [`event_queue`](Self::event_queue) have callbacks of
+    /// their own, which this doesn't affect.
+    /// Use [`clear_tempo_callback`](Self::clear_tempo_callback) to unregister
+    /// without setting a new one.
+    ///
+    /// # Arguments
+    ///
+    /// * `callback` - A function item or non-capturing closure that receives
+    ///   the new tempo in BPM.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::Link;
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// link.set_static_tempo_callback(|tempo| {
+    ///     log::info!("Tempo changed: {} BPM", tempo);
+    /// });
+    /// link.enable();
+    /// ```
+    pub fn set_static_tempo_callback<F>(&self, callback: F)
+    where
+        F: Fn(f64) + Copy + Send + Sync + 'static,
+    {
+        self.callbacks.tempo.set_static(callback);
+    }
+
+    /// Clear the tempo callback without setting a new one.
     ///
-    /// Panics if the internal mutex is poisoned. See
-    /// [`set_tempo_callback`](Self::set_tempo_callback) for details.
+    /// After calling this, no callback will be invoked when the tempo changes.
     pub fn clear_tempo_callback(&self) {
-        // Lock mutex and clear callback. Any in-flight trampoline call
-        // is blocked until we release the lock.
-        *self.tempo_callback.lock().unwrap() = None;
+        self.callbacks.tempo.set(None);
     }
 
     /// Register a callback to be notified when the transport state changes.
@@ -846,19 +1200,21 @@ impl Link {
     /// enables scheduling actions to coincide with the actual start/stop time.
     ///
     /// Setting a new callback replaces any previously registered callback.
+    /// Helpers such as [`event_queue`](Self::event_queue) have callbacks of
+    /// their own, which this doesn't affect.
     /// Use [`clear_transport_state_callback`](Self::clear_transport_state_callback)
     /// to unregister without setting a new one.
     ///
-    /// # Arguments
+    /// Replacing or clearing a callback never blocks, even if the previous
+    /// callback is currently running. The previous callback is dropped once
+    /// it returns.
     ///
-    /// * `callback` - A closure that receives the new [`TransportState`].
+    /// Panics in the callback are caught to prevent unwinding across the FFI
+    /// boundary.
     ///
-    /// # Panics
+    /// # Arguments
     ///
-    /// Panics if the internal mutex is poisoned. This can happen if a
-    /// previously registered callback panicked. Note that panics in callbacks
-    /// are caught to prevent unwinding across the FFI boundary, but the mutex
-    /// will still be poisoned.
+    /// * `callback` - A closure that receives the new [`TransportState`].
     ///
     /// # Example
     ///
@@ -888,42 +1244,265 @@ impl Link {
     ///     }
     /// }
     /// ```
-    pub fn set_transport_state_callback<F>(&self, mut callback: F)
+    pub fn set_transport_state_callback<F>(&self, callback: F)
     where
         F: FnMut(TransportState) + Send + 'static,
     {
-        // Wrap the user's callback to convert bool -> TransportState
-        let wrapper = move |is_playing: bool| {
-            callback(TransportState::from(is_playing));
-        };
-        let boxed: Box<dyn FnMut(bool) + Send> = Box::new(wrapper);
-
-        // Lock mutex and replace callback. Any in-flight trampoline call
-        // is blocked until we release the lock.
-        *self.start_stop_callback.lock().unwrap() = Some(boxed);
-
-        // Safety: handle is valid (checked in new()), trampoline has correct
-        // signature. Context pointer is stable for Link's lifetime.
-        let context = std::ptr::from_ref(&self.start_stop_callback)
-            .cast_mut()
-            .cast::<c_void>();
-        unsafe {
-            sys::abl_link_set_start_stop_callback(self.handle, Some(trampoline::<bool>), context);
-        }
+        self.callbacks.start_stop.set(Some(Box::new(callback)));
+    }
+
+    /// Register a zero-sized callback to be notified when the transport state
+    /// changes, without allocating.
+    ///
+    /// This is like
+    /// [`set_transport_state_callback`](Self::set_transport_state_callback),
+    /// but the callback is not boxed. Instead, a shim is generated for the
+    /// callback's type, which calls it directly, so Link reaches it through a
+    /// plain function pointer rather than a box and vtable. See
+    /// [Static Callbacks](#static-callbacks).
+    ///
+    /// Setting a new callback replaces any previously registered callback.
+    /// Helpers such as [`event_queue`](Self::event_queue) have callbacks of
+    /// their own, which this doesn't affect.
+    /// Use [`clear_transport_state_callback`](Self::clear_transport_state_callback)
+    /// to unregister without setting a new one.
+    ///
+    /// # Arguments
+    ///
+    /// * `callback` - A function item or non-capturing closure that receives
+    ///   the new [`TransportState`].
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::{Link, TransportState};
+    ///
+    /// fn on_transport_state(state: TransportState) {
+    ///     log::info!("Transport state changed: {:?}", state);
+    /// }
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// link.enable_transport_sync();
+    /// link.set_static_transport_state_callback(on_transport_state);
+    /// link.enable();
+    /// ```
+    pub fn set_static_transport_state_callback<F>(&self, callback: F)
+    where
+        F: Fn(TransportState) + Copy + Send + Sync + 'static,
+    {
+        self.callbacks.start_stop.set_static(callback);
     }
 
     /// Clear the transport state callback without setting a new one.
     ///
     /// After calling this, no callback will be invoked when the transport state changes.
+    pub fn clear_transport_state_callback(&self) {
+        self.callbacks.start_stop.set(None);
+    }
+
+    /// Deliver Link notifications into a bounded event queue instead of
+    /// running application callbacks on the Link thread.
+    ///
+    /// Every peer count, tempo and transport state notification is pushed as
+    /// a [`LinkEvent`], timestamped with
+    /// [`clock_now`](Self::clock_now), into a lock-free ring buffer of `N`
+    /// events. The returned [`EventReceiver`] drains it from your own task,
+    /// either by polling or by waiting on a `FreeRTOS` task notification.
+    ///
+    /// A slow consumer can never delay the Link thread: pushing an event
+    /// doesn't block or allocate, and events that don't fit in the queue are
+    /// dropped and counted (see [`EventReceiver::dropped_events`]).
+    ///
+    /// The queue itself is allocated once, by this call. It receives events
+    /// alongside the application's callbacks and any other helpers, such as
+    /// further queues, until the receiver is dropped.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::TooManySubscribers`] if too many helpers follow
+    /// the Link instance's notifications already.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::{Link, LinkEventKind};
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// let mut events = link.event_queue::<16>().unwrap();
+    /// link.enable();
+    ///
+    /// loop {
+    ///     let event = events.recv();
+    ///     match event.kind {
+    ///         LinkEventKind::NumPeers(num_peers) => log::info!("{num_peers} peers"),
+    ///         LinkEventKind::Tempo(tempo) => log::info!("{tempo} BPM"),
+    ///         LinkEventKind::TransportState(state) => log::info!("{state:?}"),
+    ///     }
+    /// }
+    /// ```
+    pub fn event_queue<const N: usize>(&self) -> Result<EventReceiver<N>, LinkError> {
+        let ring = Arc::new(EventRing::<N>::new());
+        let clock = CallbackClock::new(self.handle);
+
+        let num_peers_ring = Arc::clone(&ring);
+        let tempo_ring = Arc::clone(&ring);
+        let transport_ring = Arc::clone(&ring);
+        let subscription = self.callbacks.subscribe(
+            move |num_peers| {
+                num_peers_ring.push(LinkEvent {
+                    time: clock.now(),
+                    kind: LinkEventKind::NumPeers(num_peers),
+                });
+            },
+            move |tempo| {
+                tempo_ring.push(LinkEvent {
+                    time: clock.now(),
+                    kind: LinkEventKind::Tempo(tempo),
+                });
+            },
+            move |state| {
+                transport_ring.push(LinkEvent {
+                    time: clock.now(),
+                    kind: LinkEventKind::TransportState(state),
+                });
+            },
+        )?;
+
+        Ok(EventReceiver::new(ring, subscription))
+    }
+
+    /// Create a [`BeatScheduler`] that produces `ticks_per_beat` ticks per
+    /// beat of the session timeline.
+    ///
+    /// Beat values are computed with the given `quantum`, so ticks with an
+    /// index that is a multiple of `ticks_per_beat * quantum` fall on the
+    /// session's downbeats.
+    ///
+    /// The scheduler captures the session state again whenever the peer
+    /// count, tempo or transport state changes. It follows these
+    /// notifications alongside the application's callbacks and any other
+    /// helpers, until it is dropped.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state used by
+    /// the scheduler could not be allocated, or
+    /// [`LinkError::TooManySubscribers`] if too many helpers follow the Link
+    /// instance's notifications already.
     ///
     /// # Panics
     ///
-    /// Panics if the internal mutex is poisoned. See
-    /// [`set_transport_state_callback`](Self::set_transport_state_callback) for details.
-    pub fn clear_transport_state_callback(&self) {
-        // Lock mutex and clear callback. Any in-flight trampoline call
-        // is blocked until we release the lock.
-        *self.start_stop_callback.lock().unwrap() = None;
+    /// Panics if `ticks_per_beat` is zero.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::Link;
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    ///
+    /// // Compute the times of the next bar of sixteenth notes
+    /// let scheduler = link.beat_scheduler(4, 4.0).unwrap();
+    /// for tick in scheduler.take(16) {
+    ///     log::info!("Sixteenth at beat {} at {:?}", tick.beat, tick.time);
+    /// }
+    /// ```
+    pub fn beat_scheduler(
+        &self,
+        ticks_per_beat: u32,
+        quantum: f64,
+    ) -> Result<BeatScheduler<'_>, LinkError> {
+        BeatScheduler::new(self, ticks_per_beat, quantum)
+    }
+
+    /// Create futures for Link's notifications, for use with async
+    /// executors.
+    ///
+    /// The futures follow the peer count, tempo and transport state
+    /// notifications alongside the application's callbacks and any other
+    /// helpers, until the returned handle is dropped. See [`AsyncEvents`].
+    ///
+    /// Requires the `async` feature.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state used for
+    /// sleeping could not be allocated, [`LinkError::Driver`] if the
+    /// `esp_timer` used for sleeping could not be created, or
+    /// [`LinkError::TooManySubscribers`] if too many helpers follow the Link
+    /// instance's notifications already.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::Link;
+    ///
+    /// # async fn run() {
+    /// let link = Link::new(120.0).unwrap();
+    /// let events = link.async_events().unwrap();
+    /// link.enable();
+    ///
+    /// loop {
+    ///     let tempo = events.tempo_changed().await;
+    ///     log::info!("Tempo changed: {} BPM", tempo);
+    /// }
+    /// # }
+    /// ```
+    #[cfg(feature = "async")]
+    pub fn async_events(&self) -> Result<AsyncEvents<'_>, LinkError> {
+        AsyncEvents::new(self)
+    }
+
+    /// Create a [`SharedTimeline`], which publishes the session timeline to
+    /// any number of readers on any core, without locking.
+    ///
+    /// The timeline is published now, on every
+    /// [`commit_app_session_state`](Self::commit_app_session_state) and
+    /// [`AudioLink::commit_session_state`], and from the Link thread when the number of peers, tempo or transport state
+    /// changes, alongside the application's callbacks and any other helpers,
+    /// for as long as the Link instance exists.
+    ///
+    /// All shared timelines of a Link instance are clones of the first one.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state used for
+    /// publishing could not be allocated, or
+    /// [`LinkError::TooManySubscribers`] if this is the first shared timeline
+    /// and too many helpers follow the Link instance's notifications already.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::Link;
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// let shared = link.shared_timeline().unwrap();
+    ///
+    /// std::thread::spawn(move || {
+    ///     let timeline = shared.timeline();
+    ///     log::info!("{} BPM", timeline.tempo());
+    /// });
+    /// ```
+    pub fn shared_timeline(&self) -> Result<SharedTimeline, LinkError> {
+        let cell = if let Some((cell, _)) = self.shared_timeline.get() {
+            Arc::clone(cell)
+        } else {
+            let cell = Arc::new(TimelineCell::new(self.handle)?);
+            let num_peers_cell = Arc::clone(&cell);
+            let tempo_cell = Arc::clone(&cell);
+            let transport_cell = Arc::clone(&cell);
+            let subscription = self.callbacks.subscribe(
+                move |_| num_peers_cell.refresh(),
+                move |_| tempo_cell.refresh(),
+                move |_| transport_cell.refresh(),
+            )?;
+            // A concurrent call may have won the race; use its cell then, and
+            // drop this subscription.
+            Arc::clone(&self.shared_timeline.get_or_init(|| (cell, subscription)).0)
+        };
+
+        Ok(SharedTimeline::new(cell))
     }
 
     /// Get the current Link clock time.
@@ -950,6 +1529,50 @@ impl Link {
         Instant::from_micros(unsafe { sys::abl_link_clock_micros(self.handle) })
     }
 
+    /// Get a snapshot of the timing statistics of the hot paths.
+    ///
+    /// With the `stats` feature, every session state capture and commit (app
+    /// and audio thread) and every callback invocation on the Link thread is
+    /// timed with the CPU cycle counter, and recorded in a fixed-size
+    /// histogram. Recording costs a few atomic operations and never
+    /// allocates or blocks. Failed [`SessionState`] allocations are counted
+    /// as well.
+    ///
+    /// The statistics are process-wide: they cover all Link instances, and
+    /// start at zero when the program starts or on
+    /// [`reset_stats`](Self::reset_stats).
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::Link;
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// // ... run for a while ...
+    /// let stats = link.stats();
+    /// let capture = stats.capture_app_session_state;
+    /// log::info!(
+    ///     "capture: {} calls, min {} / p99 {} / max {} cycles",
+    ///     capture.calls,
+    ///     capture.min_cycles,
+    ///     capture.p99_cycles,
+    ///     capture.max_cycles,
+    /// );
+    /// ```
+    #[cfg(feature = "stats")]
+    #[must_use]
+    pub fn stats(&self) -> LinkStats {
+        stats::STATS.snapshot()
+    }
+
+    /// Reset the timing statistics to zero.
+    ///
+    /// See [`stats`](Self::stats).
+    #[cfg(feature = "stats")]
+    pub fn reset_stats(&self) {
+        stats::STATS.reset();
+    }
+
     /// Bind this Link instance for audio-thread access.
     ///
     /// Returns an [`AudioLink`] handle that provides realtime-safe
@@ -992,7 +1615,7 @@ impl Drop for Link {
         // Safety: handle is valid (checked in new()). After this call, handle
         // is invalid but that's fine since we're being dropped.
         // Note: abl_link_destroy waits for pending callbacks to complete,
-        // so the callback Mutexes will be dropped only after that.
+        // so the callback slots will be dropped only after that.
         unsafe { sys::abl_link_destroy(self.handle) }
     }
 }
@@ -1075,29 +1698,55 @@ impl AudioLink<'_> {
         }
     }
 
-    /// Capture the current Link session state (realtime-safe).
+    /// Capture the current Link session state (non-blocking).
     ///
-    /// This method is non-blocking and safe to call from a realtime audio
-    /// context. The returned [`SessionState`] is a snapshot that should be
-    /// used locally and not stored for later use.
+    /// This method never blocks on Link's internal synchronization. The
+    /// returned [`SessionState`] is a snapshot that should be used locally and
+    /// not stored for later use.
+    ///
+    /// **Note:** This allocates a new session state on every call, and
+    /// dropping it frees it again. For a fully realtime-safe capture, use
+    /// [`capture_session_state_into`](Self::capture_session_state_into)
+    /// with a session state allocated up front.
     ///
     /// # Errors
     ///
     /// Returns [`LinkError::AllocationFailed`] if the session state
     /// could not be allocated.
     pub fn capture_session_state(&self) -> Result<SessionState, LinkError> {
-        // Safety: abl_link_create_session_state allocates a new session state.
-        let session_state = unsafe { sys::abl_link_create_session_state() };
-
-        if session_state.impl_.is_null() {
-            return Err(LinkError::AllocationFailed);
-        }
+        let mut state = SessionState::new()?;
+        self.capture_session_state_into(&mut state);
+        Ok(state)
+    }
 
+    /// Capture the current Link session state into an existing
+    /// [`SessionState`] (realtime-safe).
+    ///
+    /// This method is non-blocking and does not allocate, making it safe to
+    /// call from a realtime audio context. It overwrites `state` with the
+    /// current session state. Allocate `state` once with
+    /// [`SessionState::new`] outside the audio callback.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::{Link, SessionState};
+    ///
+    /// let mut link = Link::new(120.0).unwrap();
+    /// let mut state = SessionState::new().unwrap();
+    /// let audio_link = link.bind_audio_thread();
+    ///
+    /// // In the audio callback:
+    /// audio_link.capture_session_state_into(&mut state);
+    /// let beat = state.beat_at_time(audio_link.clock_now(), 4.0);
+    /// ```
+    pub fn capture_session_state_into(&self, state: &mut SessionState) {
+        #[cfg(feature = "stats")]
+        let _timing = stats::STATS.capture_audio.start();
         // Safety: Both handles are valid. AudioLink's !Send guarantee ensures
         // we're on the designated audio thread.
-        unsafe { sys::abl_link_capture_audio_session_state(self.link.handle, session_state) };
-
-        Ok(SessionState::from_handle(session_state))
+        unsafe { sys::abl_link_capture_audio_session_state(self.link.handle, state.handle) }
+        state.modified = false;
     }
 
     /// Commit the given session state to the Link session (realtime-safe).
@@ -1105,9 +1754,32 @@ impl AudioLink<'_> {
     /// This method is non-blocking and safe to call from a realtime audio
     /// context. The given session state will replace the current Link session
     /// state, and modifications will be communicated to other peers.
+    ///
+    /// Once a [`SharedTimeline`] exists, the committed timeline is published
+    /// to it as well.
     pub fn commit_session_state(&self, state: &SessionState) {
+        #[cfg(feature = "stats")]
+        let _timing = stats::STATS.commit_audio.start();
         // Safety: Both handles are valid. AudioLink's !Send guarantee ensures
         // we're on the designated audio thread.
         unsafe { sys::abl_link_commit_audio_session_state(self.link.handle, state.handle) }
+        if let Some((cell, _)) = self.link.shared_timeline.get() {
+            cell.publish_audio(&state.timeline());
+        }
+    }
+
+    /// Commit the given session state (realtime-safe), but only if it was
+    /// modified since it was captured.
+    ///
+    /// After committing, the session state counts as unmodified again.
+    /// Returns whether the session state was committed. See
+    /// [`Link::commit_app_session_state_if_modified`].
+    pub fn commit_session_state_if_modified(&self, state: &mut SessionState) -> bool {
+        let modified = state.modified;
+        if modified {
+            self.commit_session_state(state);
+            state.modified = false;
+        }
+        modified
     }
 }
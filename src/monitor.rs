@@ -0,0 +1,265 @@
+//! Sync quality metrics, derived from periodic session state samples.
+
+use std::sync::Arc;
+
+use crate::{
+    Link, LinkError, SessionState,
+    double_buffer::DoubleBuffer,
+    time::{Duration, Instant},
+    timeline::Timeline,
+};
+
+/// Timeline shifts larger than this are counted as realignments instead of
+/// clock corrections.
+const REALIGNMENT_THRESHOLD: Duration = Duration::from_millis(1);
+
+/// Number of samples the correction jitter averages over, approximately.
+const JITTER_WINDOW: f64 = 16.0;
+
+/// Metrics published by a [`SyncMonitor`], as one `u32` each.
+const FIELDS: usize = 9;
+
+/// Sync quality metrics, as measured by a [`SyncMonitor`].
+///
+/// All counts are since the monitor was created or last
+/// [`reset`](SyncMonitor::reset).
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct SyncMetrics {
+    /// The number of samples taken.
+    pub samples: u32,
+    /// The number of peers at the latest sample.
+    pub peers: u32,
+    /// How often the number of peers changed between samples.
+    pub peer_changes: u32,
+    /// How often the session tempo changed between samples.
+    pub tempo_changes: u32,
+    /// How often the timeline shifted by more than a millisecond between
+    /// samples at the same tempo: the session re-converged, for example
+    /// when a peer joined or after a network outage.
+    pub realignments: u32,
+    /// The shift of the latest realignment, in microseconds. Positive values
+    /// mean beats moved later.
+    pub last_realignment_micros: i32,
+    /// The average size of the small timeline corrections between samples,
+    /// in microseconds. These follow Link's ongoing clock measurements with
+    /// its peers, so they grow with network jitter.
+    pub jitter_micros: u32,
+    /// The largest timeline correction below the realignment threshold, in
+    /// microseconds.
+    pub max_correction_micros: u32,
+    /// The longest time between two samples, in microseconds. When samples
+    /// are taken at a fixed interval from a task at the Link thread's
+    /// priority, a gap much longer than the interval means that task (and
+    /// likely the Link thread) was starved of CPU time.
+    pub max_sample_gap_micros: u32,
+}
+
+impl SyncMetrics {
+    const fn to_fields(self) -> [u32; FIELDS] {
+        #[allow(clippy::cast_sign_loss)]
+        [
+            self.samples,
+            self.peers,
+            self.peer_changes,
+            self.tempo_changes,
+            self.realignments,
+            self.last_realignment_micros as u32,
+            self.jitter_micros,
+            self.max_correction_micros,
+            self.max_sample_gap_micros,
+        ]
+    }
+
+    const fn from_fields(fields: [u32; FIELDS]) -> Self {
+        #[allow(clippy::cast_possible_wrap)]
+        Self {
+            samples: fields[0],
+            peers: fields[1],
+            peer_changes: fields[2],
+            tempo_changes: fields[3],
+            realignments: fields[4],
+            last_realignment_micros: fields[5] as i32,
+            jitter_micros: fields[6],
+            max_correction_micros: fields[7],
+            max_sample_gap_micros: fields[8],
+        }
+    }
+}
+
+/// Measures how well a Link instance is synced with its peers.
+///
+/// The Link API only reports the number of peers. A `SyncMonitor` derives
+/// more from periodic samples of the app session state, taken with
+/// [`sample`](Self::sample) (for example every 100 ms from a housekeeping
+/// task, or after each event from an
+/// [`EventReceiver`](crate::EventReceiver)):
+///
+/// - Small timeline shifts between samples at the same tempo are Link's
+///   clock corrections as it keeps measuring its peers. Their average size
+///   ([`jitter_micros`](SyncMetrics::jitter_micros)) grows with network
+///   jitter, such as Wi-Fi congestion.
+/// - Shifts larger than a millisecond are realignments: the session
+///   re-converged, for example when a peer joined or after a network outage.
+/// - Long gaps between samples mean the sampling task didn't get to run in
+///   time, which, at the Link thread's priority, points at a CPU-starved
+///   Link thread rather than the network.
+///
+/// Tempo changes and beat requests committed by the application itself show
+/// up in the metrics too; call [`resync`](Self::resync) after committing to
+/// exclude them.
+///
+/// The metrics can be read from any task, without locking, through a
+/// [`SyncMetricsReader`].
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Link, SyncMonitor};
+///
+/// let link = Link::new(120.0).unwrap();
+/// let mut monitor = SyncMonitor::new(4.0).unwrap();
+/// let reader = monitor.reader();
+///
+/// std::thread::spawn(move || loop {
+///     std::thread::sleep(std::time::Duration::from_secs(10));
+///     let metrics = reader.metrics();
+///     log::info!("jitter {} us, {} realignments", metrics.jitter_micros, metrics.realignments);
+/// });
+///
+/// loop {
+///     monitor.sample(&link);
+///     std::thread::sleep(std::time::Duration::from_millis(100));
+/// }
+/// ```
+pub struct SyncMonitor {
+    state: SessionState,
+    quantum: f64,
+    previous: Option<(Timeline, Instant)>,
+    jitter: f64,
+    metrics: SyncMetrics,
+    shared: Arc<DoubleBuffer<FIELDS>>,
+}
+
+impl SyncMonitor {
+    /// Create a monitor that compares timelines at the given quantum.
+    ///
+    /// Shifts of whole multiples of `quantum` don't change the phase, so
+    /// they are not counted; use the quantum the application syncs to.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state used for
+    /// sampling could not be allocated.
+    pub fn new(quantum: f64) -> Result<Self, LinkError> {
+        Ok(Self {
+            state: SessionState::new()?,
+            quantum,
+            previous: None,
+            jitter: 0.0,
+            metrics: SyncMetrics::default(),
+            shared: Arc::new(DoubleBuffer::new()),
+        })
+    }
+
+    /// Sample the app session state and peer count of `link`, and update the
+    /// metrics.
+    ///
+    /// This doesn't allocate.
+    #[allow(
+        clippy::cast_possible_truncation,
+        clippy::cast_sign_loss,
+        clippy::cast_precision_loss
+    )]
+    pub fn sample(&mut self, link: &Link) {
+        link.capture_app_session_state_into(&mut self.state);
+        let now = link.clock_now();
+        let timeline = self.state.timeline();
+        let peers = u32::try_from(link.num_peers()).unwrap_or(u32::MAX);
+
+        let metrics = &mut self.metrics;
+        metrics.samples = metrics.samples.saturating_add(1);
+        if metrics.samples > 1 && peers != metrics.peers {
+            metrics.peer_changes = metrics.peer_changes.saturating_add(1);
+        }
+        metrics.peers = peers;
+
+        if let Some((previous, previous_time)) = self.previous {
+            let gap = (now - previous_time).as_micros();
+            metrics.max_sample_gap_micros = metrics
+                .max_sample_gap_micros
+                .max(gap.clamp(0, i64::from(u32::MAX)) as u32);
+
+            if timeline.tempo().to_bits() == previous.tempo().to_bits() {
+                let beat = previous.beat_at_time(now, self.quantum);
+                let shift = timeline.time_at_beat(beat, self.quantum)
+                    - previous.time_at_beat(beat, self.quantum);
+                let size = shift.as_micros().unsigned_abs();
+                if shift.abs() > REALIGNMENT_THRESHOLD {
+                    metrics.realignments = metrics.realignments.saturating_add(1);
+                    metrics.last_realignment_micros = shift
+                        .as_micros()
+                        .clamp(i64::from(i32::MIN), i64::from(i32::MAX))
+                        as i32;
+                } else {
+                    self.jitter += (size as f64 - self.jitter) / JITTER_WINDOW;
+                    metrics.jitter_micros = self.jitter.round() as u32;
+                    metrics.max_correction_micros = metrics.max_correction_micros.max(size as u32);
+                }
+            } else {
+                metrics.tempo_changes = metrics.tempo_changes.saturating_add(1);
+            }
+        }
+
+        self.previous = Some((timeline, now));
+        self.shared.store(metrics.to_fields());
+    }
+
+    /// Take the next sample as the new reference, without comparing it to
+    /// the previous one.
+    ///
+    /// Call this after committing a session state, so that the application's
+    /// own tempo changes and beat requests are not counted.
+    pub const fn resync(&mut self) {
+        self.previous = None;
+    }
+
+    /// Reset all metrics to zero.
+    pub fn reset(&mut self) {
+        self.previous = None;
+        self.jitter = 0.0;
+        self.metrics = SyncMetrics::default();
+        self.shared.store(self.metrics.to_fields());
+    }
+
+    /// Get the current metrics.
+    #[must_use]
+    pub const fn metrics(&self) -> SyncMetrics {
+        self.metrics
+    }
+
+    /// Get a handle for reading the metrics from other tasks.
+    #[must_use]
+    pub fn reader(&self) -> SyncMetricsReader {
+        SyncMetricsReader {
+            shared: Arc::clone(&self.shared),
+        }
+    }
+}
+
+/// Reads the metrics of a [`SyncMonitor`] from any task.
+///
+/// Created by [`SyncMonitor::reader`]. Readers are `Clone`, `Send` and
+/// `Sync`. Reading never blocks the monitor: if it publishes new metrics
+/// during a read, the read is retried.
+#[derive(Clone)]
+pub struct SyncMetricsReader {
+    shared: Arc<DoubleBuffer<FIELDS>>,
+}
+
+impl SyncMetricsReader {
+    /// Get the latest metrics published by the monitor.
+    #[must_use]
+    pub fn metrics(&self) -> SyncMetrics {
+        SyncMetrics::from_fields(self.shared.load().1)
+    }
+}
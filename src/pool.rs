@@ -0,0 +1,164 @@
+//! Fixed-capacity pool of preallocated session states.
+
+use std::{
+    cell::UnsafeCell,
+    ops::{Deref, DerefMut},
+    sync::atomic::{AtomicBool, Ordering},
+};
+
+use crate::{LinkError, SessionState};
+
+/// A fixed-capacity pool of preallocated [`SessionState`]s.
+///
+/// All `N` session states are allocated up front by [`new`](Self::new).
+/// [`acquire`](Self::acquire) hands one out as a [`PooledSessionState`]
+/// guard, which returns it to the pool when dropped. The pool never allocates
+/// after construction: when all session states are in use, `acquire` returns
+/// [`LinkError::PoolExhausted`] instead.
+///
+/// This gives a fixed worst-case memory use and removes the heap churn of
+/// [`Link::capture_app_session_state`](crate::Link::capture_app_session_state),
+/// which allocates and frees a session state on every capture.
+///
+/// # Thread Safety
+///
+/// `SessionStatePool` is `Send` and `Sync`, so a single pool can be shared by
+/// several tasks (for example through a `static` or an `Arc`). Acquiring and
+/// releasing are lock-free. Acquiring scans the pool, so it is `O(N)`; keep
+/// `N` small (one per task that captures concurrently).
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Link, SessionStatePool};
+///
+/// let link = Link::new(120.0).unwrap();
+/// let pool = SessionStatePool::<4>::new().unwrap();
+///
+/// // In any task, without allocating:
+/// let mut state = pool.acquire().unwrap();
+/// link.capture_app_session_state_into(&mut state);
+/// let tempo = state.tempo();
+/// // `state` goes back to the pool when dropped
+/// ```
+pub struct SessionStatePool<const N: usize> {
+    slots: [Slot; N],
+}
+
+struct Slot {
+    in_use: AtomicBool,
+    state: UnsafeCell<SessionState>,
+}
+
+// Safety: Each slot's session state is only accessed through a
+// PooledSessionState guard, and the in_use flag ensures at most one guard
+// exists per slot. SessionState is Send, so handing it to whichever thread
+// acquires it is fine.
+unsafe impl<const N: usize> Sync for SessionStatePool<N> {}
+
+impl<const N: usize> SessionStatePool<N> {
+    /// Allocate a pool of `N` session states.
+    ///
+    /// This allocates, so call it during setup rather than on a realtime path.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if any of the session states
+    /// could not be allocated. Session states that were allocated are freed
+    /// again.
+    // The expect below cannot fail, since we checked for allocation failures.
+    #[allow(clippy::missing_panics_doc)]
+    pub fn new() -> Result<Self, LinkError> {
+        let states: [Option<SessionState>; N] = std::array::from_fn(|_| SessionState::new().ok());
+
+        if states.iter().any(Option::is_none) {
+            return Err(LinkError::AllocationFailed);
+        }
+
+        Ok(Self {
+            slots: states.map(|state| Slot {
+                in_use: AtomicBool::new(false),
+                state: UnsafeCell::new(state.expect("all session states were allocated")),
+            }),
+        })
+    }
+
+    /// Take a session state from the pool.
+    ///
+    /// The session state still holds whatever was last captured into it;
+    /// refill it with
+    /// [`Link::capture_app_session_state_into`](crate::Link::capture_app_session_state_into)
+    /// or [`AudioLink::capture_session_state_into`](crate::AudioLink::capture_session_state_into)
+    /// before use.
+    ///
+    /// This is lock-free and does not allocate.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::PoolExhausted`] if all session states are
+    /// currently in use.
+    pub fn acquire(&self) -> Result<PooledSessionState<'_>, LinkError> {
+        self.slots
+            .iter()
+            .find(|slot| {
+                slot.in_use
+                    .compare_exchange(false, true, Ordering::Acquire, Ordering::Relaxed)
+                    .is_ok()
+            })
+            .map(|slot| PooledSessionState { slot })
+            .ok_or(LinkError::PoolExhausted)
+    }
+
+    /// Get the total number of session states in the pool.
+    #[must_use]
+    pub const fn capacity(&self) -> usize {
+        N
+    }
+
+    /// Get the number of session states currently available.
+    ///
+    /// This is only a snapshot: other tasks may acquire or release session
+    /// states at any time.
+    #[must_use]
+    pub fn available(&self) -> usize {
+        self.slots
+            .iter()
+            .filter(|slot| !slot.in_use.load(Ordering::Relaxed))
+            .count()
+    }
+}
+
+/// A [`SessionState`] borrowed from a [`SessionStatePool`].
+///
+/// Dereferences to [`SessionState`], so it can be passed to the capture and
+/// commit methods directly. Returns the session state to the pool when
+/// dropped.
+pub struct PooledSessionState<'a> {
+    slot: &'a Slot,
+}
+
+// Safety: The guard has exclusive access to its slot's session state, and
+// SessionState is Send.
+unsafe impl Send for PooledSessionState<'_> {}
+
+impl Deref for PooledSessionState<'_> {
+    type Target = SessionState;
+
+    fn deref(&self) -> &Self::Target {
+        // Safety: in_use guarantees this guard is the only accessor.
+        unsafe { &*self.slot.state.get() }
+    }
+}
+
+impl DerefMut for PooledSessionState<'_> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        // Safety: in_use guarantees this guard is the only accessor.
+        unsafe { &mut *self.slot.state.get() }
+    }
+}
+
+impl Drop for PooledSessionState<'_> {
+    fn drop(&mut self) {
+        self.slot.in_use.store(false, Ordering::Release);
+    }
+}
@@ -0,0 +1,199 @@
+//! Duty cycling of Link while there are no peers, to save radio time.
+
+use crate::{
+    Link,
+    time::{Duration, Instant},
+};
+
+/// Timing of a [`PowerSaver`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct PowerSaverConfig {
+    /// How long Link must have been without peers before duty cycling
+    /// starts.
+    pub idle_after: Duration,
+    /// How long Link stays enabled in each cycle, listening for peers. Link
+    /// announces itself several times per second while enabled, so this
+    /// should be at least a second.
+    pub listen: Duration,
+    /// How long Link stays disabled in each cycle.
+    pub sleep: Duration,
+}
+
+impl Default for PowerSaverConfig {
+    /// Start after 30 seconds alone, then listen for 2 of every 12 seconds.
+    fn default() -> Self {
+        Self {
+            idle_after: Duration::from_secs(30),
+            listen: Duration::from_secs(2),
+            sleep: Duration::from_secs(10),
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Phase {
+    /// Enabled, because there are peers or haven't been for long.
+    Active { alone_since: Option<Instant> },
+    /// Enabled for a listen window, while alone.
+    Listening { until: Instant },
+    /// Disabled, while alone.
+    Sleeping { until: Instant },
+}
+
+/// Disables Link periodically while it has no peers, so that the Wi-Fi
+/// modem can sleep.
+///
+/// Link's discovery and measurement intervals are fixed inside the Link
+/// library. With peers, that traffic is what keeps the session in phase, so
+/// it is left alone. Without peers, it only announces the device, several
+/// times per second, which keeps waking the radio for nothing. Once Link has
+/// been alone for [`idle_after`](PowerSaverConfig::idle_after), a
+/// `PowerSaver` disables it for [`sleep`](PowerSaverConfig::sleep), then
+/// enables it again for [`listen`](PowerSaverConfig::listen), and repeats
+/// until a peer shows up, at which point Link stays enabled.
+///
+/// While disabled, the local timeline keeps running, so playback continues
+/// at the same tempo. Discovering a new peer takes up to one sleep period
+/// longer; when one is found, the device joins the session like any other
+/// peer. [`SyncMonitor`](crate::SyncMonitor) shows the realignment this
+/// causes, and that sync with peers is unaffected.
+///
+/// This works with any Wi-Fi power save mode set with `esp_wifi_set_ps`:
+/// multicast reception while listening follows the DTIM interval as usual.
+///
+/// The power saver owns the enabled state of Link: enable Link once, then
+/// call [`poll`](Self::poll) regularly, and use
+/// [`set_active`](Self::set_active) instead of
+/// [`Link::disable`](crate::Link::disable).
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Link, PowerSaver, PowerSaverConfig};
+///
+/// let link = Link::new(120.0).unwrap();
+/// link.enable();
+/// let mut power = PowerSaver::new(PowerSaverConfig::default());
+///
+/// loop {
+///     let next = power.poll(&link);
+///     std::thread::sleep(std::time::Duration::from_micros(next.as_micros().unsigned_abs()));
+/// }
+/// ```
+#[derive(Debug, Clone)]
+pub struct PowerSaver {
+    config: PowerSaverConfig,
+    phase: Phase,
+    active: bool,
+    sleeps: u32,
+    time_asleep: Duration,
+}
+
+impl PowerSaver {
+    /// Create a power saver. Duty cycling starts once Link has been without
+    /// peers for [`idle_after`](PowerSaverConfig::idle_after), measured from
+    /// the first [`poll`](Self::poll).
+    #[must_use]
+    pub const fn new(config: PowerSaverConfig) -> Self {
+        Self {
+            config,
+            phase: Phase::Active { alone_since: None },
+            active: true,
+            sleeps: 0,
+            time_asleep: Duration::from_micros(0),
+        }
+    }
+
+    /// Get the configuration.
+    #[must_use]
+    pub const fn config(&self) -> PowerSaverConfig {
+        self.config
+    }
+
+    /// Check the peer count, enable or disable Link as needed, and return
+    /// how long to wait before polling again.
+    ///
+    /// Polling more often than returned is fine, but not needed.
+    pub fn poll(&mut self, link: &Link) -> Duration {
+        let now = link.clock_now();
+        if !self.active {
+            return self.config.idle_after;
+        }
+
+        let alone = link.num_peers() == 0;
+        match self.phase {
+            Phase::Active { alone_since } => match (alone, alone_since) {
+                (false, _) => {
+                    self.phase = Phase::Active { alone_since: None };
+                    self.config.idle_after
+                }
+                (true, None) => {
+                    self.phase = Phase::Active {
+                        alone_since: Some(now),
+                    };
+                    self.config.idle_after
+                }
+                (true, Some(since)) if now - since >= self.config.idle_after => {
+                    self.sleep(link, now)
+                }
+                (true, Some(since)) => self.config.idle_after - (now - since),
+            },
+            Phase::Listening { .. } if !alone => {
+                log::debug!("Found peers, leaving power save");
+                self.phase = Phase::Active { alone_since: None };
+                self.config.idle_after
+            }
+            Phase::Listening { until } if now >= until => self.sleep(link, now),
+            Phase::Sleeping { until } if now >= until => {
+                link.enable();
+                self.phase = Phase::Listening {
+                    until: now + self.config.listen,
+                };
+                self.config.listen
+            }
+            Phase::Listening { until } | Phase::Sleeping { until } => until - now,
+        }
+    }
+
+    fn sleep(&mut self, link: &Link, now: Instant) -> Duration {
+        link.disable();
+        self.phase = Phase::Sleeping {
+            until: now + self.config.sleep,
+        };
+        self.sleeps = self.sleeps.saturating_add(1);
+        self.time_asleep += self.config.sleep;
+        self.config.sleep
+    }
+
+    /// Turn duty cycling on or off.
+    ///
+    /// Turning it off enables Link (if the power saver had disabled it) and
+    /// leaves it enabled; [`poll`](Self::poll) then does nothing until it is
+    /// turned on again.
+    pub fn set_active(&mut self, link: &Link, active: bool) {
+        if matches!(self.phase, Phase::Sleeping { .. }) {
+            link.enable();
+        }
+        self.phase = Phase::Active { alone_since: None };
+        self.active = active;
+    }
+
+    /// Check whether the power saver currently has Link disabled.
+    #[must_use]
+    pub const fn is_sleeping(&self) -> bool {
+        matches!(self.phase, Phase::Sleeping { .. })
+    }
+
+    /// Get the number of times Link was disabled to save power.
+    #[must_use]
+    pub const fn sleeps(&self) -> u32 {
+        self.sleeps
+    }
+
+    /// Get the total time Link was disabled to save power, including the
+    /// current sleep, if any, in full.
+    #[must_use]
+    pub const fn time_asleep(&self) -> Duration {
+        self.time_asleep
+    }
+}
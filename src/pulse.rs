@@ -0,0 +1,447 @@
+//! Hardware-timed pulse output on a GPIO.
+
+use std::{
+    cell::UnsafeCell,
+    ffi::c_void,
+    ptr,
+    sync::atomic::{AtomicU8, Ordering},
+};
+
+use esp_idf_sys::{
+    EspError, TickType_t, esp_err_t, gpio_mode_t_GPIO_MODE_OUTPUT, gpio_num_t, gpio_reset_pin,
+    gpio_set_direction, gpio_set_level, gptimer_alarm_config_t, gptimer_alarm_event_data_t,
+    gptimer_config_t, gptimer_count_direction_t_GPTIMER_COUNT_UP, gptimer_del_timer,
+    gptimer_disable, gptimer_enable, gptimer_event_callbacks_t, gptimer_get_raw_count,
+    gptimer_handle_t, gptimer_new_timer, gptimer_register_event_callbacks,
+    gptimer_set_alarm_action, gptimer_start, gptimer_stop,
+    soc_periph_gptimer_clk_src_t_GPTIMER_CLK_SRC_DEFAULT, ulTaskGenericNotifyTake,
+    xTaskGetCurrentTaskHandle,
+};
+
+use crate::{
+    BeatScheduler, LinkError, TransportState,
+    time::{Duration, Instant},
+};
+
+/// When a [`PulseOutput`] emits pulses.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum PulseGate {
+    /// Emit pulses continuously, regardless of the transport state.
+    Always,
+    /// Emit pulses only while the transport state is
+    /// [`Play`](TransportState::Play), starting and stopping at the
+    /// [transport state time](crate::SessionState::transport_state_time).
+    WhilePlaying,
+}
+
+/// The pulse grid, in timer counts (microseconds since the timer started).
+#[derive(Clone, Copy)]
+struct PulseParams {
+    anchor_index: i64,
+    anchor_count: i64,
+    micros_per_beat: i64,
+    // Pulses are emitted at counts in [start_count, stop_count).
+    start_count: i64,
+    stop_count: i64,
+}
+
+const EMPTY: u8 = 0;
+const WRITING: u8 = 1;
+const FULL: u8 = 2;
+const READING: u8 = 3;
+
+/// Single-slot mailbox that passes new pulse parameters to the timer ISR.
+///
+/// The ISR never waits: if the task is writing, it keeps the parameters it
+/// has and picks up the new ones on its next alarm. The task only waits for
+/// the ISR to finish copying.
+struct Mailbox {
+    state: AtomicU8,
+    params: UnsafeCell<PulseParams>,
+}
+
+impl Mailbox {
+    fn post(&self, params: PulseParams) {
+        // Take the slot if it is empty, or replace parameters the ISR hasn't
+        // picked up yet.
+        while self
+            .state
+            .compare_exchange_weak(EMPTY, WRITING, Ordering::Acquire, Ordering::Relaxed)
+            .or_else(|_| {
+                self.state.compare_exchange_weak(
+                    FULL,
+                    WRITING,
+                    Ordering::Acquire,
+                    Ordering::Relaxed,
+                )
+            })
+            .is_err()
+        {
+            std::hint::spin_loop();
+        }
+        // Safety: the WRITING state excludes the ISR.
+        unsafe { *self.params.get() = params };
+        self.state.store(FULL, Ordering::Release);
+    }
+
+    fn take(&self) -> Option<PulseParams> {
+        self.state
+            .compare_exchange(FULL, READING, Ordering::Acquire, Ordering::Relaxed)
+            .ok()?;
+        // Safety: the READING state excludes the task.
+        let params = unsafe { *self.params.get() };
+        self.state.store(EMPTY, Ordering::Release);
+        Some(params)
+    }
+}
+
+/// State owned by the timer ISR.
+struct IsrState {
+    params: Option<PulseParams>,
+    next_index: i64,
+    last_pulse: i64,
+    fall_count: i64,
+    high: bool,
+}
+
+/// State shared between a [`PulseOutput`] and its timer ISR.
+struct PulseShared {
+    mailbox: Mailbox,
+    isr: UnsafeCell<IsrState>,
+    gpio: gpio_num_t,
+    ticks_per_beat: i64,
+    width: i64,
+}
+
+impl PulseShared {
+    /// The timer count of pulse `index`, using integer math only, since the
+    /// FPU is not available in interrupt handlers.
+    fn pulse_count(&self, params: &PulseParams, index: i64) -> i64 {
+        let offset = (index - params.anchor_index) * params.micros_per_beat;
+        params.anchor_count + (2 * offset + self.ticks_per_beat).div_euclid(2 * self.ticks_per_beat)
+    }
+
+    /// The first pulse with a count greater than `count`.
+    fn first_pulse_after(&self, params: &PulseParams, count: i64) -> i64 {
+        let elapsed = count - params.anchor_count;
+        // Start early to absorb rounding, and step forward.
+        let mut index = params.anchor_index
+            + (elapsed * self.ticks_per_beat).div_euclid(params.micros_per_beat)
+            - 1;
+        while self.pulse_count(params, index) <= count {
+            index += 1;
+        }
+        index
+    }
+
+    /// Handle a timer alarm at `now`, and return the count of the next alarm.
+    fn on_alarm(&self, state: &mut IsrState, now: i64) -> Option<i64> {
+        if let Some(params) = self.mailbox.take() {
+            // Continue after the last pulse and skip pulses that are
+            // already late, so a new timeline never repeats a pulse.
+            let after = state
+                .last_pulse
+                .max(now - 1)
+                .max(params.start_count.saturating_sub(1));
+            state.next_index = self.first_pulse_after(&params, after);
+            state.params = Some(params);
+        }
+
+        if state.high && now >= state.fall_count {
+            // Safety: gpio was configured as an output in PulseOutput::new.
+            unsafe { gpio_set_level(self.gpio, 0) };
+            state.high = false;
+        }
+
+        let mut next_pulse = None;
+        if let Some(params) = &state.params {
+            let count = self.pulse_count(params, state.next_index);
+            if count < params.stop_count {
+                if count <= now {
+                    // Safety: as above.
+                    unsafe { gpio_set_level(self.gpio, 1) };
+                    state.high = true;
+                    state.last_pulse = count;
+                    state.fall_count = count + self.width;
+                    state.next_index += 1;
+                    let next = self.pulse_count(params, state.next_index);
+                    next_pulse = (next < params.stop_count).then_some(next);
+                } else {
+                    next_pulse = Some(count);
+                }
+            }
+        }
+
+        let fall = state.high.then_some(state.fall_count);
+        match (fall, next_pulse) {
+            (Some(fall), Some(pulse)) => Some(fall.min(pulse)),
+            (fall, pulse) => fall.or(pulse),
+        }
+    }
+}
+
+/// Program the next alarm of `timer`. An alarm in the past fires immediately.
+fn set_alarm(timer: gptimer_handle_t, count: i64) -> esp_err_t {
+    let config = gptimer_alarm_config_t {
+        alarm_count: count.max(0).cast_unsigned(),
+        ..Default::default()
+    };
+    // Safety: timer is valid, and config is valid for the duration of the
+    // call. Setting the alarm is allowed from the ISR.
+    unsafe { gptimer_set_alarm_action(timer, &raw const config) }
+}
+
+unsafe extern "C" fn on_alarm(
+    timer: gptimer_handle_t,
+    event: *const gptimer_alarm_event_data_t,
+    context: *mut c_void,
+) -> bool {
+    // Safety: context points to the PulseShared owned by the PulseOutput,
+    // which deletes the timer before freeing it. The ISR is the only user of
+    // the ISR state, and is never re-entered for the same timer.
+    let shared = unsafe { &*context.cast::<PulseShared>() };
+    let state = unsafe { &mut *shared.isr.get() };
+    let now = unsafe { (*event).count_value }.cast_signed();
+
+    if let Some(next) = shared.on_alarm(state, now) {
+        set_alarm(timer, next);
+    }
+
+    // No task was woken.
+    false
+}
+
+fn check(err: esp_err_t) -> Result<(), LinkError> {
+    EspError::convert(err).map_err(LinkError::Driver)
+}
+
+/// An owned `GPTimer`, torn down on drop.
+struct GpTimer(gptimer_handle_t);
+
+impl Drop for GpTimer {
+    fn drop(&mut self) {
+        // Safety: handle is valid. Stopping or disabling a timer that isn't
+        // started or enabled only returns an error, which is irrelevant here.
+        // After deletion the ISR no longer runs.
+        unsafe {
+            gptimer_stop(self.0);
+            gptimer_disable(self.0);
+            gptimer_del_timer(self.0);
+        }
+    }
+}
+
+/// Emits the ticks of a [`BeatScheduler`] as pulses on a GPIO, timed by a
+/// `GPTimer` interrupt.
+///
+/// This is meant for analog clock and sync outputs (such as 24 or 4 pulses
+/// per quarter note), where polling [`Link::clock_now`](crate::Link::clock_now)
+/// from a task gives about a millisecond of jitter. The timer interrupt sets
+/// the GPIO at the exact microsecond of each tick, so the output jitter is
+/// only the interrupt latency, and the CPU is only busy for two short
+/// interrupts per pulse (the rising and falling edge).
+///
+/// The pulse grid (the time of one tick and the tempo) is computed from the
+/// scheduler's [`Timeline`](crate::Timeline) with Link's own math, and handed
+/// to the interrupt, which steps through it with integer arithmetic. The grid
+/// only has to be reprogrammed when the session timeline changes: the tempo,
+/// the transport state, or the phase, which moves when joining a session
+/// even at the same tempo. Call [`update`](Self::update) regularly, or
+/// dedicate a task to [`run`](Self::run), which sleeps until Link reports a
+/// change. For changes Link doesn't report, see
+/// [`invalidate`](Self::invalidate).
+///
+/// The `GPTimer` counts microseconds, like the Link clock. Both run off the
+/// same crystal, and the offset between them is measured again on every
+/// update.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Duration, Link, PulseGate, PulseOutput};
+///
+/// let link = Link::new(120.0).unwrap();
+/// link.enable_transport_sync();
+/// link.enable();
+///
+/// // 24 PPQN clock on GPIO 4, with 1ms pulses, while the transport plays
+/// let scheduler = link.beat_scheduler(24, 4.0).unwrap();
+/// let mut output =
+///     PulseOutput::new(scheduler, 4, Duration::from_millis(1), PulseGate::WhilePlaying)
+///         .unwrap();
+/// output.run();
+/// ```
+pub struct PulseOutput<'a> {
+    scheduler: BeatScheduler<'a>,
+    gate: PulseGate,
+    // Declared before `shared` so that the timer, and with it the ISR, is
+    // gone before the shared state is freed.
+    timer: GpTimer,
+    shared: Box<PulseShared>,
+}
+
+// Safety: the timer handle is only used through the thread-safe GPTimer API,
+// and the shared state is synchronized through the mailbox.
+unsafe impl Send for PulseOutput<'_> {}
+
+impl<'a> PulseOutput<'a> {
+    /// Start emitting the ticks of `scheduler` as pulses of `width` on GPIO
+    /// number `gpio`.
+    ///
+    /// `width` must be shorter than the interval between ticks at the fastest
+    /// tempo you expect; otherwise consecutive pulses merge.
+    ///
+    /// This allocates a `GPTimer` and configures `gpio` as an output. Pulses
+    /// start after the first [`update`](Self::update).
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::Driver`] if the GPIO can't be configured or no
+    /// `GPTimer` is available.
+    pub fn new(
+        scheduler: BeatScheduler<'a>,
+        gpio: i32,
+        width: Duration,
+        gate: PulseGate,
+    ) -> Result<Self, LinkError> {
+        // Safety: these only configure the given pin.
+        unsafe {
+            check(gpio_reset_pin(gpio))?;
+            check(gpio_set_direction(gpio, gpio_mode_t_GPIO_MODE_OUTPUT))?;
+            check(gpio_set_level(gpio, 0))?;
+        }
+
+        let shared = Box::new(PulseShared {
+            mailbox: Mailbox {
+                state: AtomicU8::new(EMPTY),
+                params: UnsafeCell::new(PulseParams {
+                    anchor_index: 0,
+                    anchor_count: 0,
+                    micros_per_beat: 1,
+                    start_count: 0,
+                    stop_count: 0,
+                }),
+            },
+            isr: UnsafeCell::new(IsrState {
+                params: None,
+                next_index: 0,
+                last_pulse: i64::MIN,
+                fall_count: 0,
+                high: false,
+            }),
+            gpio,
+            ticks_per_beat: i64::from(scheduler.ticks_per_beat()),
+            width: width.as_micros().max(1),
+        });
+
+        let config = gptimer_config_t {
+            clk_src: soc_periph_gptimer_clk_src_t_GPTIMER_CLK_SRC_DEFAULT,
+            direction: gptimer_count_direction_t_GPTIMER_COUNT_UP,
+            resolution_hz: 1_000_000,
+            ..Default::default()
+        };
+        let mut handle = ptr::null_mut();
+        // Safety: config is valid for the duration of the call.
+        check(unsafe { gptimer_new_timer(&raw const config, &raw mut handle) })?;
+        let timer = GpTimer(handle);
+
+        let callbacks = gptimer_event_callbacks_t {
+            on_alarm: Some(on_alarm),
+        };
+        // Safety: the shared state is boxed, so its address is stable, and it
+        // outlives the timer (see the field order of PulseOutput).
+        unsafe {
+            check(gptimer_register_event_callbacks(
+                timer.0,
+                &raw const callbacks,
+                ptr::from_ref::<PulseShared>(&shared).cast_mut().cast(),
+            ))?;
+            check(gptimer_enable(timer.0))?;
+            check(gptimer_start(timer.0))?;
+        }
+
+        Ok(Self {
+            scheduler,
+            gate,
+            timer,
+            shared,
+        })
+    }
+
+    /// Reprogram the pulse grid if the tempo, transport state or phase
+    /// changed.
+    ///
+    /// This is cheap when nothing changed (one atomic operation), so it can
+    /// be called from any periodic task.
+    pub fn update(&mut self) {
+        if !self.scheduler.refresh() {
+            return;
+        }
+
+        // Measure the offset between the Link clock and the timer count.
+        let mut count = 0;
+        // Safety: the timer is valid. Reading the count can't fail for a
+        // valid timer.
+        unsafe { gptimer_get_raw_count(self.timer.0, &raw mut count) };
+        let offset = self.scheduler.link().clock_now().as_micros() - count.cast_signed();
+        let to_count = |time: Instant| time.as_micros() - offset;
+
+        let tick = self.scheduler.peek();
+        let timeline = self.scheduler.timeline();
+        let (start_count, stop_count) = match self.gate {
+            PulseGate::Always => (i64::MIN, i64::MAX),
+            PulseGate::WhilePlaying => match timeline.transport_state() {
+                TransportState::Play => (to_count(timeline.transport_state_time()), i64::MAX),
+                TransportState::Stop => (i64::MIN, to_count(timeline.transport_state_time())),
+            },
+        };
+        self.shared.mailbox.post(PulseParams {
+            anchor_index: tick.index,
+            anchor_count: to_count(tick.time),
+            micros_per_beat: timeline.micros_per_beat(),
+            start_count,
+            stop_count,
+        });
+
+        // Fire the ISR right away, so it picks up the new grid.
+        set_alarm(self.timer.0, 0);
+    }
+
+    /// Keep the pulse grid up to date forever, sleeping the current task
+    /// until Link reports a tempo, transport state or peer count change.
+    ///
+    /// The task sleeps on its `FreeRTOS` task notification (index 0). Don't
+    /// use that notification index for anything else in this task.
+    pub fn run(&mut self) -> ! {
+        // Safety: xTaskGetCurrentTaskHandle is always safe to call from a task.
+        let task = unsafe { xTaskGetCurrentTaskHandle() };
+        self.scheduler.set_waiting_task(task.cast());
+        loop {
+            self.update();
+            // Safety: waits on the current task's own notification value.
+            unsafe { ulTaskGenericNotifyTake(0, 1, TickType_t::MAX) };
+        }
+    }
+
+    /// Invalidate the pulse grid, so the next [`update`](Self::update)
+    /// recomputes it.
+    ///
+    /// See [`BeatScheduler::invalidate`].
+    pub fn invalidate(&self) {
+        self.scheduler.invalidate();
+    }
+}
+
+impl Drop for PulseOutput<'_> {
+    fn drop(&mut self) {
+        // Silence the ISR before leaving the output low. The timer is deleted
+        // right after this.
+        // Safety: the timer is valid, and the pin was configured as an output
+        // in new().
+        unsafe {
+            gptimer_stop(self.timer.0);
+            gptimer_disable(self.timer.0);
+            gpio_set_level(self.shared.gpio, 0);
+        }
+    }
+}
@@ -0,0 +1,266 @@
+//! Timeline math with the quantum and the ticks per beat fixed at compile
+//! time.
+
+use crate::{
+    SessionState, Tick,
+    time::{Beats, Instant},
+    timeline::Timeline,
+};
+
+/// A [`Timeline`] evaluated with a quantum of `BEATS_PER_BAR` beats and
+/// `PPQN` ticks per beat, both known at compile time.
+///
+/// Passing the quantum at runtime means every conversion divides by a value
+/// the compiler can't see. With the quantum and tick rate as constants, and
+/// the conversions done in fixed point (see
+/// [`Timeline::beat_at_time_fixed`]), every division and remainder is by a
+/// constant, which compiles to multiplications and shifts, and no
+/// floating-point math is left. Beats are [`Beats`], times [`Instant`]s,
+/// and ticks are counted from beat 0: tick `n` is at beat `n / PPQN`.
+///
+/// A `Quantized` is a copy of a timeline, so it is as current as the
+/// session state it was taken from. Take a new one after capturing again,
+/// or read it from a [`SharedTimeline`](crate::SharedTimeline) on the audio
+/// thread.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Link, Quantized};
+///
+/// // 4/4, with MIDI clock's 24 ticks per beat
+/// type Clock = Quantized<4, 24>;
+///
+/// let link = Link::new(120.0).unwrap();
+/// let state = link.capture_app_session_state().unwrap();
+/// let clock = Clock::from_session_state(&state);
+///
+/// let now = link.clock_now();
+/// let next = clock.next_tick(now);
+/// log::info!(
+///     "Tick {} of the bar at {:?}, bar {}",
+///     clock.tick_in_bar(next.time),
+///     next.time,
+///     clock.bar_at_time(next.time),
+/// );
+/// ```
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Quantized<const BEATS_PER_BAR: u32, const PPQN: u32> {
+    timeline: Timeline,
+}
+
+impl<const BEATS_PER_BAR: u32, const PPQN: u32> Quantized<BEATS_PER_BAR, PPQN> {
+    /// The quantum, for the [`SessionState`] methods that take one.
+    #[allow(clippy::cast_precision_loss)]
+    pub const QUANTUM: f64 = BEATS_PER_BAR as f64;
+
+    /// The quantum, in fixed point.
+    pub const QUANTUM_BEATS: Beats = Beats::from_beats(BEATS_PER_BAR as i64);
+
+    /// The number of ticks per bar.
+    pub const TICKS_PER_BAR: u32 = BEATS_PER_BAR * PPQN;
+
+    const TICKS_PER_BEAT: i64 = PPQN as i64;
+
+    /// Evaluate a timeline with this quantum and tick rate.
+    #[must_use]
+    pub const fn new(timeline: Timeline) -> Self {
+        const {
+            assert!(BEATS_PER_BAR > 0, "BEATS_PER_BAR must be non-zero");
+            assert!(PPQN > 0, "PPQN must be non-zero");
+        };
+        Self { timeline }
+    }
+
+    /// Evaluate the timeline of a session state.
+    #[must_use]
+    pub fn from_session_state(state: &SessionState) -> Self {
+        Self::new(state.timeline())
+    }
+
+    /// Get the timeline being evaluated.
+    #[must_use]
+    pub const fn timeline(&self) -> &Timeline {
+        &self.timeline
+    }
+
+    /// Get the beat at a time.
+    #[inline]
+    #[must_use]
+    pub const fn beat_at_time(&self, time: Instant) -> Beats {
+        self.timeline.beat_at_time_fixed(time, Self::QUANTUM_BEATS)
+    }
+
+    /// Get the phase at a time: the position within the bar, in
+    /// `[0, BEATS_PER_BAR)` beats.
+    #[inline]
+    #[must_use]
+    pub const fn phase_at_time(&self, time: Instant) -> Beats {
+        self.timeline.phase_at_time_fixed(time, Self::QUANTUM_BEATS)
+    }
+
+    /// Get the time at which a beat occurs.
+    #[inline]
+    #[must_use]
+    pub const fn time_at_beat(&self, beat: Beats) -> Instant {
+        self.timeline.time_at_beat_fixed(beat, Self::QUANTUM_BEATS)
+    }
+
+    /// Get the index of the bar at a time, counted from beat 0. Bars start
+    /// at phase zero.
+    #[inline]
+    #[must_use]
+    pub const fn bar_at_time(&self, time: Instant) -> i64 {
+        self.beat_at_time(time)
+            .as_micro_beats()
+            .div_euclid(Self::QUANTUM_BEATS.as_micro_beats())
+    }
+
+    /// Get the index of the latest tick at or before a time.
+    #[inline]
+    #[must_use]
+    pub const fn tick_at_time(&self, time: Instant) -> i64 {
+        ticks(self.beat_at_time(time), Self::TICKS_PER_BEAT)
+    }
+
+    /// Get the index of the latest tick at or before a time, within the
+    /// bar: in `[0, TICKS_PER_BAR)`.
+    #[inline]
+    #[must_use]
+    #[allow(clippy::cast_possible_truncation, clippy::cast_sign_loss)]
+    pub const fn tick_in_bar(&self, time: Instant) -> u32 {
+        // The phase is in [0, BEATS_PER_BAR), so this is in range.
+        ticks(self.phase_at_time(time), Self::TICKS_PER_BEAT) as u32
+    }
+
+    /// Get the beat at which a tick occurs: the first micro-beat at or
+    /// after `tick / PPQN`, so that [`tick_at_time`](Self::tick_at_time)
+    /// gives `tick` back.
+    #[inline]
+    #[must_use]
+    pub const fn beat_at_tick(&self, tick: i64) -> Beats {
+        let micro_beats = tick * Beats::MICRO_BEATS_PER_BEAT;
+        Beats::from_micro_beats(
+            micro_beats.div_euclid(Self::TICKS_PER_BEAT)
+                + (micro_beats.rem_euclid(Self::TICKS_PER_BEAT) != 0) as i64,
+        )
+    }
+
+    /// Get the time at which a tick occurs, rounded so that
+    /// [`tick_at_time`](Self::tick_at_time) gives `tick` back.
+    #[inline]
+    #[must_use]
+    pub const fn time_at_tick(&self, tick: i64) -> Instant {
+        let beat = self.beat_at_tick(tick);
+        let time = self.time_at_beat(beat);
+        // A microsecond spans several micro-beats at most tempos, so the
+        // nearest microsecond can fall just before the tick.
+        if self.beat_at_time(time).as_micro_beats() < beat.as_micro_beats() {
+            time.add_micros(1)
+        } else {
+            time
+        }
+    }
+
+    /// Get the first tick at or after a time, for example to schedule the
+    /// next clock pulse.
+    #[must_use]
+    pub fn next_tick(&self, time: Instant) -> Tick {
+        let mut index = self.tick_at_time(time);
+        let mut tick_time = self.time_at_tick(index);
+        if tick_time < time {
+            index += 1;
+            tick_time = self.time_at_tick(index);
+        }
+        Tick {
+            index,
+            beat: self.beat_at_tick(index).as_f64(),
+            time: tick_time,
+        }
+    }
+}
+
+/// The number of whole ticks in a beat value, rounded down. This overflows
+/// past `i64::MAX / ppqn` micro-beats: with up to 960 ticks per beat, after
+/// years of playback at any tempo Link allows.
+#[inline]
+const fn ticks(beats: Beats, ppqn: i64) -> i64 {
+    (beats.as_micro_beats() * ppqn).div_euclid(Beats::MICRO_BEATS_PER_BEAT)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{Quantized, ticks};
+    use crate::{
+        time::{Beats, Instant},
+        timeline::{Timeline, tests::Values},
+    };
+
+    // About 12 days of Link time and a million beats either way.
+    const TIME_SPAN: i64 = 1 << 40;
+    const BEAT_SPAN: i64 = 1_000_000 * Beats::MICRO_BEATS_PER_BEAT;
+
+    fn check<const BEATS_PER_BAR: u32, const PPQN: u32>(values: &mut Values) {
+        let ticks_per_bar = i64::from(Quantized::<BEATS_PER_BAR, PPQN>::TICKS_PER_BAR);
+        let tempos = (20..=999).step_by(7).map(f64::from).chain([133.33, 999.0]);
+        for tempo in tempos {
+            let timeline =
+                Timeline::from_parts(tempo, values.next_in(BEAT_SPAN), values.next_in(TIME_SPAN));
+            let clock = Quantized::<BEATS_PER_BAR, PPQN>::new(timeline);
+            // Microseconds per micro-beat, rounded up, plus the rounding to
+            // the nearest microsecond.
+            #[allow(clippy::cast_possible_truncation)]
+            let slack = (60.0 / tempo).ceil() as i64 + 1;
+            for _ in 0..64 {
+                let time = Instant::from_micros(values.next_in(TIME_SPAN));
+                let context = || format!("{time:?} at {tempo} BPM, {PPQN} PPQN");
+
+                // The tick's beat is the first micro-beat of the tick.
+                let tick = clock.tick_at_time(time);
+                let beat = clock.beat_at_tick(tick).as_micro_beats();
+                assert_eq!(ticks(Beats::from_micro_beats(beat), i64::from(PPQN)), tick);
+                assert_eq!(
+                    ticks(Beats::from_micro_beats(beat - 1), i64::from(PPQN)),
+                    tick - 1,
+                    "{}",
+                    context()
+                );
+
+                // The tick's time is in the tick, and no later than the
+                // microsecond nearest to its first micro-beat.
+                let tick_time = clock.time_at_tick(tick);
+                assert_eq!(clock.tick_at_time(tick_time), tick, "{}", context());
+                assert!(
+                    clock.tick_at_time(tick_time.sub_micros(slack)) < tick,
+                    "{}",
+                    context()
+                );
+
+                let in_bar = clock.tick_in_bar(time);
+                assert!(i64::from(in_bar) < ticks_per_bar, "{}", context());
+                assert_eq!(
+                    i64::from(in_bar),
+                    tick.rem_euclid(ticks_per_bar),
+                    "{}",
+                    context()
+                );
+
+                // The next tick is the first one at or after the time.
+                let next = clock.next_tick(time);
+                assert!(next.time >= time, "{}", context());
+                assert_eq!(next.time, clock.time_at_tick(next.index));
+                assert!(clock.time_at_tick(next.index - 1) < time, "{}", context());
+            }
+        }
+    }
+
+    #[test]
+    fn ticks_round_trip_through_times() {
+        let mut values = Values(0x2545_f491_4f6c_dd1d);
+        check::<4, 24>(&mut values);
+        check::<4, 96>(&mut values);
+        check::<4, 960>(&mut values);
+        check::<3, 96>(&mut values);
+        check::<7, 960>(&mut values);
+    }
+}
@@ -0,0 +1,267 @@
+//! Rate-limited tempo changes.
+
+use crate::{
+    Link, LinkError, SessionState,
+    time::{Duration, Instant},
+};
+
+/// A linear tempo change in progress.
+#[derive(Debug, Clone, Copy, PartialEq)]
+struct Ramp {
+    from: f64,
+    to: f64,
+    start: Instant,
+    end: Instant,
+}
+
+impl Ramp {
+    #[allow(clippy::cast_precision_loss)]
+    fn tempo_at(&self, time: Instant) -> f64 {
+        if time >= self.end {
+            return self.to;
+        }
+        let elapsed = (time - self.start).as_micros().max(0) as f64;
+        let length = (self.end - self.start).as_micros() as f64;
+        self.from + (self.to - self.from) * (elapsed / length)
+    }
+}
+
+/// Ramps the session tempo towards a target, committing at a limited rate.
+///
+/// Setting the tempo from a knob or a MIDI controller can produce dozens of
+/// tempo changes per second, and committing each one floods the session
+/// with timeline updates. A `TempoRamp` decouples the two: input goes
+/// to [`set_target`](Self::set_target) as often as it arrives, and
+/// [`update`](Self::update), called from the control loop, commits the
+/// ramp's current tempo at most once per `min_interval`. A new target
+/// replaces the ramp in progress, starting from wherever the ramp is at that
+/// moment, so commit traffic stays bounded however fast the input changes.
+///
+/// Tempo changes from other peers during a ramp are overridden by the ramp;
+/// they are picked up again once it ends.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Duration, Link, TempoRamp};
+///
+/// let mut link = Link::new(120.0).unwrap();
+/// let mut ramp = TempoRamp::new(Duration::from_millis(50)).unwrap();
+///
+/// # let read_tempo_knob = || None;
+/// loop {
+///     if let Some(bpm) = read_tempo_knob() {
+///         // Glide to the new tempo over half a second
+///         ramp.set_target(&link, bpm, Duration::from_millis(500));
+///     }
+///     ramp.update(&mut link);
+///     std::thread::sleep(std::time::Duration::from_millis(10));
+/// }
+/// ```
+pub struct TempoRamp {
+    state: SessionState,
+    min_interval: Duration,
+    ramp: Option<Ramp>,
+    last_commit: Option<Instant>,
+}
+
+impl TempoRamp {
+    /// Create a tempo ramp that commits at most once per `min_interval`.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state used for
+    /// committing could not be allocated.
+    pub fn new(min_interval: Duration) -> Result<Self, LinkError> {
+        Ok(Self {
+            state: SessionState::new()?,
+            min_interval,
+            ramp: None,
+            last_commit: None,
+        })
+    }
+
+    /// Ramp to `bpm` over `duration`, starting now.
+    ///
+    /// If a ramp is in progress, the new one starts from its current tempo.
+    /// Otherwise it starts from the session tempo. A zero `duration` jumps
+    /// to `bpm` with the next [`update`](Self::update).
+    ///
+    /// This doesn't commit anything, so it can be called as often as the
+    /// input changes.
+    pub fn set_target(&mut self, link: &Link, bpm: f64, duration: Duration) {
+        let now = link.clock_now();
+        let from = if let Some(ramp) = self.ramp {
+            ramp.tempo_at(now)
+        } else {
+            link.capture_app_session_state_into(&mut self.state);
+            self.state.tempo()
+        };
+        self.ramp = Some(Ramp {
+            from,
+            to: bpm,
+            start: now,
+            end: now + duration,
+        });
+    }
+
+    /// Commit the ramp's current tempo, unless the last commit was less than
+    /// `min_interval` ago.
+    ///
+    /// Call this regularly, at least as often as `min_interval`. The final
+    /// tempo of a ramp is always committed, at most `min_interval` after the
+    /// previous commit.
+    ///
+    /// Returns whether a tempo was committed.
+    pub fn update(&mut self, link: &mut Link) -> bool {
+        let Some(ramp) = self.ramp else {
+            return false;
+        };
+        let now = link.clock_now();
+        if self
+            .last_commit
+            .is_some_and(|last| now - last < self.min_interval)
+        {
+            return false;
+        }
+
+        let bpm = ramp.tempo_at(now);
+        if now >= ramp.end {
+            self.ramp = None;
+        }
+        link.capture_app_session_state_into(&mut self.state);
+        if self.state.tempo().to_bits() == bpm.to_bits() {
+            return false;
+        }
+        self.state.set_tempo(bpm, now);
+        link.commit_app_session_state(&self.state);
+        self.last_commit = Some(now);
+        true
+    }
+
+    /// Stop the ramp in progress, leaving the session at the tempo last
+    /// committed.
+    pub const fn cancel(&mut self) {
+        self.ramp = None;
+    }
+
+    /// Check whether a ramp is in progress, or its final tempo is still to
+    /// be committed.
+    #[must_use]
+    pub const fn is_ramping(&self) -> bool {
+        self.ramp.is_some()
+    }
+
+    /// Get the tempo the ramp in progress ends at, if any.
+    #[must_use]
+    pub fn target(&self) -> Option<f64> {
+        self.ramp.map(|ramp| ramp.to)
+    }
+
+    /// Get the minimum time between two commits.
+    #[must_use]
+    pub const fn min_interval(&self) -> Duration {
+        self.min_interval
+    }
+}
+
+#[cfg(test)]
+// The tempos compared are exact in binary floating point.
+#[allow(clippy::float_cmp)]
+mod tests {
+    use super::{Ramp, TempoRamp};
+    use crate::{
+        Link,
+        time::{Duration, Instant},
+    };
+
+    #[test]
+    fn ramps_linearly() {
+        let ramp = Ramp {
+            from: 100.0,
+            to: 140.0,
+            start: Instant::from_micros(1_000),
+            end: Instant::from_micros(5_000),
+        };
+        assert_eq!(ramp.tempo_at(Instant::from_micros(0)), 100.0);
+        assert_eq!(ramp.tempo_at(Instant::from_micros(1_000)), 100.0);
+        assert_eq!(ramp.tempo_at(Instant::from_micros(2_000)), 110.0);
+        assert_eq!(ramp.tempo_at(Instant::from_micros(3_000)), 120.0);
+        assert_eq!(ramp.tempo_at(Instant::from_micros(5_000)), 140.0);
+        assert_eq!(ramp.tempo_at(Instant::from_micros(9_000)), 140.0);
+    }
+
+    #[test]
+    fn jumps_to_the_target() {
+        let mut link = Link::new(120.0).unwrap();
+        let mut ramp = TempoRamp::new(Duration::from_millis(50)).unwrap();
+        assert!(!ramp.update(&mut link));
+
+        ramp.set_target(&link, 140.0, Duration::from_micros(0));
+        assert_eq!(ramp.target(), Some(140.0));
+        assert!(ramp.update(&mut link));
+        assert!(!ramp.is_ramping());
+        assert_eq!(link.capture_app_session_state().unwrap().tempo(), 140.0);
+    }
+
+    #[test]
+    fn limits_the_commit_rate() {
+        let mut link = Link::new(120.0).unwrap();
+        let mut ramp = TempoRamp::new(Duration::from_secs(3600)).unwrap();
+        ramp.set_target(&link, 100.0, Duration::from_micros(0));
+        assert!(ramp.update(&mut link));
+        ramp.set_target(&link, 180.0, Duration::from_micros(0));
+        assert!(!ramp.update(&mut link));
+        assert!(ramp.is_ramping());
+        ramp.cancel();
+        assert!(!ramp.is_ramping());
+        assert_eq!(link.capture_app_session_state().unwrap().tempo(), 100.0);
+    }
+
+    #[test]
+    fn retargets_from_where_the_ramp_is() {
+        let mut link = Link::new(120.0).unwrap();
+        let mut ramp = TempoRamp::new(Duration::from_millis(10)).unwrap();
+        ramp.set_target(&link, 180.0, Duration::from_secs(3600));
+
+        // Another tempo committed meanwhile doesn't move the ramp's start.
+        let mut state = link.capture_app_session_state().unwrap();
+        state.set_tempo(60.0, link.clock_now());
+        link.commit_app_session_state(&state);
+
+        ramp.set_target(&link, 90.0, Duration::from_secs(1));
+        let from = ramp.ramp.unwrap().from;
+        assert!((120.0..120.1).contains(&from), "{from}");
+        assert_eq!(ramp.target(), Some(90.0));
+    }
+
+    #[test]
+    fn commits_a_rising_tempo_at_a_limited_rate() {
+        let min_interval = Duration::from_millis(5);
+        let mut link = Link::new(120.0).unwrap();
+        let mut ramp = TempoRamp::new(min_interval).unwrap();
+        ramp.set_target(&link, 140.0, Duration::from_millis(40));
+
+        let mut commits: Vec<(Instant, f64)> = Vec::new();
+        while ramp.is_ramping() {
+            if ramp.update(&mut link) {
+                let tempo = link.capture_app_session_state().unwrap().tempo();
+                commits.push((ramp.last_commit.unwrap(), tempo));
+            }
+            std::thread::sleep(std::time::Duration::from_micros(500));
+        }
+
+        assert!(commits.len() >= 2, "{commits:?}");
+        for pair in commits.windows(2) {
+            let [(earlier, slower), (later, faster)] = pair else {
+                unreachable!()
+            };
+            assert!(*later - *earlier >= min_interval, "{commits:?}");
+            assert!(slower < faster, "{commits:?}");
+        }
+        assert!(commits[0].1 > 120.0);
+        assert_eq!(commits.last().unwrap().1, 140.0);
+        // The ramp has ended, so there is nothing left to commit.
+        assert!(!ramp.update(&mut link));
+    }
+}
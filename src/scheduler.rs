@@ -0,0 +1,540 @@
+//! Scheduling of beat subdivisions on the Link clock.
+
+use std::{
+    ffi::c_void,
+    ptr,
+    sync::{
+        Arc,
+        atomic::{AtomicBool, AtomicPtr, Ordering},
+    },
+};
+
+use crate::{
+    Link, LinkError, SessionState,
+    callback::Subscription,
+    idf::{
+        ESP_OK, TaskHandle_t, TickType_t, configTICK_RATE_HZ, eNotifyAction_eIncrement,
+        esp_timer_create, esp_timer_create_args_t, esp_timer_delete,
+        esp_timer_dispatch_t_ESP_TIMER_TASK, esp_timer_handle_t, esp_timer_start_once,
+        esp_timer_stop, ulTaskGenericNotifyTake, xTaskGenericNotify, xTaskGetCurrentTaskHandle,
+    },
+    time::Instant,
+    timeline::Timeline,
+};
+
+/// A beat subdivision produced by a [`BeatScheduler`].
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Tick {
+    /// The number of the tick: the tick occurs at beat
+    /// `index / ticks_per_beat`.
+    ///
+    /// Consecutive ticks have consecutive indices, unless the session
+    /// timeline jumped in between.
+    pub index: i64,
+    /// The beat value at which the tick occurs.
+    pub beat: f64,
+    /// The Link clock time at which the tick occurs.
+    pub time: Instant,
+}
+
+/// State shared between a [`BeatScheduler`] and the Link callbacks that
+/// invalidate it.
+pub(crate) struct SchedulerSignal {
+    // Set when the session timeline may have changed.
+    stale: AtomicBool,
+    // FreeRTOS task waiting in BeatScheduler::wait, or null.
+    task: AtomicPtr<c_void>,
+}
+
+impl SchedulerSignal {
+    pub(crate) const fn new() -> Self {
+        Self {
+            stale: AtomicBool::new(true),
+            task: AtomicPtr::new(ptr::null_mut()),
+        }
+    }
+
+    /// Mark the timeline as stale and wake the waiting task, if any.
+    ///
+    /// This never blocks or allocates.
+    pub(crate) fn invalidate(&self) {
+        self.stale.store(true, Ordering::Release);
+        notify(self.task.load(Ordering::Acquire));
+    }
+}
+
+/// Increment the notification value of `task`, unless it is null.
+fn notify(task: *mut c_void) {
+    if !task.is_null() {
+        // Safety: task was registered by the waiting task itself.
+        // Incrementing a notification value is always valid.
+        unsafe {
+            xTaskGenericNotify(task.cast(), 0, 0, eNotifyAction_eIncrement, ptr::null_mut());
+        }
+    }
+}
+
+// esp_timer callback; the argument is the task to wake.
+extern "C" fn wake_task(task: *mut c_void) {
+    notify(task);
+}
+
+/// A one-shot `esp_timer` that wakes one specific task.
+struct WakeTimer {
+    handle: esp_timer_handle_t,
+    task: TaskHandle_t,
+}
+
+// Safety: the esp_timer API is thread-safe, and the task handle is only
+// passed to FreeRTOS, never dereferenced.
+unsafe impl Send for WakeTimer {}
+
+impl WakeTimer {
+    fn new(task: TaskHandle_t) -> Option<Self> {
+        let args = esp_timer_create_args_t {
+            callback: Some(wake_task),
+            // The task handle is passed by value, so the callback never
+            // touches memory owned by the scheduler.
+            arg: task.cast(),
+            dispatch_method: esp_timer_dispatch_t_ESP_TIMER_TASK,
+            name: c"abl_link_sched".as_ptr(),
+            skip_unhandled_events: false,
+        };
+        let mut handle = ptr::null_mut();
+        // Safety: args is valid for the duration of the call, and the name is
+        // a static string.
+        let result = unsafe { esp_timer_create(&raw const args, &raw mut handle) };
+        (result == ESP_OK).then_some(Self { handle, task })
+    }
+
+    /// Fire once after `micros` microseconds, replacing any pending expiry.
+    fn start(&self, micros: u64) {
+        // Safety: handle is valid until drop. Stopping a timer that isn't
+        // running only returns an error, which is irrelevant here.
+        unsafe {
+            esp_timer_stop(self.handle);
+            esp_timer_start_once(self.handle, micros);
+        }
+    }
+}
+
+impl Drop for WakeTimer {
+    fn drop(&mut self) {
+        // Safety: handle is valid, and a timer must be stopped before it can
+        // be deleted.
+        unsafe {
+            esp_timer_stop(self.handle);
+            esp_timer_delete(self.handle);
+        }
+    }
+}
+
+/// Produces the upcoming subdivisions of the beat, such as the 24 pulses per
+/// quarter note of MIDI clock, as [`Tick`]s in [`Instant`] space.
+///
+/// Created by [`Link::beat_scheduler`]. The scheduler keeps a [`Timeline`]
+/// of the session and evaluates it in Rust, so producing a tick costs no FFI
+/// calls. The timeline is only captured again once Link reports a tempo or
+/// transport state change, or peers joining or leaving (joining a session
+/// adopts its timeline, which moves the beats even at the same tempo), so
+/// ticks are never computed from an outdated timeline. After recapturing,
+/// the scheduler continues with the first tick after the last one it
+/// produced, so a tempo change never drops or repeats a tick.
+///
+/// There are two ways to consume ticks:
+///
+/// - As an [`Iterator`], which never ends and doesn't wait: use
+///   [`take`](Iterator::take) to compute the next N ticks, for example to
+///   fill a buffer of timed events.
+/// - With [`wait`](Self::wait), which sleeps the current task until the next
+///   tick is due, using a one-shot `esp_timer` to wake it at the exact
+///   microsecond instead of polling.
+///
+/// Link doesn't report timeline changes that don't change the tempo, such as
+/// a committed [`SessionState::request_beat_at_time`]. Call
+/// [`invalidate`](Self::invalidate) after making such changes.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::Link;
+///
+/// let link = Link::new(120.0).unwrap();
+/// link.enable();
+///
+/// // MIDI clock: 24 ticks per beat
+/// let mut scheduler = link.beat_scheduler(24, 4.0).unwrap();
+/// loop {
+///     let tick = scheduler.wait();
+///     // Send a MIDI clock message, and a song position on every bar.
+///     if tick.index % (24 * 4) == 0 {
+///         log::info!("Bar at beat {}", tick.beat);
+///     }
+/// }
+/// ```
+pub struct BeatScheduler<'a> {
+    link: &'a Link,
+    state: SessionState,
+    timeline: Timeline,
+    ticks_per_beat: u32,
+    quantum: f64,
+    // The next tick to produce, and the time of the last one produced.
+    next_index: i64,
+    last_time: Option<Instant>,
+    signal: Arc<SchedulerSignal>,
+    timer: Option<WakeTimer>,
+    // Invalidates the signal on every Link notification.
+    _subscription: Subscription,
+}
+
+impl<'a> BeatScheduler<'a> {
+    pub(crate) fn new(
+        link: &'a Link,
+        ticks_per_beat: u32,
+        quantum: f64,
+    ) -> Result<Self, LinkError> {
+        assert!(ticks_per_beat > 0, "ticks_per_beat must be non-zero");
+        let state = SessionState::new()?;
+        let timeline = state.timeline();
+
+        let signal = Arc::new(SchedulerSignal::new());
+        // Joining a session can move beats without changing the tempo.
+        let num_peers_signal = Arc::clone(&signal);
+        let tempo_signal = Arc::clone(&signal);
+        let transport_signal = Arc::clone(&signal);
+        let subscription = link.callbacks.subscribe(
+            move |_| num_peers_signal.invalidate(),
+            move |_| tempo_signal.invalidate(),
+            move |_| transport_signal.invalidate(),
+        )?;
+        Ok(Self {
+            link,
+            state,
+            timeline,
+            ticks_per_beat,
+            quantum,
+            next_index: 0,
+            last_time: None,
+            signal,
+            timer: None,
+            _subscription: subscription,
+        })
+    }
+
+    /// Get the number of ticks per beat.
+    #[must_use]
+    pub const fn ticks_per_beat(&self) -> u32 {
+        self.ticks_per_beat
+    }
+
+    /// Get the quantum used to compute beat values.
+    #[must_use]
+    pub const fn quantum(&self) -> f64 {
+        self.quantum
+    }
+
+    /// Get the timeline the scheduler currently computes ticks from.
+    ///
+    /// This is the snapshot taken at the last tempo, transport state or peer
+    /// count change, so it also gives the transport state that applies to the
+    /// upcoming ticks.
+    #[must_use]
+    pub const fn timeline(&self) -> &Timeline {
+        &self.timeline
+    }
+
+    /// Make the scheduler capture the session state again before producing
+    /// the next tick.
+    ///
+    /// Tempo, transport state and peer count changes do this automatically.
+    /// Call this after committing other timeline changes. If another task is
+    /// blocked in [`wait`](Self::wait), it recomputes the time of its tick.
+    pub fn invalidate(&self) {
+        self.signal.invalidate();
+    }
+
+    /// Get the next tick without consuming it.
+    ///
+    /// The tick may already be due, or even in the past.
+    pub fn peek(&mut self) -> Tick {
+        self.refresh();
+        self.tick(self.next_index)
+    }
+
+    /// Wait for the next tick, blocking the current task until it is due.
+    ///
+    /// Returns the tick as soon as its time is reached, or immediately if it
+    /// is already in the past. If Link reports a change of the timeline while
+    /// waiting, the scheduler wakes up, recomputes the tick from the new
+    /// timeline and keeps waiting.
+    ///
+    /// The wakeup comes from a one-shot `esp_timer` with microsecond
+    /// resolution, created when the scheduler is first used from a task. If
+    /// the timer can't be created, this falls back to `FreeRTOS` tick
+    /// resolution.
+    ///
+    /// While waiting, the task sleeps on its `FreeRTOS` task notification
+    /// (index 0). Don't use that notification index for anything else in the
+    /// waiting task.
+    pub fn wait(&mut self) -> Tick {
+        // Safety: xTaskGetCurrentTaskHandle is always safe to call from a task.
+        let task = unsafe { xTaskGetCurrentTaskHandle() };
+        if self.timer.as_ref().is_none_or(|timer| timer.task != task) {
+            self.timer = WakeTimer::new(task);
+        }
+
+        // Register before checking the timeline, so that an invalidation
+        // after the check always wakes us.
+        self.set_waiting_task(task.cast());
+        let tick = loop {
+            let tick = self.peek();
+            let remaining = (tick.time - self.link.clock_now())
+                .as_micros()
+                .max(0)
+                .cast_unsigned();
+            if remaining == 0 {
+                break tick;
+            }
+
+            if let Some(timer) = &self.timer {
+                timer.start(remaining);
+            }
+            // Also time out on the FreeRTOS tick just after the deadline, in
+            // case the timer is unavailable.
+            let ticks = remaining.saturating_mul(u64::from(configTICK_RATE_HZ)) / 1_000_000 + 1;
+            // Safety: waits on the current task's own notification value.
+            unsafe {
+                ulTaskGenericNotifyTake(
+                    0,
+                    1,
+                    TickType_t::try_from(ticks).unwrap_or(TickType_t::MAX),
+                );
+            }
+        };
+        self.set_waiting_task(ptr::null_mut());
+
+        self.advance(tick)
+    }
+
+    /// Capture the timeline again if it changed, and find the next tick in it.
+    ///
+    /// Returns whether the timeline was captured again.
+    pub(crate) fn refresh(&mut self) -> bool {
+        if !self.signal.stale.swap(false, Ordering::Acquire) {
+            return false;
+        }
+
+        let previous = self.timeline;
+        self.link.capture_app_session_state_into(&mut self.state);
+        self.timeline = self.state.timeline();
+        let now = self.link.clock_now();
+        self.next_index = match self.last_time {
+            // Continue after the last tick, in the new timeline.
+            Some(last_time) => {
+                let next = self.first_tick_from(last_time, false);
+                // A tempo change pivots on the time it was committed, which
+                // can move the last tick after `last_time` again in the new
+                // timeline. Don't produce it twice, unless the beat jumped
+                // back by a tick or more.
+                let jump = self.timeline.beat_at_time(now, self.quantum)
+                    - previous.beat_at_time(now, self.quantum);
+                if jump * f64::from(self.ticks_per_beat) > -1.0 {
+                    next.max(self.next_index)
+                } else {
+                    next
+                }
+            }
+            None => self.first_tick_from(now, true),
+        };
+        true
+    }
+
+    // Only used by PulseOutput, which the host feature leaves out.
+    #[cfg_attr(feature = "host", allow(dead_code))]
+    pub(crate) const fn link(&self) -> &'a Link {
+        self.link
+    }
+
+    /// Make Link's callbacks wake `task`, or no task if null.
+    pub(crate) fn set_waiting_task(&self, task: *mut c_void) {
+        self.signal.task.store(task, Ordering::Release);
+    }
+
+    /// The first tick at (if `inclusive`) or after `time`.
+    #[allow(clippy::cast_possible_truncation)]
+    fn first_tick_from(&self, time: Instant, inclusive: bool) -> i64 {
+        let beat = self.timeline.beat_at_time(time, self.quantum);
+        // Beat and time conversions round to micro-beats and microseconds,
+        // so start one tick early and step forward.
+        let mut index = (beat * f64::from(self.ticks_per_beat)).floor() as i64 - 1;
+        loop {
+            let tick_time = self.tick(index).time;
+            if tick_time > time || (inclusive && tick_time == time) {
+                return index;
+            }
+            index += 1;
+        }
+    }
+
+    #[allow(clippy::cast_precision_loss)]
+    fn tick(&self, index: i64) -> Tick {
+        let beat = index as f64 / f64::from(self.ticks_per_beat);
+        Tick {
+            index,
+            beat,
+            time: self.timeline.time_at_beat(beat, self.quantum),
+        }
+    }
+
+    fn advance(&mut self, tick: Tick) -> Tick {
+        self.next_index = tick.index + 1;
+        self.last_time = Some(tick.time);
+        tick
+    }
+}
+
+impl Iterator for BeatScheduler<'_> {
+    type Item = Tick;
+
+    /// Get the next tick, without waiting for it to be due.
+    fn next(&mut self) -> Option<Tick> {
+        let tick = self.peek();
+        Some(self.advance(tick))
+    }
+}
+
+impl Drop for BeatScheduler<'_> {
+    fn drop(&mut self) {
+        // Stop notifying a task that may no longer exist.
+        self.set_waiting_task(ptr::null_mut());
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{Link, host::session_test, time::Duration};
+
+    const QUANTUM: f64 = 4.0;
+
+    /// Wait for a condition that a callback on the Link thread makes true.
+    fn eventually(mut done: impl FnMut() -> bool) {
+        let deadline = std::time::Instant::now() + std::time::Duration::from_secs(5);
+        while !done() {
+            assert!(std::time::Instant::now() < deadline, "timed out");
+            std::thread::sleep(std::time::Duration::from_millis(1));
+        }
+    }
+
+    /// Commit a tempo change from another peer of the session.
+    fn set_tempo(peer: &mut Link, bpm: f64) {
+        let mut state = peer.capture_app_session_state().unwrap();
+        state.set_tempo(bpm, peer.clock_now());
+        peer.commit_app_session_state(&state);
+    }
+
+    #[test]
+    fn starts_at_the_first_tick_from_now() {
+        let link = Link::new(120.0).unwrap();
+        let mut scheduler = link.beat_scheduler(24, QUANTUM).unwrap();
+        let before = link.clock_now();
+        let tick = scheduler.peek();
+        let after = link.clock_now();
+        // A tick is 1/48 s at 120 BPM.
+        assert!(tick.time >= before);
+        assert!(tick.time - after <= Duration::from_micros(20_834));
+        assert_eq!(scheduler.next(), Some(tick));
+    }
+
+    #[test]
+    fn never_repeats_a_tick_across_tempo_changes() {
+        let _session = session_test();
+        let link = Link::new(120.0).unwrap();
+        let mut peer = Link::new(120.0).unwrap();
+        link.enable();
+        peer.enable();
+        let mut scheduler = link.beat_scheduler(24, QUANTUM).unwrap();
+        let mut ticks = vec![scheduler.next().unwrap()];
+        for bpm in [240.0, 60.0, 999.0, 20.0, 133.0] {
+            // The change lands while the scheduler is ahead of the clock,
+            // between ticks it has already produced.
+            set_tempo(&mut peer, bpm);
+            eventually(|| {
+                ticks.push(scheduler.next().unwrap());
+                scheduler.timeline().tempo().to_bits() == bpm.to_bits()
+            });
+            ticks.extend(scheduler.by_ref().take(8));
+        }
+        for pair in ticks.windows(2) {
+            assert!(pair[1].index > pair[0].index, "{pair:?}");
+            assert!(pair[1].time > pair[0].time, "{pair:?}");
+        }
+    }
+
+    #[test]
+    fn wakes_at_the_tick() {
+        let link = Link::new(240.0).unwrap();
+        let mut scheduler = link.beat_scheduler(16, QUANTUM).unwrap();
+        let mut last = None;
+        for _ in 0..8 {
+            let tick = scheduler.wait();
+            let now = link.clock_now();
+            assert!(now >= tick.time, "woke {:?} early", tick.time - now);
+            // Generous, for loaded machines.
+            assert!(now - tick.time < Duration::from_millis(10));
+            if let Some(last) = last {
+                assert_eq!(tick.index, last + 1);
+            }
+            last = Some(tick.index);
+        }
+    }
+
+    #[test]
+    fn wait_follows_a_tempo_change() {
+        let _session = session_test();
+        let link = Link::new(20.0).unwrap();
+        let mut peer = Link::new(20.0).unwrap();
+        link.enable();
+        peer.enable();
+        // At 20 BPM, the next beat is up to 3 s away.
+        let mut scheduler = link.beat_scheduler(1, QUANTUM).unwrap();
+        let slow = scheduler.peek();
+        std::thread::scope(|scope| {
+            scope.spawn(|| {
+                std::thread::sleep(std::time::Duration::from_millis(20));
+                set_tempo(&mut peer, 999.0);
+            });
+            let tick = scheduler.wait();
+            let now = link.clock_now();
+            // Woken by the change, and waited for the tick in the new
+            // timeline, not the old one.
+            assert_eq!(scheduler.timeline().tempo().to_bits(), 999.0_f64.to_bits());
+            assert!(now >= tick.time);
+            assert!(tick.time < slow.time || slow.time - now < Duration::from_millis(100));
+            assert!(now - tick.time < Duration::from_millis(10));
+        });
+    }
+
+    #[test]
+    fn follows_the_session_phase_after_joining() {
+        let _session = session_test();
+        let session = Link::new(120.0).unwrap();
+        session.enable();
+        // Same tempo, but a new instance starts at beat 0 when it is
+        // created, so its phase differs from the session's by 60 ms.
+        std::thread::sleep(std::time::Duration::from_millis(60));
+        let joining = Link::new(120.0).unwrap();
+        let mut scheduler = joining.beat_scheduler(4, QUANTUM).unwrap();
+        scheduler.peek();
+        let alone = *scheduler.timeline();
+
+        joining.enable();
+        let timeline = session.capture_app_session_state().unwrap().timeline();
+        eventually(|| {
+            let tick = scheduler.peek();
+            tick.time == timeline.time_at_beat(tick.beat, QUANTUM)
+        });
+        let tick = scheduler.peek();
+        let shift = alone.time_at_beat(tick.beat, QUANTUM) - tick.time;
+        assert!(shift.abs() >= Duration::from_millis(50), "{shift:?}");
+    }
+}
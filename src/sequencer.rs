@@ -0,0 +1,360 @@
+//! Events scheduled at beat positions of the session timeline.
+
+use std::{cmp::Ordering, collections::BinaryHeap};
+
+use crate::{
+    Link, LinkError, SessionState,
+    time::{Duration, Instant},
+    timeline::Timeline,
+};
+
+/// An event of a [`Sequencer`] that is due.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct SequencedEvent<T> {
+    /// The beat the event was scheduled at.
+    pub beat: f64,
+    /// The Link clock time of that beat, according to the timeline when the
+    /// event was taken. This is in the past for events taken late.
+    pub time: Instant,
+    /// The event itself.
+    pub event: T,
+}
+
+/// A pending event, ordered so that the [`BinaryHeap`] (a max-heap) yields
+/// the earliest beat first, and events at the same beat in the order they
+/// were scheduled.
+struct Entry<T> {
+    beat: f64,
+    sequence: u64,
+    event: T,
+}
+
+impl<T> Ord for Entry<T> {
+    fn cmp(&self, other: &Self) -> Ordering {
+        other
+            .beat
+            .total_cmp(&self.beat)
+            .then_with(|| other.sequence.cmp(&self.sequence))
+    }
+}
+
+impl<T> PartialOrd for Entry<T> {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl<T> PartialEq for Entry<T> {
+    fn eq(&self, other: &Self) -> bool {
+        self.cmp(other) == Ordering::Equal
+    }
+}
+
+impl<T> Eq for Entry<T> {}
+
+/// Holds up to `N` events at beat positions, such as "the next bar" or "in
+/// 3.5 beats", and hands them out as their time approaches.
+///
+/// Events are kept by beat, not by time, in a binary heap whose storage is
+/// allocated once, in [`new`](Self::new), so scheduling and taking events
+/// never allocates. A beat is only converted to a time when its event is at
+/// the front of the heap and [`poll`](Self::poll) checks whether it falls
+/// within the lookahead window. A tempo change therefore costs nothing
+/// beyond [`update`](Self::update) capturing the new [`Timeline`]: no
+/// re-sorting, and no conversion of events that are far away.
+///
+/// Beats and times are evaluated on a [`Timeline`] in Rust, with the
+/// quantum given to [`new`](Self::new), so they match
+/// [`SessionState::time_at_beat`]. After committing a
+/// [`request_beat_at_time`](SessionState::request_beat_at_time), or when
+/// Link reports a tempo or transport change, call
+/// [`update`](Self::update) so that events follow the new timeline.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Duration, Link, Sequencer};
+///
+/// let link = Link::new(120.0).unwrap();
+/// link.enable();
+/// let mut sequencer = Sequencer::<&str, 32>::new(4.0).unwrap();
+/// sequencer.update(&link);
+///
+/// sequencer.schedule_next_bar(&link, "cue lights").unwrap();
+/// sequencer.schedule_in(&link, 3.5, "fire relay").unwrap();
+///
+/// loop {
+///     // Tempo or transport changes would call sequencer.update(&link) here
+///     while let Some(due) = sequencer.poll(&link, Duration::from_millis(5)) {
+///         log::info!("{} at {:?}", due.event, due.time);
+///     }
+///     std::thread::sleep(std::time::Duration::from_millis(1));
+/// }
+/// ```
+pub struct Sequencer<T, const N: usize> {
+    state: SessionState,
+    timeline: Timeline,
+    quantum: f64,
+    events: BinaryHeap<Entry<T>>,
+    next_sequence: u64,
+}
+
+impl<T, const N: usize> Sequencer<T, N> {
+    /// Create an empty sequencer that evaluates beats with the given
+    /// `quantum`.
+    ///
+    /// Call [`update`](Self::update) before scheduling or polling, to
+    /// capture the session timeline.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state used for
+    /// capturing could not be allocated.
+    pub fn new(quantum: f64) -> Result<Self, LinkError> {
+        let state = SessionState::new()?;
+        let timeline = state.timeline();
+        Ok(Self {
+            state,
+            timeline,
+            quantum,
+            events: BinaryHeap::with_capacity(N),
+            next_sequence: 0,
+        })
+    }
+
+    /// Capture the session timeline that beats are converted with.
+    ///
+    /// This costs one capture, however many events are pending.
+    pub fn update(&mut self, link: &Link) {
+        link.capture_app_session_state_into(&mut self.state);
+        self.timeline = self.state.timeline();
+    }
+
+    /// Get the timeline captured by the last [`update`](Self::update).
+    #[must_use]
+    pub const fn timeline(&self) -> &Timeline {
+        &self.timeline
+    }
+
+    /// Schedule an event at a beat.
+    ///
+    /// Events at the same beat are handed out in the order they were
+    /// scheduled.
+    ///
+    /// # Errors
+    ///
+    /// Returns the event back if the sequencer already holds `N` events.
+    pub fn schedule(&mut self, beat: f64, event: T) -> Result<(), T> {
+        if self.events.len() == N {
+            return Err(event);
+        }
+        self.events.push(Entry {
+            beat,
+            sequence: self.next_sequence,
+            event,
+        });
+        self.next_sequence += 1;
+        Ok(())
+    }
+
+    /// Schedule an event `beats` beats from now.
+    ///
+    /// # Errors
+    ///
+    /// Returns the event back if the sequencer already holds `N` events.
+    pub fn schedule_in(&mut self, link: &Link, beats: f64, event: T) -> Result<(), T> {
+        let now = self.timeline.beat_at_time(link.clock_now(), self.quantum);
+        self.schedule(now + beats, event)
+    }
+
+    /// Schedule an event at the start of the next bar, that is, the next
+    /// beat at phase zero of the quantum.
+    ///
+    /// # Errors
+    ///
+    /// Returns the event back if the sequencer already holds `N` events.
+    pub fn schedule_next_bar(&mut self, link: &Link, event: T) -> Result<(), T> {
+        let now = link.clock_now();
+        let beat = self.timeline.beat_at_time(now, self.quantum);
+        let phase = self.timeline.phase_at_time(now, self.quantum);
+        self.schedule(beat - phase + self.quantum, event)
+    }
+
+    /// Take the earliest event, if it is due within `lookahead` from now.
+    ///
+    /// Events that are already past are taken as well, with their time in
+    /// the past. Call this in a loop until it returns `None` to take all
+    /// events in the window.
+    pub fn poll(&mut self, link: &Link, lookahead: Duration) -> Option<SequencedEvent<T>> {
+        let time = self.next_time()?;
+        if time > link.clock_now() + lookahead {
+            return None;
+        }
+        self.events.pop().map(|entry| SequencedEvent {
+            beat: entry.beat,
+            time,
+            event: entry.event,
+        })
+    }
+
+    /// Get the time of the earliest event, for example to sleep until then.
+    #[must_use]
+    pub fn next_time(&self) -> Option<Instant> {
+        self.events
+            .peek()
+            .map(|entry| self.timeline.time_at_beat(entry.beat, self.quantum))
+    }
+
+    /// Get the beat of the earliest event.
+    #[must_use]
+    pub fn next_beat(&self) -> Option<f64> {
+        self.events.peek().map(|entry| entry.beat)
+    }
+
+    /// Remove all pending events.
+    pub fn clear(&mut self) {
+        self.events.clear();
+    }
+
+    /// Get the number of pending events.
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.events.len()
+    }
+
+    /// Check whether there are no pending events.
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.events.is_empty()
+    }
+
+    /// Get the maximum number of pending events, `N`.
+    #[must_use]
+    pub const fn capacity(&self) -> usize {
+        N
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::Sequencer;
+    use crate::{Link, time::Duration};
+
+    // Far enough ahead that every scheduled event is due.
+    const EVERYTHING: Duration = Duration::from_secs(3600);
+
+    fn set_tempo(link: &mut Link, bpm: f64) {
+        let mut state = link.capture_app_session_state().unwrap();
+        state.set_tempo(bpm, link.clock_now());
+        link.commit_app_session_state(&state);
+    }
+
+    #[test]
+    fn hands_out_events_by_beat_then_schedule_order() {
+        let link = Link::new(120.0).unwrap();
+        let mut sequencer = Sequencer::<&str, 8>::new(4.0).unwrap();
+        sequencer.update(&link);
+        for (beat, event) in [(2.0, "c"), (1.0, "a"), (3.0, "e"), (1.0, "b"), (2.0, "d")] {
+            sequencer.schedule(beat, event).unwrap();
+        }
+        assert_eq!(sequencer.next_beat(), Some(1.0));
+
+        let mut due = Vec::new();
+        while let Some(event) = sequencer.poll(&link, EVERYTHING) {
+            due.push(event);
+        }
+        let order: Vec<_> = due.iter().map(|due| due.event).collect();
+        assert_eq!(order, ["a", "b", "c", "d", "e"]);
+        assert!(sequencer.is_empty());
+
+        // Half a second per beat at 120 BPM, and none between events at the
+        // same beat.
+        let gaps: Vec<_> = due
+            .windows(2)
+            .map(|pair| (pair[1].time - pair[0].time).as_micros())
+            .collect();
+        assert_eq!(gaps, [0, 500_000, 0, 500_000]);
+    }
+
+    #[test]
+    fn follows_a_tempo_change_after_updating() {
+        let mut link = Link::new(120.0).unwrap();
+        let mut sequencer = Sequencer::<u32, 4>::new(4.0).unwrap();
+        sequencer.update(&link);
+        let now = sequencer.timeline().beat_at_time(link.clock_now(), 4.0);
+        for event in 1..=3 {
+            sequencer
+                .schedule(now.ceil() + f64::from(event), event)
+                .unwrap();
+        }
+        let before = sequencer.next_time().unwrap();
+
+        set_tempo(&mut link, 60.0);
+        // Still the captured timeline, until updating.
+        assert_eq!(sequencer.next_time(), Some(before));
+        sequencer.update(&link);
+        assert_ne!(sequencer.next_time(), Some(before));
+
+        let mut due = Vec::new();
+        while let Some(event) = sequencer.poll(&link, EVERYTHING) {
+            due.push(event);
+        }
+        assert_eq!(
+            due.iter().map(|due| due.event).collect::<Vec<_>>(),
+            [1, 2, 3]
+        );
+        for pair in due.windows(2) {
+            assert_eq!((pair[1].time - pair[0].time).as_micros(), 1_000_000);
+        }
+    }
+
+    #[test]
+    fn holds_events_outside_the_lookahead() {
+        let link = Link::new(120.0).unwrap();
+        let mut sequencer = Sequencer::<u32, 4>::new(4.0).unwrap();
+        sequencer.update(&link);
+        sequencer.schedule_in(&link, 8.0, 1).unwrap();
+        let now = link.clock_now();
+        let until = sequencer.next_time().unwrap() - now;
+
+        // Allow for the clock moving on by up to 50 ms before polling.
+        let short = until - Duration::from_millis(50);
+        assert!(sequencer.poll(&link, short).is_none());
+        assert_eq!(sequencer.len(), 1);
+        assert_eq!(sequencer.poll(&link, until).map(|due| due.event), Some(1));
+    }
+
+    #[test]
+    fn hands_out_late_events_at_once() {
+        let link = Link::new(120.0).unwrap();
+        let mut sequencer = Sequencer::<u32, 4>::new(4.0).unwrap();
+        sequencer.update(&link);
+        sequencer.schedule_in(&link, -1.0, 1).unwrap();
+        let due = sequencer.poll(&link, Duration::from_micros(0)).unwrap();
+        assert!(due.time < link.clock_now());
+    }
+
+    #[test]
+    fn schedules_the_next_bar_on_a_downbeat() {
+        let link = Link::new(120.0).unwrap();
+        let mut sequencer = Sequencer::<u32, 4>::new(3.0).unwrap();
+        sequencer.update(&link);
+        let now = sequencer.timeline().beat_at_time(link.clock_now(), 3.0);
+        sequencer.schedule_next_bar(&link, 1).unwrap();
+        let beat = sequencer.next_beat().unwrap();
+        assert_eq!(beat.rem_euclid(3.0).to_bits(), 0f64.to_bits(), "{beat}");
+        assert!(now < beat && beat <= now + 3.0, "{beat} after {now}");
+    }
+
+    #[test]
+    fn rejects_events_beyond_capacity() {
+        let mut sequencer = Sequencer::<u32, 2>::new(4.0).unwrap();
+        assert_eq!(sequencer.capacity(), 2);
+        assert_eq!(sequencer.schedule(1.0, 1), Ok(()));
+        assert_eq!(sequencer.schedule(2.0, 2), Ok(()));
+        assert_eq!(sequencer.schedule(3.0, 3), Err(3));
+        assert_eq!(sequencer.len(), 2);
+        sequencer.clear();
+        assert_eq!(sequencer.schedule(3.0, 3), Ok(()));
+    }
+}
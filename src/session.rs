@@ -1,10 +1,10 @@
 //! Session state for Link synchronization.
 
-use crate::{TransportState, time::Instant};
+use crate::{LinkError, TransportState, time::Instant, timeline::Timeline};
 
 mod sys {
     #[allow(clippy::wildcard_imports)]
-    pub use esp_idf_sys::abl_link::*;
+    pub use crate::idf::abl_link::*;
 }
 
 /// A snapshot of the Link session state.
@@ -21,6 +21,8 @@ mod sys {
 ///
 /// 1. Capture a session state with [`Link::capture_app_session_state`](crate::Link::capture_app_session_state)
 ///    or [`AudioLink::capture_session_state`](crate::AudioLink::capture_session_state)
+///    (or refill an existing one with the `_into` variants, see
+///    [Reusing a Session State](#reusing-a-session-state))
 /// 2. Read values using [`tempo`](Self::tempo),
 ///    [`beat_at_time`](Self::beat_at_time), [`transport_state`](Self::transport_state), etc.
 /// 3. Optionally modify using [`set_tempo`](Self::set_tempo),
@@ -28,13 +30,43 @@ mod sys {
 ///    [`set_transport_state_at`](Self::set_transport_state_at), etc.
 /// 4. Commit changes with [`Link::commit_app_session_state`](crate::Link::commit_app_session_state)
 ///    or [`AudioLink::commit_session_state`](crate::AudioLink::commit_session_state)
+///    (or skip unmodified session states with the `_if_modified` variants,
+///    see [`is_modified`](Self::is_modified))
 ///
 /// # Important
 ///
 /// This is a snapshot and will become stale. Don't store it for later use.
 /// Capture a fresh state when you need current values.
+///
+/// # Reusing a Session State
+///
+/// Every `SessionState` owns a heap-allocated C++ object. Capturing with
+/// [`Link::capture_app_session_state`](crate::Link::capture_app_session_state)
+/// or [`AudioLink::capture_session_state`](crate::AudioLink::capture_session_state)
+/// allocates a new one, and dropping it frees it again. To avoid this on hot
+/// paths (such as audio callbacks), allocate a session state once with
+/// [`new`](Self::new) and refill it with
+/// [`Link::capture_app_session_state_into`](crate::Link::capture_app_session_state_into)
+/// or [`AudioLink::capture_session_state_into`](crate::AudioLink::capture_session_state_into):
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Link, SessionState};
+///
+/// let mut link = Link::new(120.0).unwrap();
+/// let audio_link = link.bind_audio_thread();
+///
+/// // Once, during setup:
+/// let mut state = SessionState::new().unwrap();
+///
+/// // In every audio callback, without allocating:
+/// audio_link.capture_session_state_into(&mut state);
+/// let beat = state.beat_at_time(audio_link.clock_now(), 4.0);
+/// ```
 pub struct SessionState {
     pub(crate) handle: sys::abl_link_session_state,
+    // Set by every method that modifies the session state, and cleared by
+    // capturing into it.
+    pub(crate) modified: bool,
 }
 
 // Safety: SessionState is an independent snapshot with no references to Link.
@@ -46,13 +78,60 @@ pub struct SessionState {
 unsafe impl Send for SessionState {}
 
 impl SessionState {
+    /// Allocate a new, empty session state.
+    ///
+    /// The returned session state holds default values until it is filled by
+    /// one of the `_into` capture methods, such as
+    /// [`Link::capture_app_session_state_into`](crate::Link::capture_app_session_state_into)
+    /// or [`AudioLink::capture_session_state_into`](crate::AudioLink::capture_session_state_into).
+    /// See [Reusing a Session State](#reusing-a-session-state).
+    ///
+    /// This allocates, so call it during setup rather than on a realtime path.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state
+    /// could not be allocated.
+    pub fn new() -> Result<Self, LinkError> {
+        // Safety: abl_link_create_session_state allocates a new session state.
+        let handle = unsafe { sys::abl_link_create_session_state() };
+
+        if handle.impl_.is_null() {
+            #[cfg(feature = "stats")]
+            crate::stats::STATS
+                .allocation_failures
+                .fetch_add(1, std::sync::atomic::Ordering::Relaxed);
+            Err(LinkError::AllocationFailed)
+        } else {
+            Ok(Self::from_handle(handle))
+        }
+    }
+
     /// Create a new `SessionState` from a raw handle.
     ///
     /// # Safety
     ///
     /// The handle must be valid (non-null `impl_` pointer).
     pub(crate) const fn from_handle(handle: sys::abl_link_session_state) -> Self {
-        Self { handle }
+        Self {
+            handle,
+            modified: false,
+        }
+    }
+
+    /// Check whether this session state was modified since it was last
+    /// captured into.
+    ///
+    /// This is set by every method that changes the session state, such as
+    /// [`set_tempo`](Self::set_tempo),
+    /// [`request_beat_at_time`](Self::request_beat_at_time) and
+    /// [`set_transport_state_at`](Self::set_transport_state_at), even if the
+    /// new value equals the old one. It is cleared by the `_into` capture
+    /// methods and by the `_if_modified` commit methods, such as
+    /// [`Link::commit_app_session_state_if_modified`](crate::Link::commit_app_session_state_if_modified).
+    #[must_use]
+    pub const fn is_modified(&self) -> bool {
+        self.modified
     }
 
     /// Get the tempo of the timeline in Beats Per Minute.
@@ -84,7 +163,11 @@ impl SessionState {
     /// * `time` - The pivot point for the tempo change. The beat value at this
     ///   time remains unchanged; beats at other times shift according to the
     ///   new tempo.
+    ///
+    /// To follow a tempo knob or controller without committing every change,
+    /// use a [`TempoRamp`](crate::TempoRamp).
     pub fn set_tempo(&mut self, bpm: f64, time: Instant) {
+        self.modified = true;
         // Safety: handle is valid (checked in new()).
         unsafe { sys::abl_link_set_tempo(self.handle, bpm, time.as_micros()) }
     }
@@ -135,6 +218,136 @@ impl SessionState {
         Instant::from_micros(unsafe { sys::abl_link_time_at_beat(self.handle, beat, quantum) })
     }
 
+    /// Extract a plain-data [`Timeline`] snapshot of this session state.
+    ///
+    /// The timeline can then be queried without FFI calls, copied, and shared
+    /// between threads. See [`Timeline`] for details.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::Link;
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// let timeline = link.capture_app_session_state().unwrap().timeline();
+    /// let beat = timeline.beat_at_time(link.clock_now(), 4.0);
+    /// ```
+    #[must_use]
+    pub fn timeline(&self) -> Timeline {
+        Timeline::from_session_state(self)
+    }
+
+    /// Get the beat values at many times at once.
+    ///
+    /// This is equivalent to calling [`beat_at_time`](Self::beat_at_time)
+    /// for each of `times`, with bit-for-bit identical results, but much
+    /// cheaper for more than a handful of times: the timeline is read from the
+    /// session state once (a few FFI calls), and then evaluated in Rust for
+    /// every time. To evaluate the same session state repeatedly, extract the
+    /// [`timeline`](Self::timeline) once and use
+    /// [`Timeline::beats_at_times`] instead.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `times` and `out` have different lengths.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::{Duration, Link};
+    ///
+    /// let link = Link::new(120.0).unwrap();
+    /// let state = link.capture_app_session_state().unwrap();
+    /// let now = link.clock_now();
+    /// let times = [now, now + Duration::from_millis(10), now + Duration::from_millis(20)];
+    /// let mut beats = [0.0; 3];
+    /// state.beats_at_times(&times, 4.0, &mut beats);
+    /// ```
+    pub fn beats_at_times(&self, times: &[Instant], quantum: f64, out: &mut [f64]) {
+        assert_eq!(
+            times.len(),
+            out.len(),
+            "times and out must have the same length"
+        );
+        self.timeline().beats_at_times(times, quantum, out);
+    }
+
+    /// Get the phases at many times at once.
+    ///
+    /// This is equivalent to calling [`phase_at_time`](Self::phase_at_time)
+    /// for each of `times`. See [`beats_at_times`](Self::beats_at_times) for
+    /// details.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `times` and `out` have different lengths.
+    pub fn phases_at_times(&self, times: &[Instant], quantum: f64, out: &mut [f64]) {
+        assert_eq!(
+            times.len(),
+            out.len(),
+            "times and out must have the same length"
+        );
+        self.timeline().phases_at_times(times, quantum, out);
+    }
+
+    /// Get the beat value at every sample of an audio buffer.
+    ///
+    /// Writes the beat at sample `i` (at `start + i / sample_rate` seconds,
+    /// rounded to the nearest microsecond) to `out[i]`, for every sample in
+    /// `out`. Like [`beats_at_times`](Self::beats_at_times), this reads the
+    /// timeline once and evaluates it in Rust, instead of making one FFI call
+    /// per sample.
+    ///
+    /// # Arguments
+    ///
+    /// * `start` - The time of the first sample in the buffer. For audio
+    ///   output, this should include the output latency.
+    /// * `sample_rate` - The sample rate in Hz.
+    /// * `quantum` - The quantum (beats per cycle/bar).
+    /// * `out` - Receives one beat value per sample.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use esp_idf_ableton_link::{Duration, Link, SessionState};
+    ///
+    /// let mut link = Link::new(120.0).unwrap();
+    /// let mut state = SessionState::new().unwrap();
+    /// let audio_link = link.bind_audio_thread();
+    /// let output_latency = Duration::from_millis(5);
+    ///
+    /// // In the audio callback:
+    /// let mut beats = [0.0; 256];
+    /// audio_link.capture_session_state_into(&mut state);
+    /// let start = audio_link.clock_now() + output_latency;
+    /// state.beats_for_buffer(start, 48_000, 4.0, &mut beats);
+    /// ```
+    pub fn beats_for_buffer(
+        &self,
+        start: Instant,
+        sample_rate: u32,
+        quantum: f64,
+        out: &mut [f64],
+    ) {
+        self.timeline()
+            .beats_for_buffer(start, sample_rate, quantum, out);
+    }
+
+    /// Get the phase at every sample of an audio buffer.
+    ///
+    /// This is the phase equivalent of
+    /// [`beats_for_buffer`](Self::beats_for_buffer).
+    pub fn phases_for_buffer(
+        &self,
+        start: Instant,
+        sample_rate: u32,
+        quantum: f64,
+        out: &mut [f64],
+    ) {
+        self.timeline()
+            .phases_for_buffer(start, sample_rate, quantum, out);
+    }
+
     /// Request a beat/time mapping, respecting session phase when not alone
     /// in the session (quantized launch).
     ///
@@ -183,6 +396,7 @@ impl SessionState {
     /// [`Link::commit_app_session_state`](crate::Link::commit_app_session_state) or
     /// [`AudioLink::commit_session_state`](crate::AudioLink::commit_session_state).
     pub fn request_beat_at_time(&mut self, beat: f64, time: Instant, quantum: f64) {
+        self.modified = true;
         // Safety: handle is valid (checked in new()).
         unsafe {
             sys::abl_link_request_beat_at_time(self.handle, beat, time.as_micros(), quantum);
@@ -222,6 +436,7 @@ impl SessionState {
     /// * `time` - The time to map it to.
     /// * `quantum` - The quantum (beats per cycle/bar).
     pub fn force_beat_at_time(&mut self, beat: f64, time: Instant, quantum: f64) {
+        self.modified = true;
         // Safety: handle is valid (checked in new()).
         unsafe {
             sys::abl_link_force_beat_at_time(self.handle, beat, time.as_u64(), quantum);
@@ -299,6 +514,7 @@ impl SessionState {
     /// * `state` - The desired transport state.
     /// * `time` - The time at which the change takes effect.
     pub fn set_transport_state_at(&mut self, state: TransportState, time: Instant) {
+        self.modified = true;
         // Safety: handle is valid (checked in new()).
         unsafe { sys::abl_link_set_is_playing(self.handle, state.into(), time.as_u64()) }
     }
@@ -357,6 +573,7 @@ impl SessionState {
     /// * `beat` - The beat to map to the transport state time.
     /// * `quantum` - The quantum (beats per cycle/bar).
     pub fn request_beat_at_transport_state_time(&mut self, beat: f64, quantum: f64) {
+        self.modified = true;
         // Safety: handle is valid (checked in new()).
         unsafe { sys::abl_link_request_beat_at_start_playing_time(self.handle, beat, quantum) }
     }
@@ -380,6 +597,7 @@ impl SessionState {
     /// [`start_transport_at`]: Self::start_transport_at
     /// [`request_beat_at_transport_state_time`]: Self::request_beat_at_transport_state_time
     pub fn start_transport_and_request_beat_at(&mut self, beat: f64, time: Instant, quantum: f64) {
+        self.modified = true;
         // Safety: handle is valid (checked in new()).
         unsafe {
             sys::abl_link_set_is_playing_and_request_beat_at_time(
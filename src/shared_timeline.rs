@@ -0,0 +1,215 @@
+//! Lock-free publication of the session timeline to any number of readers.
+
+use std::{
+    cell::UnsafeCell,
+    sync::{
+        Arc,
+        atomic::{AtomicBool, Ordering},
+    },
+};
+
+use crate::{LinkError, SessionState, Timeline, double_buffer::DoubleBuffer, sys};
+
+/// The publishing side of a [`SharedTimeline`], owned by the Link instance
+/// and its callbacks.
+pub(crate) struct TimelineCell {
+    handle: sys::abl_link,
+    // Only accessed by the thread that holds `refreshing`.
+    state: UnsafeCell<SessionState>,
+    // Set while a thread is capturing and publishing, so that there is only
+    // ever one writer of `timeline`.
+    refreshing: AtomicBool,
+    // Set by every refresh request, and cleared by the thread that serves
+    // it.
+    requested: AtomicBool,
+    timeline: DoubleBuffer<{ Timeline::WORDS }>,
+    // Published by the audio thread, its only writer, which can't take part
+    // in `refreshing` without waiting.
+    audio_timeline: DoubleBuffer<{ Timeline::WORDS }>,
+    // Whether `audio_timeline` was published after `timeline`.
+    audio_latest: AtomicBool,
+}
+
+// Safety: abl_link_capture_app_session_state is thread-safe, `state` is only
+// accessed by the one thread holding `refreshing`, and the handle is only
+// used from the Link instance and its callbacks, so never after it is
+// destroyed.
+unsafe impl Send for TimelineCell {}
+unsafe impl Sync for TimelineCell {}
+
+impl TimelineCell {
+    pub(crate) fn new(handle: sys::abl_link) -> Result<Self, LinkError> {
+        let cell = Self {
+            handle,
+            state: UnsafeCell::new(SessionState::new()?),
+            refreshing: AtomicBool::new(false),
+            requested: AtomicBool::new(false),
+            timeline: DoubleBuffer::new(),
+            audio_timeline: DoubleBuffer::new(),
+            audio_latest: AtomicBool::new(false),
+        };
+        cell.refresh();
+        Ok(cell)
+    }
+
+    /// Capture the app session state and publish its timeline.
+    ///
+    /// Never waits: if another thread is publishing already, it is left to
+    /// capture again once it is done, so the published timeline is never
+    /// older than the latest request.
+    pub(crate) fn refresh(&self) {
+        // SeqCst orders the request before the check of `refreshing`, and
+        // the release of `refreshing` before the check of `requested`, so
+        // either this thread publishes or the one publishing sees the
+        // request.
+        self.requested.store(true, Ordering::SeqCst);
+        while self.requested.load(Ordering::SeqCst) {
+            if self.refreshing.swap(true, Ordering::SeqCst) {
+                return;
+            }
+            self.requested.store(false, Ordering::SeqCst);
+            // Safety: `refreshing` gives this thread exclusive access to
+            // state, and the Link handle is valid (see above).
+            let timeline = unsafe {
+                let state = &mut *self.state.get();
+                sys::abl_link_capture_app_session_state(self.handle, state.handle);
+                state.timeline()
+            };
+            self.timeline.store(timeline.to_words());
+            self.audio_latest.store(false, Ordering::Release);
+            self.refreshing.store(false, Ordering::SeqCst);
+        }
+    }
+
+    /// Publish the timeline of a session state committed from the audio
+    /// thread.
+    ///
+    /// Realtime-safe, as it publishes the committed timeline instead of
+    /// capturing one. Must only be called from the thread an
+    /// [`AudioLink`](crate::AudioLink) is bound to, as the single writer of
+    /// `audio_timeline`.
+    pub(crate) fn publish_audio(&self, timeline: &Timeline) {
+        self.audio_timeline.store(timeline.to_words());
+        self.audio_latest.store(true, Ordering::Release);
+    }
+
+    fn load(&self) -> Timeline {
+        let buffer = if self.audio_latest.load(Ordering::Acquire) {
+            &self.audio_timeline
+        } else {
+            &self.timeline
+        };
+        Timeline::from_words(buffer.load().1)
+    }
+
+    fn generation(&self) -> u32 {
+        self.timeline
+            .generation()
+            .wrapping_add(self.audio_timeline.generation())
+            & (u32::MAX >> 1)
+    }
+}
+
+/// The session timeline, readable from any task or core without locking,
+/// FFI calls or allocation.
+///
+/// Created by [`Link::shared_timeline`](crate::Link::shared_timeline).
+/// The Link instance keeps the timeline up to date: it republishes it from
+/// the Link thread when the tempo, transport state or number of peers
+/// changes, and from the committing thread on every
+/// [`commit_app_session_state`](crate::Link::commit_app_session_state) and
+/// [`AudioLink::commit_session_state`](crate::AudioLink::commit_session_state).
+///
+/// Reading takes a consistent [`Timeline`] snapshot by value. Readers never
+/// wait for the publisher: if a new timeline is published during a read,
+/// the read is retried, and a publisher never waits for readers either. This
+/// suits many readers on both cores, such as several audio or LED tasks that
+/// each need the beat at their own buffer times, where capturing a
+/// [`SessionState`] each would contend on Link's internal lock.
+///
+/// Capturing an app session state isn't realtime-safe, so commits from the
+/// audio thread publish the timeline of the committed state instead, into a
+/// buffer of their own. Readers get whichever was published last.
+///
+/// `SharedTimeline` handles are `Clone`, `Send` and `Sync`. They stay
+/// readable after the Link instance is dropped, returning the last timeline
+/// published.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::Link;
+///
+/// let link = Link::new(120.0).unwrap();
+/// let timeline = link.shared_timeline().unwrap();
+/// link.enable();
+///
+/// # let buffer_time = || link.clock_now();
+/// for core in 0..2 {
+///     let timeline = timeline.clone();
+///     let time = buffer_time();
+///     std::thread::spawn(move || {
+///         let beat = timeline.timeline().beat_at_time(time, 4.0);
+///         log::info!("Core {core} at beat {beat}");
+///     });
+/// }
+/// ```
+#[derive(Clone)]
+pub struct SharedTimeline {
+    cell: Arc<TimelineCell>,
+}
+
+impl SharedTimeline {
+    pub(crate) const fn new(cell: Arc<TimelineCell>) -> Self {
+        Self { cell }
+    }
+
+    /// Get the latest published timeline.
+    #[must_use]
+    pub fn timeline(&self) -> Timeline {
+        self.cell.load()
+    }
+
+    /// Get the number of timelines published so far, wrapping at 2^31.
+    ///
+    /// Comparing this with the value seen earlier is a cheaper way to check
+    /// for changes than comparing timelines. A change in generation doesn't
+    /// imply a change in the timeline: it is republished on every commit and
+    /// notification, changed or not.
+    #[must_use]
+    pub fn generation(&self) -> u32 {
+        self.cell.generation()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{Link, SessionState};
+
+    #[test]
+    fn publishes_audio_commits() {
+        let mut link = Link::new(120.0).unwrap();
+        let shared = link.shared_timeline().unwrap();
+        let generation = shared.generation();
+        let mut state = SessionState::new().unwrap();
+
+        // Moving the phase at the same tempo makes Link report nothing.
+        let audio_link = link.bind_audio_thread();
+        audio_link.capture_session_state_into(&mut state);
+        let now = audio_link.clock_now();
+        state.request_beat_at_time(1.0, now, 4.0);
+        audio_link.commit_session_state(&state);
+
+        let timeline = shared.timeline();
+        assert_ne!(shared.generation(), generation);
+        assert_eq!(
+            timeline.beat_at_time(now, 4.0).to_bits(),
+            state.beat_at_time(now, 4.0).to_bits()
+        );
+
+        // An app commit takes over again.
+        state.set_tempo(90.0, now);
+        link.commit_app_session_state(&state);
+        assert_eq!(shared.timeline().tempo().to_bits(), 90f64.to_bits());
+    }
+}
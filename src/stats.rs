@@ -0,0 +1,253 @@
+//! Timing statistics for the hot paths, enabled by the `stats` feature.
+
+use std::sync::atomic::{AtomicU32, Ordering};
+
+/// Number of histogram buckets: one per power of two of a `u32` duration.
+const BUCKETS: usize = 32;
+
+/// Read the CPU cycle counter.
+#[cfg(target_arch = "xtensa")]
+#[inline]
+fn cycle_count() -> u32 {
+    let cycles: u32;
+    // Safety: reading CCOUNT has no side effects.
+    unsafe {
+        core::arch::asm!("rsr.ccount {0}", out(reg) cycles, options(nomem, nostack));
+    }
+    cycles
+}
+
+/// Read the processor ID of the core this runs on. Each core has a `CCOUNT`
+/// of its own, so a duration only means something if it starts and ends on
+/// the same core.
+#[cfg(target_arch = "xtensa")]
+#[inline]
+fn core_id() -> u32 {
+    let prid: u32;
+    // Safety: reading PRID has no side effects.
+    unsafe {
+        core::arch::asm!("rsr.prid {0}", out(reg) prid, options(nomem, nostack));
+    }
+    prid
+}
+
+/// Read a cycle counter stand-in on targets without `CCOUNT`: microseconds.
+#[cfg(not(target_arch = "xtensa"))]
+#[inline]
+#[allow(clippy::cast_possible_truncation, clippy::cast_sign_loss)]
+fn cycle_count() -> u32 {
+    // Safety: esp_timer_get_time is always safe to call.
+    (unsafe { crate::idf::esp_timer_get_time() }) as u32
+}
+
+/// The stand-in counter is shared by all cores, so any core will do.
+#[cfg(not(target_arch = "xtensa"))]
+#[inline]
+const fn core_id() -> u32 {
+    0
+}
+
+/// A lock-free, fixed-size histogram of durations in CPU cycles, with
+/// power-of-two buckets.
+pub(crate) struct Histogram {
+    buckets: [AtomicU32; BUCKETS],
+    calls: AtomicU32,
+    min: AtomicU32,
+    max: AtomicU32,
+    migrated: AtomicU32,
+}
+
+impl Histogram {
+    const fn new() -> Self {
+        Self {
+            buckets: [const { AtomicU32::new(0) }; BUCKETS],
+            calls: AtomicU32::new(0),
+            min: AtomicU32::new(u32::MAX),
+            max: AtomicU32::new(0),
+            migrated: AtomicU32::new(0),
+        }
+    }
+
+    /// Start timing; the duration is recorded when the guard is dropped.
+    #[inline]
+    pub(crate) fn start(&self) -> Timing<'_> {
+        Timing {
+            histogram: self,
+            core: core_id(),
+            start: cycle_count(),
+        }
+    }
+
+    fn record(&self, cycles: u32) {
+        let bucket = (u32::BITS - 1).saturating_sub(cycles.leading_zeros());
+        self.buckets[bucket as usize].fetch_add(1, Ordering::Relaxed);
+        self.calls.fetch_add(1, Ordering::Relaxed);
+        self.min.fetch_min(cycles, Ordering::Relaxed);
+        self.max.fetch_max(cycles, Ordering::Relaxed);
+    }
+
+    fn snapshot(&self) -> HistogramSnapshot {
+        let buckets = std::array::from_fn(|i| self.buckets[i].load(Ordering::Relaxed));
+        let calls = self.calls.load(Ordering::Relaxed);
+        let max_cycles = self.max.load(Ordering::Relaxed);
+        HistogramSnapshot {
+            calls,
+            min_cycles: if calls == 0 {
+                0
+            } else {
+                self.min.load(Ordering::Relaxed)
+            },
+            max_cycles,
+            p99_cycles: percentile(&buckets, 0.99).min(max_cycles),
+            buckets,
+            migrated: self.migrated.load(Ordering::Relaxed),
+        }
+    }
+
+    fn reset(&self) {
+        for bucket in &self.buckets {
+            bucket.store(0, Ordering::Relaxed);
+        }
+        self.calls.store(0, Ordering::Relaxed);
+        self.min.store(u32::MAX, Ordering::Relaxed);
+        self.max.store(0, Ordering::Relaxed);
+        self.migrated.store(0, Ordering::Relaxed);
+    }
+}
+
+/// The upper bound of the bucket containing the `fraction` percentile.
+fn percentile(buckets: &[u32; BUCKETS], fraction: f64) -> u32 {
+    let total: u64 = buckets.iter().map(|&count| u64::from(count)).sum();
+    #[allow(
+        clippy::cast_precision_loss,
+        clippy::cast_possible_truncation,
+        clippy::cast_sign_loss
+    )]
+    let rank = ((total as f64) * fraction).ceil() as u64;
+    let mut seen = 0;
+    for (bucket, &count) in buckets.iter().enumerate() {
+        seen += u64::from(count);
+        if seen >= rank && seen > 0 {
+            // Bucket i holds durations in [2^i, 2^(i+1)), bucket 0 also 0.
+            return u32::MAX >> (BUCKETS - 1 - bucket);
+        }
+    }
+    0
+}
+
+/// Records the time since [`Histogram::start`] when dropped, unless the
+/// task moved to another core in between.
+pub(crate) struct Timing<'a> {
+    histogram: &'a Histogram,
+    core: u32,
+    start: u32,
+}
+
+impl Drop for Timing<'_> {
+    #[inline]
+    fn drop(&mut self) {
+        let end = cycle_count();
+        // The cycle counters of the cores aren't in sync, so the difference
+        // of readings on two cores is meaningless.
+        if core_id() == self.core {
+            self.histogram.record(end.wrapping_sub(self.start));
+        } else {
+            self.histogram.migrated.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// All statistics, shared by every Link instance.
+pub(crate) struct Stats {
+    pub(crate) capture_app: Histogram,
+    pub(crate) commit_app: Histogram,
+    pub(crate) capture_audio: Histogram,
+    pub(crate) commit_audio: Histogram,
+    pub(crate) callback: Histogram,
+    pub(crate) allocation_failures: AtomicU32,
+}
+
+pub(crate) static STATS: Stats = Stats {
+    capture_app: Histogram::new(),
+    commit_app: Histogram::new(),
+    capture_audio: Histogram::new(),
+    commit_audio: Histogram::new(),
+    callback: Histogram::new(),
+    allocation_failures: AtomicU32::new(0),
+};
+
+impl Stats {
+    pub(crate) fn snapshot(&self) -> LinkStats {
+        LinkStats {
+            capture_app_session_state: self.capture_app.snapshot(),
+            commit_app_session_state: self.commit_app.snapshot(),
+            capture_audio_session_state: self.capture_audio.snapshot(),
+            commit_audio_session_state: self.commit_audio.snapshot(),
+            callbacks: self.callback.snapshot(),
+            allocation_failures: self.allocation_failures.load(Ordering::Relaxed),
+        }
+    }
+
+    pub(crate) fn reset(&self) {
+        self.capture_app.reset();
+        self.commit_app.reset();
+        self.capture_audio.reset();
+        self.commit_audio.reset();
+        self.callback.reset();
+        self.allocation_failures.store(0, Ordering::Relaxed);
+    }
+}
+
+/// A snapshot of the duration histogram of one operation.
+///
+/// Durations are in CPU cycles, read from the Xtensa `CCOUNT` register: at
+/// 240 MHz, 240 cycles are one microsecond. Bucket `i` of
+/// [`buckets`](Self::buckets) counts durations from `2^i` up to (but not
+/// including) `2^(i+1)` cycles; bucket 0 also counts zero.
+///
+/// Each core counts its own cycles, so a call that starts on one core and
+/// ends on another can't be timed. Such calls only count towards
+/// [`migrated`](Self::migrated), not towards [`calls`](Self::calls) or the
+/// durations. Pin the calling task to a core to time every call.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct HistogramSnapshot {
+    /// The number of recorded calls.
+    pub calls: u32,
+    /// The shortest recorded duration, or 0 if there were no calls.
+    pub min_cycles: u32,
+    /// The longest recorded duration.
+    pub max_cycles: u32,
+    /// An upper bound of the 99th percentile duration: the upper end of the
+    /// bucket that contains it, but no more than
+    /// [`max_cycles`](Self::max_cycles).
+    pub p99_cycles: u32,
+    /// The number of calls per power-of-two bucket.
+    pub buckets: [u32; BUCKETS],
+    /// The number of calls that weren't recorded because the calling task
+    /// moved to another core during the call.
+    pub migrated: u32,
+}
+
+/// Timing statistics of the Link hot paths, returned by
+/// [`Link::stats`](crate::Link::stats).
+///
+/// Requires the `stats` feature.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct LinkStats {
+    /// [`Link::capture_app_session_state`](crate::Link::capture_app_session_state)
+    /// and its `_into` variant.
+    pub capture_app_session_state: HistogramSnapshot,
+    /// [`Link::commit_app_session_state`](crate::Link::commit_app_session_state).
+    pub commit_app_session_state: HistogramSnapshot,
+    /// [`AudioLink::capture_session_state`](crate::AudioLink::capture_session_state)
+    /// and its `_into` variant.
+    pub capture_audio_session_state: HistogramSnapshot,
+    /// [`AudioLink::commit_session_state`](crate::AudioLink::commit_session_state).
+    pub commit_audio_session_state: HistogramSnapshot,
+    /// How long peer count, tempo and transport state callbacks ran on the
+    /// Link thread.
+    pub callbacks: HistogramSnapshot,
+    /// The number of times a [`SessionState`](crate::SessionState) could not
+    /// be allocated.
+    pub allocation_failures: u32,
+}
@@ -1,10 +1,11 @@
 //! Time types for the Link clock domain.
 //!
 //! This module provides [`Instant`] and [`Duration`] types that are specific
-//! to the Link clock, which is synchronized across all connected peers.
+//! to the Link clock, which is synchronized across all connected peers, and
+//! the fixed-point [`Beats`] type for integer-only timeline math.
 
 use std::{
-    ops::{Add, AddAssign, Div, DivAssign, Mul, MulAssign, Sub, SubAssign},
+    ops::{Add, AddAssign, Div, DivAssign, Mul, MulAssign, Neg, Sub, SubAssign},
     time::Duration as StdDuration,
 };
 
@@ -26,6 +27,9 @@ use std::{
 /// let now = link.clock_now();
 /// ```
 ///
+/// To convert readings of another clock, such as an I2S sample counter, to
+/// `Instant`s, use a [`ClockBridge`](crate::ClockBridge).
+///
 /// # Arithmetic
 ///
 /// `Instant` supports addition and subtraction with [`Duration`]:
@@ -323,3 +327,144 @@ impl SubAssign<StdDuration> for Instant {
         *self = *self - rhs;
     }
 }
+
+/// A beat value in fixed point: a whole number of micro-beats.
+///
+/// Micro-beats are Link's own beat representation, so a `Beats` holds
+/// exactly what Link computes with. Together with the integer
+/// microseconds of [`Instant`], it lets a [`Timeline`](crate::Timeline) map
+/// between beats and times without floating point, see
+/// [`Timeline::beat_at_time_fixed`](crate::Timeline::beat_at_time_fixed).
+/// That matters on chips whose FPU only does single precision, such as the
+/// ESP32, where every `f64` operation is done in software.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::Beats;
+///
+/// let quantum = Beats::from_beats(4);
+/// let half = Beats::from_micro_beats(500_000);
+/// assert_eq!((quantum + half).as_f64(), 4.5);
+/// assert_eq!(Beats::from_f64(4.5).floor(), 4);
+/// ```
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub struct Beats(i64);
+
+impl Beats {
+    /// Zero beats.
+    pub const ZERO: Self = Self(0);
+
+    /// The number of micro-beats per beat.
+    pub const MICRO_BEATS_PER_BEAT: i64 = 1_000_000;
+
+    /// Create a `Beats` from micro-beats.
+    #[must_use]
+    pub const fn from_micro_beats(micro_beats: i64) -> Self {
+        Self(micro_beats)
+    }
+
+    /// Create a `Beats` from whole beats.
+    #[must_use]
+    pub const fn from_beats(beats: i64) -> Self {
+        Self(beats * Self::MICRO_BEATS_PER_BEAT)
+    }
+
+    /// Convert a floating-point beat value, rounding to the nearest
+    /// micro-beat like Link does.
+    #[must_use]
+    #[allow(clippy::cast_possible_truncation)]
+    pub fn from_f64(beats: f64) -> Self {
+        Self((beats * 1e6).round() as i64)
+    }
+
+    /// Get the beat value in micro-beats.
+    #[must_use]
+    pub const fn as_micro_beats(self) -> i64 {
+        self.0
+    }
+
+    /// Convert to a floating-point beat value.
+    #[must_use]
+    #[allow(clippy::cast_precision_loss)]
+    pub fn as_f64(self) -> f64 {
+        self.0 as f64 / 1e6
+    }
+
+    /// Get the largest whole beat not greater than this value, for example
+    /// the index of the beat a phase falls in.
+    #[must_use]
+    pub const fn floor(self) -> i64 {
+        self.0.div_euclid(Self::MICRO_BEATS_PER_BEAT)
+    }
+
+    /// Get the position within the beat, in `[0, 1)` beats.
+    #[must_use]
+    pub const fn fract(self) -> Self {
+        Self(self.0.rem_euclid(Self::MICRO_BEATS_PER_BEAT))
+    }
+}
+
+impl Add for Beats {
+    type Output = Self;
+
+    fn add(self, rhs: Self) -> Self::Output {
+        Self(self.0 + rhs.0)
+    }
+}
+
+impl AddAssign for Beats {
+    fn add_assign(&mut self, rhs: Self) {
+        *self = *self + rhs;
+    }
+}
+
+impl Sub for Beats {
+    type Output = Self;
+
+    fn sub(self, rhs: Self) -> Self::Output {
+        Self(self.0 - rhs.0)
+    }
+}
+
+impl SubAssign for Beats {
+    fn sub_assign(&mut self, rhs: Self) {
+        *self = *self - rhs;
+    }
+}
+
+impl Neg for Beats {
+    type Output = Self;
+
+    fn neg(self) -> Self::Output {
+        Self(-self.0)
+    }
+}
+
+impl Mul<i64> for Beats {
+    type Output = Self;
+
+    fn mul(self, rhs: i64) -> Self::Output {
+        Self(self.0 * rhs)
+    }
+}
+
+impl MulAssign<i64> for Beats {
+    fn mul_assign(&mut self, rhs: i64) {
+        *self = *self * rhs;
+    }
+}
+
+impl Div<i64> for Beats {
+    type Output = Self;
+
+    fn div(self, rhs: i64) -> Self::Output {
+        Self(self.0 / rhs)
+    }
+}
+
+impl DivAssign<i64> for Beats {
+    fn div_assign(&mut self, rhs: i64) {
+        *self = *self / rhs;
+    }
+}
@@ -0,0 +1,616 @@
+//! Plain-data snapshot of a Link timeline, evaluated in Rust.
+//!
+//! This mirrors the timeline math of Ableton Link (`Timeline.hpp`,
+//! `Tempo.hpp`, `Beats.hpp` and `Phase.hpp`), so that a timeline extracted
+//! once from a [`SessionState`] can be evaluated many times without crossing
+//! FFI, with bit-for-bit identical results.
+//!
+//! Like Link, beats are handled as integer micro-beats, tempo as an integer
+//! number of microseconds per beat, and times as integer microseconds.
+
+use crate::{
+    SessionState, TransportState,
+    time::{Beats, Instant},
+};
+
+/// A quantum large enough that phase encoding with it doesn't wrap, used to
+/// recover the beat origin of a timeline. Timelines whose beat origin is at
+/// least half this many beats away from zero are not supported.
+const ORIGIN_PROBE_QUANTUM: f64 = 1e9;
+
+/// Convert beats to micro-beats, like Link's `Beats(double)` constructor.
+#[inline]
+#[allow(clippy::cast_possible_truncation)]
+pub(crate) fn micro_beats(beats: f64) -> i64 {
+    (beats * 1e6).round() as i64
+}
+
+/// Convert micro-beats to beats, like Link's `Beats::floating()`.
+#[inline]
+#[allow(clippy::cast_precision_loss)]
+pub(crate) fn floating(micro_beats: i64) -> f64 {
+    micro_beats as f64 / 1e6
+}
+
+/// `a % b`, or zero if `b` is zero, like Link's `Beats::operator%`.
+#[inline]
+const fn modulo(a: i64, b: i64) -> i64 {
+    if b == 0 { 0 } else { a % b }
+}
+
+/// The phase of `beats` in `[0, quantum)`, handling negative beats.
+#[inline]
+const fn phase(beats: i64, quantum: i64) -> i64 {
+    if quantum == 0 {
+        return 0;
+    }
+    // Compute relative to a quantum boundary below -abs(beats).
+    let quantum_bins = (beats.abs() + quantum) / quantum;
+    modulo(beats + quantum_bins * quantum, quantum)
+}
+
+/// The least value not less than `x` with the same phase as `target`.
+#[inline]
+pub(crate) const fn next_phase_match(x: i64, target: i64, quantum: i64) -> i64 {
+    let phase_diff = modulo(
+        phase(target, quantum) - phase(x, quantum) + quantum,
+        quantum,
+    );
+    x + phase_diff
+}
+
+/// Half a quantum, rounded like Link's `Beats(0.5 * quantum.floating())`.
+#[inline]
+pub(crate) fn half(quantum: i64) -> i64 {
+    micro_beats(0.5 * floating(quantum))
+}
+
+/// Half a quantum, rounded to the nearest micro-beat without floating point.
+#[inline]
+const fn half_fixed(quantum: i64) -> i64 {
+    div_round(quantum, 2)
+}
+
+/// The value closest to `x` with the same phase as `target`, given half the
+/// quantum.
+#[inline]
+pub(crate) const fn closest_phase_match(x: i64, target: i64, quantum: i64, half: i64) -> i64 {
+    next_phase_match(x - half, target, quantum)
+}
+
+/// `a / b` rounded to the nearest integer, halves away from zero like
+/// `llround`. `b` must be positive.
+#[inline]
+const fn div_round(a: i64, b: i64) -> i64 {
+    if a >= 0 {
+        (a + b / 2) / b
+    } else {
+        (a - b / 2) / b
+    }
+}
+
+/// `value * num / den`, rounded like [`div_round`], without overflow as long
+/// as `den * num` fits in an `i64`.
+#[inline]
+const fn mul_div_round(value: i64, num: i64, den: i64) -> i64 {
+    (value / den) * num + div_round((value % den) * num, den)
+}
+
+/// A plain-data snapshot of a session state's timeline and transport state.
+///
+/// A `Timeline` holds the same information as a [`SessionState`] (tempo, the
+/// beat/time mapping, and transport state), but as plain Rust data instead
+/// of a handle to a C++ object. It is extracted once with
+/// [`SessionState::timeline`], after which its methods are pure Rust:
+///
+/// - No FFI calls, so queries can be inlined and optimized by the compiler.
+/// - [`beat_at_time`](Self::beat_at_time),
+///   [`phase_at_time`](Self::phase_at_time) and
+///   [`time_at_beat`](Self::time_at_beat) return bit-for-bit the same results
+///   as the [`SessionState`] methods of the same name, including Link's phase
+///   encoding and rounding.
+/// - The `_fixed` variants of those methods take and return fixed-point
+///   [`Beats`] instead of `f64`, and use no floating point at all.
+/// - It is `Copy`, `Send` and `Sync`, so it can be passed by value to
+///   interrupt handlers, DMA callbacks and worker tasks, or shared between
+///   them, which [`SessionState`] (deliberately `!Sync`) doesn't allow.
+///
+/// Like a [`SessionState`], a `Timeline` is a snapshot: it doesn't follow
+/// later tempo or phase changes in the session. Extract a new one when those
+/// happen (for example from [`Link::set_tempo_callback`](crate::Link::set_tempo_callback)),
+/// or have a [`SharedTimeline`](crate::SharedTimeline) keep one up to date.
+/// Modifying the session still goes through [`SessionState`].
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::Link;
+///
+/// let link = Link::new(120.0).unwrap();
+/// let now = link.clock_now();
+/// let timeline = link.capture_app_session_state().unwrap().timeline();
+///
+/// // Hand the timeline to another task by value
+/// std::thread::spawn(move || {
+///     let phase = timeline.phase_at_time(now, 4.0);
+///     let next_beat = timeline.time_at_beat(timeline.beat_at_time(now, 4.0).ceil(), 4.0);
+/// });
+/// ```
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Timeline {
+    tempo: f64,
+    micros_per_beat: i64,
+    beat_origin: i64,
+    time_origin: i64,
+    transport_state: TransportState,
+    transport_state_time: Instant,
+}
+
+impl Timeline {
+    /// Extract the timeline of a session state.
+    ///
+    /// This costs six FFI calls, after which evaluating the timeline needs
+    /// none.
+    pub(crate) fn from_session_state(state: &SessionState) -> Self {
+        let tempo = state.tempo();
+
+        // With a quantum of zero, Link applies the timeline without phase
+        // encoding. With a huge quantum, phase encoding shifts the beat by
+        // exactly the negated beat origin.
+        let origin = Instant::from_micros(0);
+        let raw_beat = micro_beats(state.beat_at_time(origin, 0.0));
+        let encoded_beat = micro_beats(state.beat_at_time(origin, ORIGIN_PROBE_QUANTUM));
+        let beat_origin = raw_beat - encoded_beat;
+        let time_origin = state.time_at_beat(floating(beat_origin), 0.0).as_micros();
+
+        Self {
+            tempo,
+            micros_per_beat: Self::tempo_micros_per_beat(tempo),
+            beat_origin,
+            time_origin,
+            transport_state: state.transport_state(),
+            transport_state_time: state.transport_state_time(),
+        }
+    }
+
+    /// Create a timeline from Link's representation, with the transport
+    /// stopped. Used by the host backend to evaluate its session states.
+    #[cfg(feature = "host")]
+    pub(crate) fn from_parts(tempo: f64, beat_origin: i64, time_origin: i64) -> Self {
+        Self {
+            tempo,
+            micros_per_beat: Self::tempo_micros_per_beat(tempo),
+            beat_origin,
+            time_origin,
+            transport_state: TransportState::Stop,
+            transport_state_time: Instant::from_micros(0),
+        }
+    }
+
+    /// The number of `u32` words a timeline is encoded in by
+    /// [`to_words`](Self::to_words).
+    pub(crate) const WORDS: usize = 11;
+
+    /// Encode the timeline as plain words, for publishing through atomics.
+    /// The tempo in microseconds per beat is stored alongside the tempo, so
+    /// that readers don't have to derive it with a division.
+    #[allow(clippy::cast_possible_truncation, clippy::cast_sign_loss)]
+    pub(crate) fn to_words(self) -> [u32; Self::WORDS] {
+        let split = |value: u64| [value as u32, (value >> 32) as u32];
+        let [tempo_lo, tempo_hi] = split(self.tempo.to_bits());
+        let [micros_lo, micros_hi] = split(self.micros_per_beat as u64);
+        let [beat_lo, beat_hi] = split(self.beat_origin as u64);
+        let [time_lo, time_hi] = split(self.time_origin as u64);
+        let [transport_lo, transport_hi] = split(self.transport_state_time.as_micros() as u64);
+        [
+            tempo_lo,
+            tempo_hi,
+            micros_lo,
+            micros_hi,
+            beat_lo,
+            beat_hi,
+            time_lo,
+            time_hi,
+            bool::from(self.transport_state).into(),
+            transport_lo,
+            transport_hi,
+        ]
+    }
+
+    /// Decode a timeline encoded by [`to_words`](Self::to_words).
+    #[allow(clippy::cast_possible_wrap)]
+    pub(crate) fn from_words(words: [u32; Self::WORDS]) -> Self {
+        let join = |lo: u32, hi: u32| u64::from(lo) | (u64::from(hi) << 32);
+        Self {
+            tempo: f64::from_bits(join(words[0], words[1])),
+            micros_per_beat: join(words[2], words[3]) as i64,
+            beat_origin: join(words[4], words[5]) as i64,
+            time_origin: join(words[6], words[7]) as i64,
+            transport_state: (words[8] != 0).into(),
+            transport_state_time: Instant::from_micros(join(words[9], words[10]) as i64),
+        }
+    }
+
+    /// Link's tempo representation: whole microseconds per beat.
+    #[allow(clippy::cast_possible_truncation)]
+    fn tempo_micros_per_beat(tempo: f64) -> i64 {
+        (60.0 * 1e6 / tempo).round() as i64
+    }
+
+    /// Get the tempo of the timeline in Beats Per Minute.
+    ///
+    /// See [`SessionState::tempo`].
+    #[must_use]
+    pub const fn tempo(&self) -> f64 {
+        self.tempo
+    }
+
+    /// Link's tempo representation, in whole microseconds per beat.
+    // Only used by PulseOutput, which the host feature leaves out.
+    #[cfg_attr(feature = "host", allow(dead_code))]
+    pub(crate) const fn micros_per_beat(&self) -> i64 {
+        self.micros_per_beat
+    }
+
+    /// Get the beat value at the timeline's [`time_origin`](Self::time_origin).
+    ///
+    /// Together with [`time_origin`](Self::time_origin) and
+    /// [`tempo`](Self::tempo), this defines the timeline's beat/time mapping.
+    /// Link treats the beat origin as a quantum boundary when phase-encoding
+    /// beats, so this is also the reference point for phase.
+    #[must_use]
+    pub fn beat_origin(&self) -> f64 {
+        floating(self.beat_origin)
+    }
+
+    /// Get the time of the timeline's [`beat_origin`](Self::beat_origin).
+    #[must_use]
+    pub const fn time_origin(&self) -> Instant {
+        Instant::from_micros(self.time_origin)
+    }
+
+    /// Get the transport state.
+    ///
+    /// See [`SessionState::transport_state`].
+    #[must_use]
+    pub const fn transport_state(&self) -> TransportState {
+        self.transport_state
+    }
+
+    /// Get the time associated with the transport state.
+    ///
+    /// See [`SessionState::transport_state_time`].
+    #[must_use]
+    pub const fn transport_state_time(&self) -> Instant {
+        self.transport_state_time
+    }
+
+    #[inline]
+    #[allow(clippy::cast_precision_loss)]
+    fn beats_at_micros(&self, time: i64) -> i64 {
+        self.beat_origin
+            + micro_beats((time - self.time_origin) as f64 / self.micros_per_beat as f64)
+    }
+
+    #[inline]
+    #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+    fn micros_at_beats(&self, beats: i64) -> i64 {
+        self.time_origin
+            + (floating(beats - self.beat_origin) * self.micros_per_beat as f64).round() as i64
+    }
+
+    /// Like [`beats_at_micros`](Self::beats_at_micros), in integers only.
+    #[inline]
+    const fn beats_at_micros_fixed(&self, time: i64) -> i64 {
+        self.beat_origin
+            + mul_div_round(
+                time - self.time_origin,
+                Beats::MICRO_BEATS_PER_BEAT,
+                self.micros_per_beat,
+            )
+    }
+
+    /// Like [`micros_at_beats`](Self::micros_at_beats), in integers only.
+    #[inline]
+    const fn micros_at_beats_fixed(&self, beats: i64) -> i64 {
+        self.time_origin
+            + mul_div_round(
+                beats - self.beat_origin,
+                self.micros_per_beat,
+                Beats::MICRO_BEATS_PER_BEAT,
+            )
+    }
+
+    /// Phase-encoded beat at `time`, in micro-beats.
+    #[inline]
+    fn encoded_beat_at(&self, time: i64, quantum: i64) -> i64 {
+        let beat = self.beats_at_micros(time);
+        closest_phase_match(beat, beat - self.beat_origin, quantum, half(quantum))
+    }
+
+    /// Like [`encoded_beat_at`](Self::encoded_beat_at), in integers only.
+    #[inline]
+    const fn encoded_beat_at_fixed(&self, time: i64, quantum: i64) -> i64 {
+        let beat = self.beats_at_micros_fixed(time);
+        closest_phase_match(beat, beat - self.beat_origin, quantum, half_fixed(quantum))
+    }
+
+    /// Undo the phase encoding of `beat`, giving the micro-beat on the
+    /// timeline whose time it occurs at.
+    #[inline]
+    const fn decoded_beat(&self, beat: i64, quantum: i64, half: i64) -> i64 {
+        let from_origin = beat - self.beat_origin;
+        let origin_offset = from_origin - phase(from_origin, quantum);
+        // Invert the phase calculation so that it rounds up in the middle
+        // instead of down like closest_phase_match, as Link does.
+        let inverse_phase_offset = closest_phase_match(
+            quantum - phase(from_origin, quantum),
+            quantum - phase(beat, quantum),
+            quantum,
+            half,
+        );
+        self.beat_origin + origin_offset + quantum - inverse_phase_offset
+    }
+
+    /// Get the beat value at the given time for the given quantum.
+    ///
+    /// Identical to [`SessionState::beat_at_time`], without an FFI call.
+    #[inline]
+    #[must_use]
+    pub fn beat_at_time(&self, time: Instant, quantum: f64) -> f64 {
+        floating(self.encoded_beat_at(time.as_micros(), micro_beats(quantum)))
+    }
+
+    /// Get the phase (position within a cycle) at the given time.
+    ///
+    /// Identical to [`SessionState::phase_at_time`], without an FFI call.
+    #[inline]
+    #[must_use]
+    pub fn phase_at_time(&self, time: Instant, quantum: f64) -> f64 {
+        let quantum = micro_beats(quantum);
+        floating(phase(
+            self.encoded_beat_at(time.as_micros(), quantum),
+            quantum,
+        ))
+    }
+
+    /// Get the time at which the given beat occurs for the given quantum.
+    ///
+    /// Identical to [`SessionState::time_at_beat`], without an FFI call.
+    #[inline]
+    #[must_use]
+    pub fn time_at_beat(&self, beat: f64, quantum: f64) -> Instant {
+        let beat = micro_beats(beat);
+        let quantum = micro_beats(quantum);
+        Instant::from_micros(self.micros_at_beats(self.decoded_beat(beat, quantum, half(quantum))))
+    }
+
+    /// Get the beat value at the given time for the given quantum, in fixed
+    /// point, without any floating-point operations.
+    ///
+    /// This is [`beat_at_time`](Self::beat_at_time) with the beat/time
+    /// conversions done in integers, so nothing needs the FPU. Link does
+    /// those conversions in `f64`, then rounds to whole micro-beats or
+    /// microseconds; here they are rounded exactly instead. The results are
+    /// the same, except where the rounding error of `f64` happens to cross a
+    /// rounding boundary. They then differ by one micro-beat (or, for
+    /// [`time_at_beat_fixed`](Self::time_at_beat_fixed), one microsecond),
+    /// and never by more, for any beat and time values Link can produce.
+    #[inline]
+    #[must_use]
+    pub const fn beat_at_time_fixed(&self, time: Instant, quantum: Beats) -> Beats {
+        Beats::from_micro_beats(
+            self.encoded_beat_at_fixed(time.as_micros(), quantum.as_micro_beats()),
+        )
+    }
+
+    /// Get the phase at the given time, in fixed point, without any
+    /// floating-point operations.
+    ///
+    /// See [`beat_at_time_fixed`](Self::beat_at_time_fixed) for how the
+    /// result compares to [`phase_at_time`](Self::phase_at_time).
+    #[inline]
+    #[must_use]
+    pub const fn phase_at_time_fixed(&self, time: Instant, quantum: Beats) -> Beats {
+        let quantum = quantum.as_micro_beats();
+        Beats::from_micro_beats(phase(
+            self.encoded_beat_at_fixed(time.as_micros(), quantum),
+            quantum,
+        ))
+    }
+
+    /// Get the time at which the given beat occurs, in fixed point, without
+    /// any floating-point operations.
+    ///
+    /// See [`beat_at_time_fixed`](Self::beat_at_time_fixed) for how the
+    /// result compares to [`time_at_beat`](Self::time_at_beat).
+    #[inline]
+    #[must_use]
+    pub const fn time_at_beat_fixed(&self, beat: Beats, quantum: Beats) -> Instant {
+        let quantum = quantum.as_micro_beats();
+        Instant::from_micros(self.micros_at_beats_fixed(self.decoded_beat(
+            beat.as_micro_beats(),
+            quantum,
+            half_fixed(quantum),
+        )))
+    }
+
+    /// Get the beat values at many times at once.
+    ///
+    /// See [`SessionState::beats_at_times`].
+    ///
+    /// # Panics
+    ///
+    /// Panics if `times` and `out` have different lengths.
+    pub fn beats_at_times(&self, times: &[Instant], quantum: f64, out: &mut [f64]) {
+        assert_eq!(
+            times.len(),
+            out.len(),
+            "times and out must have the same length"
+        );
+        let quantum = micro_beats(quantum);
+        for (out, time) in out.iter_mut().zip(times) {
+            *out = floating(self.encoded_beat_at(time.as_micros(), quantum));
+        }
+    }
+
+    /// Get the phases at many times at once.
+    ///
+    /// See [`SessionState::phases_at_times`].
+    ///
+    /// # Panics
+    ///
+    /// Panics if `times` and `out` have different lengths.
+    pub fn phases_at_times(&self, times: &[Instant], quantum: f64, out: &mut [f64]) {
+        assert_eq!(
+            times.len(),
+            out.len(),
+            "times and out must have the same length"
+        );
+        let quantum = micro_beats(quantum);
+        for (out, time) in out.iter_mut().zip(times) {
+            *out = floating(phase(
+                self.encoded_beat_at(time.as_micros(), quantum),
+                quantum,
+            ));
+        }
+    }
+
+    /// Get the beat value at every sample of an audio buffer.
+    ///
+    /// See [`SessionState::beats_for_buffer`].
+    pub fn beats_for_buffer(
+        &self,
+        start: Instant,
+        sample_rate: u32,
+        quantum: f64,
+        out: &mut [f64],
+    ) {
+        let quantum = micro_beats(quantum);
+        for (index, out) in out.iter_mut().enumerate() {
+            let time = sample_time(start, index, sample_rate);
+            *out = floating(self.encoded_beat_at(time, quantum));
+        }
+    }
+
+    /// Get the phase at every sample of an audio buffer.
+    ///
+    /// See [`SessionState::phases_for_buffer`].
+    pub fn phases_for_buffer(
+        &self,
+        start: Instant,
+        sample_rate: u32,
+        quantum: f64,
+        out: &mut [f64],
+    ) {
+        let quantum = micro_beats(quantum);
+        for (index, out) in out.iter_mut().enumerate() {
+            let time = sample_time(start, index, sample_rate);
+            *out = floating(phase(self.encoded_beat_at(time, quantum), quantum));
+        }
+    }
+}
+
+/// The time of sample `index` of a buffer starting at `start`, rounded to
+/// the nearest microsecond.
+#[inline]
+fn sample_time(start: Instant, index: usize, sample_rate: u32) -> i64 {
+    let sample_rate = i64::from(sample_rate);
+    #[allow(clippy::cast_possible_wrap)]
+    let index = index as i64;
+    start.as_micros() + (index * 1_000_000 + sample_rate / 2) / sample_rate
+}
+
+#[cfg(test)]
+pub(crate) mod tests {
+    use super::{Timeline, floating, micro_beats};
+    use crate::time::{Beats, Instant};
+
+    /// A xorshift generator, for reproducible values across the whole
+    /// range of an `i64` span.
+    pub(crate) struct Values(pub(crate) u64);
+
+    impl Values {
+        pub(crate) fn next_in(&mut self, span: i64) -> i64 {
+            self.0 ^= self.0 << 13;
+            self.0 ^= self.0 >> 7;
+            self.0 ^= self.0 << 17;
+            #[allow(clippy::cast_possible_wrap)]
+            let value = (self.0 >> 1) as i64;
+            value % (2 * span + 1) - span
+        }
+    }
+
+    /// The difference of two phases in `[0, quantum)`, across the wrap from
+    /// `quantum` to zero.
+    fn phase_difference(a: i64, b: i64, quantum: i64) -> i64 {
+        let difference = (a - b).abs();
+        difference.min(quantum - difference)
+    }
+
+    #[test]
+    fn fixed_point_matches_floating_point() {
+        // About 12 days of Link time and a million beats either way.
+        const TIME_SPAN: i64 = 1 << 40;
+        const BEAT_SPAN: i64 = 1_000_000 * Beats::MICRO_BEATS_PER_BEAT;
+
+        let mut values = Values(0x2545_f491_4f6c_dd1d);
+        let tempos = (20..=999).step_by(7).map(f64::from).chain([133.33, 999.0]);
+        for tempo in tempos {
+            for quantum in [1.0, 2.5, 3.0, 4.0, 7.0] {
+                let fixed_quantum = Beats::from_f64(quantum);
+                let quantum_micro_beats = micro_beats(quantum);
+                for _ in 0..4 {
+                    let timeline = Timeline::from_parts(
+                        tempo,
+                        values.next_in(BEAT_SPAN),
+                        values.next_in(TIME_SPAN),
+                    );
+                    for _ in 0..256 {
+                        let time = Instant::from_micros(values.next_in(TIME_SPAN));
+                        let beat = micro_beats(timeline.beat_at_time(time, quantum));
+                        let fixed = timeline.beat_at_time_fixed(time, fixed_quantum);
+                        assert!(
+                            (fixed.as_micro_beats() - beat).abs() <= 1,
+                            "beat at {time:?} with {timeline:?}, quantum {quantum}"
+                        );
+
+                        let phase = micro_beats(timeline.phase_at_time(time, quantum));
+                        let fixed = timeline.phase_at_time_fixed(time, fixed_quantum);
+                        assert!(
+                            phase_difference(fixed.as_micro_beats(), phase, quantum_micro_beats)
+                                <= 1,
+                            "phase at {time:?} with {timeline:?}, quantum {quantum}"
+                        );
+
+                        let beat = values.next_in(BEAT_SPAN);
+                        let time = timeline.time_at_beat(floating(beat), quantum);
+                        let fixed = timeline
+                            .time_at_beat_fixed(Beats::from_micro_beats(beat), fixed_quantum);
+                        assert!(
+                            (fixed - time).as_micros().abs() <= 1,
+                            "time at {beat} micro-beats with {timeline:?}, quantum {quantum}"
+                        );
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn words_round_trip() {
+        let mut values = Values(0x9e37_79b9_7f4a_7c15);
+        for tempo in [20.0, 120.0, 133.33, 999.0] {
+            for playing in [false, true] {
+                let timeline = Timeline {
+                    transport_state: playing.into(),
+                    transport_state_time: Instant::from_micros(values.next_in(1 << 40)),
+                    ..Timeline::from_parts(tempo, values.next_in(1 << 50), values.next_in(1 << 40))
+                };
+                let decoded = Timeline::from_words(timeline.to_words());
+                assert_eq!(decoded, timeline);
+                assert_eq!(decoded.micros_per_beat(), timeline.micros_per_beat);
+            }
+        }
+    }
+}
@@ -0,0 +1,409 @@
+//! Quantized transport start and stop, with the launch precomputed for the
+//! audio thread.
+
+use std::sync::Arc;
+
+use crate::{
+    Link, LinkError, SessionState, TransportState, double_buffer::DoubleBuffer, time::Instant,
+    timeline::Timeline,
+};
+
+const WORDS: usize = Timeline::WORDS + 4;
+
+/// A transport start or stop, with everything needed to act on it without
+/// calling into Link.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Launch {
+    /// Whether the transport starts or stops.
+    pub state: TransportState,
+    /// The Link clock time at which it does.
+    pub time: Instant,
+    /// The beat at that time: the beat playback starts from, or the beat it
+    /// stops at.
+    pub beat: f64,
+    /// The session timeline the launch was computed from, which maps the
+    /// beats before and after it.
+    pub timeline: Timeline,
+}
+
+impl Launch {
+    /// Check whether the transport is playing at `time`, according to this
+    /// launch.
+    #[must_use]
+    pub fn is_playing_at(&self, time: Instant) -> bool {
+        match self.state {
+            TransportState::Play => time >= self.time,
+            TransportState::Stop => time < self.time,
+        }
+    }
+
+    #[allow(clippy::cast_possible_truncation)]
+    fn to_words(self) -> [u32; WORDS] {
+        let mut words = [0; WORDS];
+        words[..Timeline::WORDS].copy_from_slice(&self.timeline.to_words());
+        let beat = self.beat.to_bits();
+        let time = self.time.as_micros().cast_unsigned();
+        words[Timeline::WORDS..].copy_from_slice(&[
+            beat as u32,
+            (beat >> 32) as u32,
+            time as u32,
+            (time >> 32) as u32,
+        ]);
+        words
+    }
+
+    fn from_words(words: [u32; WORDS]) -> Self {
+        let join = |i: usize| u64::from(words[i]) | (u64::from(words[i + 1]) << 32);
+        let mut timeline = [0; Timeline::WORDS];
+        timeline.copy_from_slice(&words[..Timeline::WORDS]);
+        let timeline = Timeline::from_words(timeline);
+        Self {
+            state: timeline.transport_state(),
+            time: Instant::from_micros(join(Timeline::WORDS + 2).cast_signed()),
+            beat: f64::from_bits(join(Timeline::WORDS)),
+            timeline,
+        }
+    }
+}
+
+/// Starts and stops the transport in phase with the session, and hands each
+/// launch to other tasks as a precomputed [`Launch`].
+///
+/// Starting in phase normally means capturing a session state, starting the
+/// transport with a beat request, committing, then capturing again and again
+/// to see when the start time has passed. A `Transport` does one capture and
+/// one commit per start or stop, and computes the launch time and beat
+/// mapping from that single snapshot. Other tasks, such as the audio
+/// callback, read the launch through a [`LaunchReader`] without locking or
+/// FFI calls, and can compare it against their own buffer times until it
+/// is due.
+///
+/// Starts are mapped to beat 0 at the next bar: alone, playback starts
+/// right away; with peers, at the next time the session is at phase zero of
+/// the quantum. Stops take effect at the start of the next bar.
+///
+/// Starts and stops by other peers arrive through Link's transport state
+/// callback. Forward them to [`sync`](Self::sync), for example from an
+/// [`EventReceiver`](crate::EventReceiver), which maps playback to beat 0
+/// for those starts too and publishes their launch.
+///
+/// Transport sync must be enabled with
+/// [`Link::enable_transport_sync`](crate::Link::enable_transport_sync) for
+/// starts and stops to be shared with peers.
+///
+/// # Example
+///
+/// ```no_run
+/// use esp_idf_ableton_link::{Link, LinkEventKind, Transport};
+///
+/// let mut link = Link::new(120.0).unwrap();
+/// link.enable_transport_sync();
+/// link.enable();
+/// let mut events = link.event_queue::<8>().unwrap();
+/// let mut transport = Transport::new(4.0).unwrap();
+/// let launches = transport.reader();
+///
+/// # let buffer_time = esp_idf_ableton_link::Instant::default();
+/// std::thread::spawn(move || loop {
+///     // In the audio callback, with the Link time of the buffer:
+///     if let Some(launch) = launches.launch() {
+///         if launch.is_playing_at(buffer_time) {
+///             let beat = launch.timeline.beat_at_time(buffer_time, 4.0);
+///             log::info!("Playing beat {beat}");
+///         }
+///     }
+/// });
+///
+/// transport.start(&mut link);
+/// loop {
+///     if let LinkEventKind::TransportState(_) = events.recv().kind {
+///         transport.sync(&mut link);
+///     }
+/// }
+/// ```
+pub struct Transport {
+    state: SessionState,
+    quantum: f64,
+    launch: Option<Launch>,
+    shared: Arc<DoubleBuffer<WORDS>>,
+}
+
+impl Transport {
+    /// Create a transport helper that quantizes to `quantum` beats.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`LinkError::AllocationFailed`] if the session state used for
+    /// capturing could not be allocated.
+    pub fn new(quantum: f64) -> Result<Self, LinkError> {
+        Ok(Self {
+            state: SessionState::new()?,
+            quantum,
+            launch: None,
+            shared: Arc::new(DoubleBuffer::new()),
+        })
+    }
+
+    /// Start the transport at beat 0, in phase with the session, and publish
+    /// the launch.
+    pub fn start(&mut self, link: &mut Link) -> Launch {
+        let now = link.clock_now();
+        link.capture_app_session_state_into(&mut self.state);
+        self.state
+            .start_transport_and_request_beat_at(0.0, now, self.quantum);
+        link.commit_app_session_state(&self.state);
+        self.publish_start()
+    }
+
+    /// Stop the transport at the start of the next bar, and publish the
+    /// launch.
+    pub fn stop(&mut self, link: &mut Link) -> Launch {
+        let now = link.clock_now();
+        link.capture_app_session_state_into(&mut self.state);
+        let timeline = self.state.timeline();
+        let beat = timeline.beat_at_time(now, self.quantum);
+        let bar = beat - timeline.phase_at_time(now, self.quantum) + self.quantum;
+        self.state
+            .stop_transport_at(timeline.time_at_beat(bar, self.quantum));
+        link.commit_app_session_state(&self.state);
+        self.publish_stop()
+    }
+
+    /// Pick up a start or stop by another peer, and publish its launch.
+    ///
+    /// Call this when Link reports a transport state change. Starts are
+    /// mapped to beat 0 like those made with [`start`](Self::start). If the
+    /// transport state is the one already published, this does nothing but
+    /// the capture.
+    ///
+    /// Returns the new launch, if there is one.
+    pub fn sync(&mut self, link: &mut Link) -> Option<Launch> {
+        link.capture_app_session_state_into(&mut self.state);
+        let state = self.state.transport_state();
+        let time = self.state.transport_state_time();
+        if self.launch.is_some_and(|launch| {
+            launch.state == state && launch.timeline.transport_state_time() == time
+        }) {
+            return None;
+        }
+        Some(match state {
+            TransportState::Play => {
+                self.state
+                    .request_beat_at_transport_state_time(0.0, self.quantum);
+                link.commit_app_session_state(&self.state);
+                self.publish_start()
+            }
+            TransportState::Stop => self.publish_stop(),
+        })
+    }
+
+    fn publish_start(&mut self) -> Launch {
+        let timeline = self.state.timeline();
+        self.publish(Launch {
+            state: TransportState::Play,
+            time: timeline.time_at_beat(0.0, self.quantum),
+            beat: 0.0,
+            timeline,
+        })
+    }
+
+    fn publish_stop(&mut self) -> Launch {
+        let timeline = self.state.timeline();
+        let time = timeline.transport_state_time();
+        self.publish(Launch {
+            state: TransportState::Stop,
+            time,
+            beat: timeline.beat_at_time(time, self.quantum),
+            timeline,
+        })
+    }
+
+    fn publish(&mut self, launch: Launch) -> Launch {
+        self.shared.store(launch.to_words());
+        self.launch = Some(launch);
+        launch
+    }
+
+    /// Get the last launch published.
+    #[must_use]
+    pub const fn launch(&self) -> Option<Launch> {
+        self.launch
+    }
+
+    /// Get the quantum that starts and stops are aligned to.
+    #[must_use]
+    pub const fn quantum(&self) -> f64 {
+        self.quantum
+    }
+
+    /// Get a handle for reading launches from other tasks.
+    #[must_use]
+    pub fn reader(&self) -> LaunchReader {
+        LaunchReader {
+            shared: Arc::clone(&self.shared),
+        }
+    }
+}
+
+/// Reads the launches of a [`Transport`] from any task, including the audio
+/// thread.
+///
+/// Created by [`Transport::reader`]. Readers are `Clone`, `Send` and `Sync`.
+/// Reading never blocks, allocates or calls into Link: if a launch is
+/// published during a read, the read is retried.
+#[derive(Clone)]
+pub struct LaunchReader {
+    shared: Arc<DoubleBuffer<WORDS>>,
+}
+
+impl LaunchReader {
+    /// Get the latest launch, or `None` if the transport hasn't started or
+    /// stopped yet.
+    #[must_use]
+    pub fn launch(&self) -> Option<Launch> {
+        let (generation, words) = self.shared.load();
+        (generation != 0).then(|| Launch::from_words(words))
+    }
+
+    /// Get the number of launches published so far, wrapping at 2^31.
+    #[must_use]
+    pub fn generation(&self) -> u32 {
+        self.shared.generation()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{Launch, Transport};
+    use crate::{
+        Link, SessionState, TransportState, host::session_test, time::Instant, timeline::Timeline,
+    };
+
+    const QUANTUM: f64 = 4.0;
+
+    /// Assert that `time` is at phase zero of the quantum, to within the
+    /// rounding of a time to microseconds.
+    fn assert_downbeat(timeline: &Timeline, time: Instant) {
+        let phase = timeline.phase_at_time(time, QUANTUM);
+        assert!(
+            phase < 1e-5 || QUANTUM - phase < 1e-5,
+            "phase {phase} at {time:?}"
+        );
+    }
+
+    fn eventually(mut done: impl FnMut() -> bool) {
+        let deadline = std::time::Instant::now() + std::time::Duration::from_secs(5);
+        while !done() {
+            assert!(std::time::Instant::now() < deadline, "timed out");
+            std::thread::sleep(std::time::Duration::from_millis(1));
+        }
+    }
+
+    #[test]
+    fn launch_words_round_trip() {
+        let mut state = SessionState::new().unwrap();
+        state.set_tempo(133.7, Instant::from_micros(0));
+        state.force_beat_at_time(-12.345_678, Instant::from_micros(987_654_321_012), 3.0);
+        for playing in [TransportState::Stop, TransportState::Play] {
+            state.set_transport_state_at(playing, Instant::from_micros(-42));
+            let launch = Launch {
+                state: playing,
+                time: Instant::from_micros(-1_234_567_890_123),
+                beat: -3.25,
+                timeline: state.timeline(),
+            };
+            assert_eq!(Launch::from_words(launch.to_words()), launch);
+        }
+    }
+
+    #[test]
+    fn starts_right_away_alone() {
+        let mut link = Link::new(120.0).unwrap();
+        let mut transport = Transport::new(QUANTUM).unwrap();
+        let before = link.clock_now();
+        let start = transport.start(&mut link);
+        assert!(before <= start.time && start.time <= link.clock_now());
+        assert_eq!(start.state, TransportState::Play);
+        assert!(start.timeline.beat_at_time(start.time, QUANTUM).abs() < 1e-5);
+        assert!(start.is_playing_at(start.time));
+        assert!(!start.is_playing_at(start.time.sub_micros(1)));
+    }
+
+    #[test]
+    fn starts_on_the_next_downbeat_with_peers() {
+        let _session = session_test();
+        let mut peer = Link::new(120.0).unwrap();
+        peer.enable();
+        // Put the session mid-bar.
+        let mut state = peer.capture_app_session_state().unwrap();
+        state.force_beat_at_time(1.5, peer.clock_now(), QUANTUM);
+        peer.commit_app_session_state(&state);
+
+        let mut link = Link::new(120.0).unwrap();
+        link.enable();
+        let mut transport = Transport::new(QUANTUM).unwrap();
+        let now = link.clock_now();
+        let start = transport.start(&mut link);
+
+        // A bar is two seconds at 120 BPM.
+        assert!(start.time > now, "{start:?}");
+        assert!((start.time - now).as_micros() <= 2_000_000, "{start:?}");
+        peer.capture_app_session_state_into(&mut state);
+        assert_downbeat(&state.timeline(), start.time);
+        // And playback starts from beat 0 there.
+        assert!(start.timeline.beat_at_time(start.time, QUANTUM).abs() < 1e-5);
+    }
+
+    #[test]
+    fn stops_at_the_next_bar() {
+        let mut link = Link::new(120.0).unwrap();
+        let mut transport = Transport::new(QUANTUM).unwrap();
+        let reader = transport.reader();
+        assert_eq!(reader.launch(), None);
+        let start = transport.start(&mut link);
+        assert_eq!(reader.launch(), Some(start));
+
+        let now = link.clock_now();
+        let stop = transport.stop(&mut link);
+        assert_eq!(stop.state, TransportState::Stop);
+        assert!(stop.time > now);
+        assert_downbeat(&stop.timeline, stop.time);
+        assert!((stop.beat - QUANTUM).abs() < 1e-5, "{stop:?}");
+        assert!(stop.is_playing_at(stop.time.sub_micros(1)));
+        assert!(!stop.is_playing_at(stop.time));
+        assert_eq!(reader.launch(), Some(stop));
+        assert_eq!(reader.generation(), 2);
+        // Already published, so there is nothing to pick up.
+        assert_eq!(transport.sync(&mut link), None);
+    }
+
+    #[test]
+    fn syncs_a_start_by_another_peer() {
+        let _session = session_test();
+        let mut peer = Link::new(120.0).unwrap();
+        let mut link = Link::new(120.0).unwrap();
+        for instance in [&peer, &link] {
+            instance.enable_transport_sync();
+            instance.enable();
+        }
+        let mut transport = Transport::new(QUANTUM).unwrap();
+        let reader = transport.reader();
+
+        let started = Transport::new(QUANTUM).unwrap().start(&mut peer);
+        let mut state = SessionState::new().unwrap();
+        eventually(|| {
+            link.capture_app_session_state_into(&mut state);
+            state.transport_state() == TransportState::Play
+        });
+
+        let launch = transport.sync(&mut link).unwrap();
+        assert_eq!(launch.state, TransportState::Play);
+        assert!(
+            (launch.time - started.time).as_micros().abs() <= 1,
+            "{launch:?}"
+        );
+        assert!(launch.timeline.beat_at_time(launch.time, QUANTUM).abs() < 1e-5);
+        assert_eq!(reader.launch(), Some(launch));
+        assert_eq!(transport.sync(&mut link), None);
+    }
+}